@@ -0,0 +1,265 @@
+#include "AllocStats.h"
+
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <new>
+#include <cstddef>
+
+namespace {
+	struct Counters {
+		std::atomic<uint64_t> allocations, bytes, peak;
+		std::atomic<int64_t> live; // bytes of the blocks charged here that are not freed yet
+	};
+
+	// what a block was charged with, kept in front of it until it is freed
+	struct Charge {
+		size_t size; // 0 if the block was allocated while accounting was off
+		Counters *phase, *prototype;
+	};
+
+	struct PrototypeCounters {
+		std::string name;
+		Counters counters;
+	};
+
+	std::atomic<bool> active(false);
+	std::atomic<int64_t> live(0);
+	std::atomic<uint64_t> globalPeak(0);
+	Counters phases[Stats::NUM_PHASES + 1];
+
+	thread_local int currentPhase = Stats::NONE;
+	thread_local PrototypeCounters *currentPrototype = nullptr;
+
+	std::mutex &prototypesMutex() {
+		static std::mutex mutex;
+		return mutex;
+	}
+
+	std::map<std::string, std::unique_ptr<PrototypeCounters> > &prototypes() {
+		static std::map<std::string, std::unique_ptr<PrototypeCounters> > prototypes;
+		return prototypes;
+	}
+
+	inline void raise(std::atomic<uint64_t> &peak, int64_t value) {
+		if (value <= 0) {
+			return;
+		}
+		uint64_t old = peak.load(std::memory_order_relaxed);
+		while ((uint64_t)value > old && !peak.compare_exchange_weak(old, value, std::memory_order_relaxed));
+	}
+
+	inline void charge(Counters &counters, size_t size) {
+		counters.allocations.fetch_add(1, std::memory_order_relaxed);
+		counters.bytes.fetch_add(size, std::memory_order_relaxed);
+		raise(counters.peak, counters.live.fetch_add(size, std::memory_order_relaxed) + size);
+	}
+
+	inline Charge allocated(size_t size) {
+		raise(globalPeak, live.fetch_add(size, std::memory_order_relaxed) + size);
+		Charge c = {size, &phases[currentPhase], currentPrototype ? &currentPrototype->counters : nullptr};
+		charge(*c.phase, size);
+		if (c.prototype) {
+			charge(*c.prototype, size);
+		}
+		return c;
+	}
+
+	// the live sizes go down where the block was charged, whatever is current now
+	inline void freed(const Charge &c) {
+		live.fetch_sub(c.size, std::memory_order_relaxed);
+		c.phase->live.fetch_sub(c.size, std::memory_order_relaxed);
+		if (c.prototype) {
+			c.prototype->live.fetch_sub(c.size, std::memory_order_relaxed);
+		}
+	}
+}
+
+#ifdef LUADISASS_ALLOC_STATS
+
+// Every block starts with a header holding its Charge. Frees give back exactly what was charged,
+// to the phase and prototype that were charged, so blocks that outlive enable(), disable() or
+// their phase keep every live size right, and no allocator query is needed.
+namespace {
+	const size_t HEADER = (sizeof(Charge) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+	void *allocate(std::size_t size) {
+		void *block = std::malloc(HEADER + size);
+		if (!block) {
+			throw std::bad_alloc();
+		}
+		Charge c = {0, nullptr, nullptr};
+		if (active.load(std::memory_order_relaxed)) {
+			c = allocated(size ? size : 1);
+		}
+		*static_cast<Charge*>(block) = c;
+		return static_cast<char*>(block) + HEADER;
+	}
+
+	void release(void *p) {
+		if (!p) {
+			return;
+		}
+		void *block = static_cast<char*>(p) - HEADER;
+		const Charge &c = *static_cast<Charge*>(block);
+		if (c.size) {
+			freed(c);
+		}
+		std::free(block);
+	}
+}
+
+void *operator new(std::size_t size) {
+	return allocate(size);
+}
+
+void *operator new[](std::size_t size) {
+	return allocate(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+	try {
+		return allocate(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+	try {
+		return allocate(size);
+	} catch (...) {
+		return nullptr;
+	}
+}
+
+void operator delete(void *p) noexcept {
+	release(p);
+}
+
+void operator delete[](void *p) noexcept {
+	release(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+	release(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+	release(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void *p, std::size_t) noexcept {
+	release(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept {
+	release(p);
+}
+#endif
+
+#endif
+
+namespace AllocStats {
+	bool enable() {
+#ifdef LUADISASS_ALLOC_STATS
+		active = true;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void disable() {
+		active = false;
+	}
+
+	bool enabled() {
+		return active;
+	}
+
+	void setPhase(Stats::Phase phase) {
+		currentPhase = phase;
+	}
+
+	void *setPrototype(const std::string &name) {
+		PrototypeCounters *previous = currentPrototype;
+		if (!active.load(std::memory_order_relaxed)) {
+			return previous;
+		}
+
+		std::lock_guard<std::mutex> lock(prototypesMutex());
+		std::unique_ptr<PrototypeCounters> &entry = prototypes()[name];
+		if (!entry) {
+			entry.reset(new PrototypeCounters());
+			entry->name = name;
+		}
+		currentPrototype = entry.get();
+		return previous;
+	}
+
+	void restorePrototype(void *previous) {
+		currentPrototype = reinterpret_cast<PrototypeCounters*>(previous);
+	}
+
+	Usage phase(Stats::Phase phase) {
+		Counters &c = phases[phase];
+		return Usage{c.allocations, c.bytes, c.peak};
+	}
+
+	uint64_t peak() {
+		return globalPeak;
+	}
+
+	std::string report(size_t top) {
+		std::string out;
+		char line[160];
+
+		std::snprintf(line, sizeof(line), "%-24s %12s %14s %14s\n", "phase", "allocations", "bytes", "peak live");
+		out += line;
+
+		std::vector<std::pair<uint64_t, int> > order;
+		for (int i = 0; i <= Stats::NUM_PHASES; i++) {
+			order.push_back(std::make_pair(phases[i].bytes.load(), i));
+		}
+		std::sort(order.rbegin(), order.rend());
+		for (auto &p : order) {
+			Counters &c = phases[p.second];
+			if (c.allocations == 0) {
+				continue;
+			}
+			std::snprintf(line, sizeof(line), "%-24s %12llu %14llu %14llu\n", Stats::phaseName((Stats::Phase)p.second),
+				(unsigned long long)c.allocations, (unsigned long long)c.bytes, (unsigned long long)c.peak);
+			out += line;
+		}
+		std::snprintf(line, sizeof(line), "peak live heap: %llu bytes\n\n", (unsigned long long)globalPeak.load());
+		out += line;
+
+		std::vector<PrototypeCounters*> protos;
+		{
+			std::lock_guard<std::mutex> lock(prototypesMutex());
+			for (auto &it : prototypes()) {
+				protos.push_back(it.second.get());
+			}
+		}
+		std::sort(protos.begin(), protos.end(), [](PrototypeCounters *a, PrototypeCounters *b) {
+			return a->counters.bytes > b->counters.bytes;
+		});
+
+		std::snprintf(line, sizeof(line), "%-24s %12s %14s %14s\n", "prototype", "allocations", "bytes", "peak live");
+		out += line;
+		for (size_t i = 0; i < protos.size() && i < top; i++) {
+			Counters &c = protos[i]->counters;
+			std::snprintf(line, sizeof(line), "%-24s %12llu %14llu %14llu\n", protos[i]->name.c_str(),
+				(unsigned long long)c.allocations, (unsigned long long)c.bytes, (unsigned long long)c.peak);
+			out += line;
+		}
+		return out;
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef ALLOCSTATS_H
+#define ALLOCSTATS_H
+
+#include "Stats.h"
+#include <string>
+#include <stdint.h>
+
+// Allocation accounting. Builds with LUADISASS_ALLOC_STATS replace the global operator new/delete
+// by counting hooks; once enabled, every allocation is charged to the phase (see Stats::Scope) and
+// prototype that is current on the allocating thread. While disabled the hooks only test a flag.
+namespace AllocStats {
+	struct Usage {
+		uint64_t allocations, bytes, peak; // peak = most bytes charged here that were alive at once
+	};
+
+	bool enable(); // returns false if the hooks are not built in
+	void disable();
+	bool enabled();
+
+	void setPhase(Stats::Phase phase);
+
+	void *setPrototype(const std::string &name); // returns the previous prototype for restorePrototype
+	void restorePrototype(void *previous);
+
+	// charges allocations of the current thread to a prototype for the lifetime of the scope
+	class Prototype {
+	public:
+		inline Prototype(const std::string &name) : previous_(setPrototype(name)) {}
+		inline ~Prototype() {
+			restorePrototype(previous_);
+		}
+	private:
+		Prototype(const Prototype &) = delete;
+		Prototype &operator=(const Prototype &) = delete;
+
+		void *previous_;
+	};
+
+	Usage phase(Stats::Phase phase);
+	uint64_t peak();
+
+	std::string report(size_t top = 10);
+}
+
+#endif
@@ -1,22 +1,28 @@
 ﻿#include "Assembler.h"
 
+#include <atomic>
 #include <cstring>
 #include <limits>
+#include <thread>
 #include "util.h"
 #include "opcodes.h"
+#include "CharClass.h"
+#include "AllocStats.h"
+#include "Liveness.h"
+#include "Optimizer.h"
 
 
-Assembler::Assembler(Buffer *rbuffer, WriteBufferPtr wbuffer) : rbuffer_(rbuffer), wbuffer_(wbuffer), parseStatus_(PARSE_NONE), funcid_(-1), bUpvalues_(false) {
+Assembler::Assembler(Buffer *rbuffer, WriteBufferPtr wbuffer) : wbuffer_(wbuffer), rbuffer_(rbuffer), stats_(nullptr), stackMode_(STACK_KEEP), optimizations_(0), strip_(STRIP_NONE), format_(ChunkFormat::native()), threads_(1), parseStatus_(PARSE_NONE), bUpvalues_(false), streaming_(false), funcid_(-1), f_loadkx_(0) {
 
 }
 
 inline const char *parseLabel(std::string &out, const char *start, const char *end) {
-	start = std::find_if_not(start, end, std::ptr_fun<int, int>(std::isblank));
+	start = std::find_if_not(start, end, CharClass::isBlank);
 	if (start == end || *start == ';') {
 		return nullptr;
 	}
 
-	const char *lend = std::find_if_not(start, end, [](char c) {return std::isalnum(c) || c == '_'; });
+	const char *lend = std::find_if_not(start, end, CharClass::isIdent);
 	if (lend == start) {
 		return nullptr;
 	}
@@ -27,7 +33,7 @@ inline const char *parseLabel(std::string &out, const char *start, const char *e
 
 template<typename T>
 inline const char *parseInt(T &out, const char *start, const char *end) {
-	start = std::find_if_not(start, end, std::ptr_fun<int, int>(std::isblank));
+	start = std::find_if_not(start, end, CharClass::isBlank);
 	if (start == end || *start == ';') {
 		return nullptr;
 	}
@@ -48,7 +54,7 @@ inline const char *parseInt(T &out, const char *start, const char *end) {
 		}
 	}
 
-	const char *iend = std::find_if_not(start, end, std::ptr_fun<int, int>(std::isdigit));
+	const char *iend = std::find_if_not(start, end, CharClass::isDigit);
 	if (iend == start) {
 		return nullptr;
 	}
@@ -66,47 +72,24 @@ inline const char *parseInt(T &out, const char *start, const char *end) {
 	return iend;
 }
 
-std::string Assembler::get_line_comment_from_asm_line_code(const char *line, size_t len)
+// the line number of a ";L<digits>;<other comment>" comment, -1 for none
+int Assembler::get_linenumber_from_asm_line_comment(const char *comment, const char *end)
 {
-  std::string line_comment;
-  const char *comment_start = nullptr;
-  for (auto i = line + 1; i < line + len; ++i) {
-    if (*i == ';') {
-      comment_start = i;
-      break;
-    }
-  }
-  if (comment_start) {
-    line_comment.assign(comment_start, line + len);
+  if (end - comment < 4 || comment[0] != ';' || comment[1] != 'L') {
+    return -1;
   }
-  return line_comment;
-}
-
-int Assembler::get_linenumber_from_asm_line_comment(std::string line_comment)
-{
-  int linenumber = -1;
-  if (line_comment.size() >= 3 && line_comment[0] == ';' && line_comment[1] == 'L')
-  {
-    std::vector<char> line_number_chars;
-    for (size_t i = 2; i < line_comment.length(); ++i)
-    {
-      auto ic = line_comment[i];
-      if (isdigit(ic)) {
-        line_number_chars.push_back(ic);
-      }
-      else {
-        break;
-      }
-    }
-    line_number_chars.push_back('\0');
-    if (line_comment.length() >= 2 + line_number_chars.size() - 1 + 1
-      && line_comment[2 + line_number_chars.size() - 1] == ';' && line_number_chars.size() >= 2) {
-      // this is ";L<digit>;" + other line comment style
-      std::string line_number_str(line_number_chars.data());
-      linenumber = std::stoi(line_number_str);
+  long long linenumber = 0;
+  const char *c = comment + 2;
+  for (; c != end && CharClass::isDigit(*c); ++c) {
+    linenumber = linenumber * 10 + (*c - '0');
+    if (linenumber > std::numeric_limits<int>::max()) {
+      return -1;
     }
   }
-  return linenumber;
+  if (c == comment + 2 || c == end || *c != ';') {
+    return -1;
+  }
+  return (int)linenumber;
 }
 
 inline Util::BoolRes Assembler::parseDirective(const char *line, size_t len) {
@@ -114,10 +97,9 @@ inline Util::BoolRes Assembler::parseDirective(const char *line, size_t len) {
     // line's first char is '.'
 	const char *c = line + 1;
 	const char *end = line + len;
-    const char *comment_start = nullptr; // line comment start position
 	for (; c != end; c++) {
-		if (!(std::isalnum(*c) || *c == '_')) {
-			if (std::isblank(*c) || *c == ';') {
+		if (!CharClass::isIdent(*c)) {
+			if (CharClass::isBlank(*c) || *c == ';') {
 				if (*c == ';') {
 					end = --c;
 				}
@@ -126,20 +108,12 @@ inline Util::BoolRes Assembler::parseDirective(const char *line, size_t len) {
 			return Util::BoolRes(false, std::string("could not parse directive: illegal character '") + *c + "'");
 		}
 	}
-    for (auto i = line + 1; i < line + len; ++i) {
-      if (*i == ';') {
-        comment_start = i;
-        break;
-      }
-    }
     // here c is the end position of directive name
 	name.assign(&line[1], c);
     
 	if (name.empty()) {
 		return Util::BoolRes(false, "could not parse directive");
 	}
-    auto line_comment = get_line_comment_from_asm_line_code(line, len);
-    int linenumber = get_linenumber_from_asm_line_comment(line_comment);
 
 	Util::lower(name);
 	if (name == "upvalues") {
@@ -161,12 +135,18 @@ inline Util::BoolRes Assembler::parseDirective(const char *line, size_t len) {
 				return res;
 			}
 		}
+		locations_.clear(); // labels are local to their function
 
 		if ((c = parseLabel(funcname_, c, end)) == nullptr) {
 			return Util::BoolRes(false, "invalid args for directive .func");
 		}
 
-		if ((c = parseInt(f_maxstacksize_, c, end)) == nullptr) {
+		const char *arg = std::find_if_not(c, end, CharClass::isBlank);
+		f_autostack_ = end - arg >= 4 && std::strncmp(arg, "auto", 4) == 0 && (arg + 4 == end || CharClass::isBlank(arg[4]));
+		if (f_autostack_) {
+			f_maxstacksize_ = 0;
+			c = arg + 4;
+		} else if ((c = parseInt(f_maxstacksize_, c, end)) == nullptr) {
 			return Util::BoolRes(false, "invalid args for directive .func");
 		}
 		if ((c = parseInt(f_params_, c, end)) == nullptr) {
@@ -178,6 +158,7 @@ inline Util::BoolRes Assembler::parseDirective(const char *line, size_t len) {
 		if (f_vararg_ > 2) {
 			return Util::BoolRes(false, "vararg cannot be greater than 2");
 		}
+		AllocStats::setPrototype(funcname_);
 
 		funcid_++;
 		parseStatus_ = PARSE_FUNC;
@@ -227,129 +208,33 @@ const char *Assembler::parseConstant(const char *start, const char *end, size_t
 	const char *c = start;
 	const char *bend;
 
-	char cf = std::tolower(start[0]);
+	char cf = CharClass::lower(start[0]);
 
 	TValuePtr tval;
 
 	if (cf == '\'' || cf == '"') { // parse string
 		std::string string;
-
-		c++;
-		for (; c != end; ++c) {
-			if (*c == '\\') {
-				if (c + 1 == end) {
-					return nullptr;
-				}
-				switch (*(++c)) {
-					case 'a':
-						string += '\a';
-						break;
-					case 'b':
-						string += '\b';
-						break;
-					case 'f':
-						string += '\f';
-						break;
-					case 'n':
-						string += '\n';
-						break;
-					case 'r':
-						string += '\r';
-						break;
-					case 't':
-						string += '\t';
-						break;
-					case 'v':
-						string += '\v';
-						break;
-					case '\\':
-						string += '\\';
-						break;
-					case '"':
-						string += '"';
-						break;
-					case '\'':
-						string += '\'';
-						break;
-					case '[':
-						string += '[';
-						break;
-					case ']':
-						string += ']';
-						break;
-				}
-			} else if (*c == cf) {
-				tval.reset(new TString(string));
-				bend = c + 1;
-				break;
-			} else {
-				string += *c;
-			}
+		const char *close = StringEscape::unescape(c + 1, end, cf, string);
+		if (close == nullptr) {
+			return nullptr;
 		}
+		tval.reset(new TString(std::move(string)));
+		bend = close + 1;
 	}
-	else if (std::isdigit(cf) || (cf == '-' || cf == '+')) { // parse number
-		bool negative = false;
-		lua_Number num = 0;
-
-		if (cf == '-' || cf == '+') {
-			if (cf == '-') {
-				negative = true;
-			}
-			if (++c == end) {
-				return nullptr;
-			}
-		}
-
-		bool hex = false;
-		if (cf == '0' && c + 1 != end && *(c + 1) == 'x') {
-			// hexadecimal
-			hex = true;
-			c+=2;
+	else if (CharClass::isDigit(cf) || cf == '-' || cf == '+' || cf == '.') { // parse number, without a decimal point or exponent it is an integer
+		lua_Number num;
+		lua_Integer inum;
+		bool isInteger;
+		if ((bend = NumberFormat::parse(c, end, num, inum, isInteger)) == nullptr) {
+			return nullptr;
 		}
-
-		if (hex) {
-			for (; c != end; ++c) {
-				if (std::isxdigit(*c)) {
-					cf = *c;
-					if (cf <= '9' && cf >= '0') {
-						num = num * 16 + (cf - '0');
-					} else {
-						cf = std::tolower(cf);
-						num = num * 16 + (cf - 'a' + 10);
-					}
-				} else {
-					break;
-				}
-			}
+		if (isInteger) {
+			tval.reset(new TInteger(inum));
 		} else {
-			lua_Number frac = 0;
-			bool dpart = false;
-			for (; c != end; ++c) {
-				if (std::isdigit(*c)) {
-					if (dpart) {
-						num += frac * (*c - '0');
-						frac *= 0.1;
-					} else {
-						num = num * 10 + (*c - '0');
-					}
-				} else if (*c == '.' && !dpart) {
-					dpart = true;
-					frac = 0.1;
-				} else {
-					break;
-				}
-			}
-		}
-
-		if (negative) {
-			num *= -1;
+			tval.reset(new TNumber(num));
 		}
-
-		tval.reset(new TNumber(num));
-		bend = c;
-
-	} else if (cf == 't' || cf == 'f' || cf == 'n') { // possibly true, false, or nil
-		bend = std::find_if_not(c, end, std::ptr_fun<int, int>(std::isalpha));
+	} else if (cf == 't' || cf == 'f' || cf == 'n' || cf == 'i') { // possibly true, false, nil, inf or nan
+		bend = std::find_if_not(c, end, CharClass::isAlpha);
 		if (bend == c) {
 			return nullptr;
 		}
@@ -362,6 +247,14 @@ const char *Assembler::parseConstant(const char *start, const char *end, size_t
 			tval.reset(new TBool(false));
 		} else if (cval == "nil") {
 			tval.reset(new TValue());
+		} else if (cval == "inf" || cval == "nan") {
+			lua_Number num;
+			lua_Integer inum;
+			bool isInteger;
+			if ((bend = NumberFormat::parse(c, end, num, inum, isInteger)) == nullptr) {
+				return nullptr;
+			}
+			tval.reset(new TNumber(num));
 		} else {
 			return nullptr;
 		}
@@ -373,29 +266,23 @@ const char *Assembler::parseConstant(const char *start, const char *end, size_t
 
 	if (parseStatus_ == PARSE_CONST) {
 		if (bend != end && *bend != ';') {
-			bend = std::find_if_not(bend, end, std::ptr_fun<int, int>(std::isblank));
+			bend = std::find_if_not(bend, end, CharClass::isBlank);
 			if (bend != end && *bend != ';') {
 				return nullptr;
 			}
 		}
 	}
 
-	bool found = false;
-	for (int i = 0; i < constants_.size(); i++) {
-		if (*constants_[i] == *tval) {
-			// use this constant instead of creating a duplicate
-			found = true;
-			if (id != nullptr) {
-				*id = i;
-			}
-			break;
-		}
+	bool found;
+	size_t k = constants_.add(tval, &found);
+	if (id != nullptr) {
+		*id = k;
 	}
-
-	if (!found) {
-		constants_.push_back(tval);
-		if (id != nullptr) {
-			*id = constants_.size() - 1;
+	if (stats_) {
+		if (found) {
+			stats_->count(Stats::DEDUP_HITS);
+		} else if (tval->type() == LUA_TSTRING) {
+			stats_->count(Stats::STRING_BYTES, reinterpret_cast<TString*>(tval.get())->string().size());
 		}
 	}
 
@@ -411,7 +298,7 @@ const char *Assembler::parseConstant(const char *start, const char *end, size_t
 #define LIMIT_CONST_STACK LIMIT_CONSTANT | LIMIT_STACKIDX
 
 inline const char *Assembler::parseOperand(Operand &operand, const char *start, const char *end, unsigned int limit) {
-	start = std::find_if_not(start, end, std::ptr_fun<int, int>(std::isblank));
+	start = std::find_if_not(start, end, CharClass::isBlank);
 	if (start == end || *start == ';') {
 		return nullptr;
 	}
@@ -424,7 +311,7 @@ inline const char *Assembler::parseOperand(Operand &operand, const char *start,
 
 			size_t val;
 			const char *bend = parseInt(val, start, end);
-			if (bend == nullptr || (bend != end && (!std::isblank(*bend) && *bend != ';'))) {
+			if (bend == nullptr || (bend != end && (!CharClass::isBlank(*bend) && *bend != ';'))) {
 				return nullptr;
 			}
 
@@ -441,7 +328,7 @@ inline const char *Assembler::parseOperand(Operand &operand, const char *start,
 
 			size_t val;
 			const char *bend = parseInt(val, start, end);
-			if (bend == nullptr || (bend != end && (!std::isblank(*bend) && *bend != ';'))) {
+			if (bend == nullptr || (bend != end && (!CharClass::isBlank(*bend) && *bend != ';'))) {
 				return nullptr;
 			}
 
@@ -478,12 +365,12 @@ inline const char *Assembler::parseOperand(Operand &operand, const char *start,
 		}
 		default: {
 			if (*start == 'c') { // could be const
-				const char *bend = std::find_if_not(start, end, std::ptr_fun<int, int>(std::isalpha));
+				const char *bend = std::find_if_not(start, end, CharClass::isAlpha);
 				if (bend != end && std::strncmp(start, "const", bend - start) == 0) {
 					if (!(limit & LIMIT_CONSTANT)) {
 						return nullptr;
 					}
-					bend = std::find_if_not(bend, end, std::ptr_fun<int, int>(std::isblank));
+					bend = std::find_if_not(bend, end, CharClass::isBlank);
 					if (bend == end || *bend == ';') {
 						return nullptr;
 					}
@@ -494,11 +381,7 @@ inline const char *Assembler::parseOperand(Operand &operand, const char *start,
 						return nullptr;
 					}
 					operand.setType(Operand::CONSTANT);
-					if (limit & LIMIT_STACKIDX) {
-						operand.setValue(RKASK(id));
-					} else {
-						operand.setValue(id);
-					}
+					operand.setValue(id); // RK encoding is chosen by parseCode
 
 					return bend;
 				}
@@ -514,7 +397,6 @@ inline const char *Assembler::parseOperand(Operand &operand, const char *start,
 				if (u != usedSubroutines_.end() && u->second != funcid_) {
 					return nullptr;
 				}
-				auto it = subroutines_.find(label);
 				operand.setValue(-1);
 				neededSubroutines_.push_back(std::make_pair(label, (int)instructions_.size()));
 
@@ -532,9 +414,9 @@ inline const char *Assembler::parseOperand(Operand &operand, const char *start,
 
 			int val;
 
-			char cf = std::tolower(*start);
+			char cf = CharClass::lower(*start);
 			if (cf == 't' || cf == 'f') {
-				if ((bend = std::find_if_not(start, end, std::ptr_fun<int, int>(std::isalpha))) == start) {
+				if ((bend = std::find_if_not(start, end, CharClass::isAlpha)) == start) {
 					return nullptr;
 				}
 
@@ -681,7 +563,7 @@ const OpInfo opinfo[NUM_OPCODES][3] = { // Maximum of 3 operands
 	{{OPP_Ax, LIMIT_EMBED}} // EXTRAARG
 };
 
-inline Util::BoolRes Assembler::parseCode(const char *line, size_t len) {
+inline Util::BoolRes Assembler::parseCode(const char *line, size_t len, size_t comment) {
 	const char *c = line;
 	const char *end = line + len;
 
@@ -691,8 +573,7 @@ inline Util::BoolRes Assembler::parseCode(const char *line, size_t len) {
 		return Util::BoolRes(false, "invalid opcode");
 	}
 
-    auto line_comment = get_line_comment_from_asm_line_code(line, len);
-    auto linenumber = get_linenumber_from_asm_line_comment(line_comment);
+    auto linenumber = get_linenumber_from_asm_line_comment(line + comment, end);
     if (linenumber >= 0)
     {
       lineinfos_.push_back(linenumber);
@@ -700,6 +581,9 @@ inline Util::BoolRes Assembler::parseCode(const char *line, size_t len) {
 
 	if (bend != end && *bend == ':') { // location
 		locations_[opcodestr] = instructions_.size();
+		if (stats_) {
+			stats_->count(Stats::LABELS);
+		}
 
 		for (auto it = neededLocations_.begin(); it != neededLocations_.end(); ) {
 			if ((*it).first == opcodestr) {
@@ -742,6 +626,7 @@ inline Util::BoolRes Assembler::parseCode(const char *line, size_t len) {
 
 	unsigned char count = opcount[opcode];
 	const OpInfo *info = opinfo[opcode];
+	std::vector<std::pair<size_t, bool> > spilled; // constants that do not fit an RK operand (id, operand C)
 
 	for (int i = 0; i < count; i++) {
 		Operand op;
@@ -749,53 +634,97 @@ inline Util::BoolRes Assembler::parseCode(const char *line, size_t len) {
 			return Util::BoolRes(false, "invalid operand(s)");
 		}
 
+		int value = op.value();
+		if (op.type() == Operand::CONSTANT && (info[i].limit & LIMIT_STACKIDX)) {
+			if (value <= MAXINDEXRK) {
+				value = RKASK(value);
+			} else {
+				spilled.push_back(std::make_pair(value, info[i].position == OPP_C));
+				value = 0; // the scratch register is only known in finalizeFunction
+			}
+		}
+
 		switch (info[i].position) {
 			case OPP_A:
-				SETARG_A(ins, op.value());
+				SETARG_A(ins, value);
 				break;
 			case OPP_B:
-				SETARG_B(ins, op.value());
+				SETARG_B(ins, value);
 				break;
 			case OPP_C:
-				SETARG_C(ins, op.value());
+				SETARG_C(ins, value);
 				break;
 			case OPP_Bx:
-				SETARG_Bx(ins, op.value());
+				if (opcode == OP_LOADK && value > MAXARG_Bx) {
+					SET_OPCODE(ins, OP_LOADKX);
+					extended = value;
+					useExtended = true;
+					f_loadkx_++;
+				} else {
+					SETARG_Bx(ins, value);
+				}
 				break;
 			case OPP_Ax:
-				SETARG_Ax(ins, op.value());
+				SETARG_Ax(ins, value);
 				break;
 			case OPP_sBx:
-				SETARG_sBx(ins, op.value());
+				SETARG_sBx(ins, value);
 				break;
 			case OPP_ARG:
-				extended = op.value();
+				extended = value;
 				useExtended = true;
 				break;
 			case OPP_C_ARG:
-				if (op.value() > MAXARG_C) {
+				if (value > MAXARG_C) {
 					SETARG_C(ins, 0);
-					extended = op.value();
+					extended = value;
 					useExtended = true;
 				} else {
-					SETARG_C(ins, op.value());
+					SETARG_C(ins, value);
 				}
 				break;
 		}
 	}
 
-	bend = std::find_if_not(bend, end, std::ptr_fun<int, int>(std::isblank));
+	bend = std::find_if_not(bend, end, CharClass::isBlank);
 	if (bend != end && *bend != ';') {
 		return Util::BoolRes(false, "too many operands in instruction");
 	}
 
+	if (!spilled.empty() && !instructions_.empty()) {
+		// an open result (call with C = 0, vararg with B = 0) may extend above the frame
+		Instruction prev = instructions_.back();
+		if ((GET_OPCODE(prev) == OP_CALL && GETARG_C(prev) == 0) || (GET_OPCODE(prev) == OP_VARARG && GETARG_B(prev) == 0)) {
+			return Util::BoolRes(false, "constant index does not fit an RK operand right after an open result");
+		}
+	}
+
+	size_t start = instructions_.size();
+	size_t firstSpill = spills_.size();
+	for (size_t slot = 0; slot < spilled.size(); slot++) {
+		size_t id = spilled[slot].first;
+		spills_.push_back(Spill{(int)instructions_.size(), 0, spilled[slot].second, (int)slot});
+		if (id <= MAXARG_Bx) {
+			instructions_.push_back(CREATE_ABx(OP_LOADK, 0, id));
+		} else {
+			instructions_.push_back(CREATE_ABx(OP_LOADKX, 0, 0));
+			instructions_.push_back(CREATE_Ax(OP_EXTRAARG, id));
+			f_loadkx_++;
+		}
+	}
+
+	for (size_t k = firstSpill; k < spills_.size(); k++) {
+		spills_[k].use = (int)instructions_.size();
+	}
 	instructions_.push_back(ins);
 
 	if (useExtended) {
-		Instruction extended = 0;
-		SET_OPCODE(extended, OP_EXTRAARG);
-		SETARG_Ax(extended, extended);
-		instructions_.push_back(extended);
+		instructions_.push_back(CREATE_Ax(OP_EXTRAARG, extended));
+	}
+
+	if (linenumber >= 0) {
+		// every instruction emitted for the line gets its line
+		lineinfos_.resize(lineinfos_.size() + instructions_.size() - start - 1, linenumber);
 	}
 
 	return Util::BoolRes(true, "");
@@ -813,7 +742,7 @@ inline Util::BoolRes Assembler::parseUpvalue(const char *line, size_t len) {
 		return Util::BoolRes(false, "could not parse idx");
 	}
 
-	c = std::find_if_not(c, end, std::ptr_fun<int, int>(std::isblank));
+	c = std::find_if_not(c, end, CharClass::isBlank);
 	if (c != end && *c != ';') {
 		return Util::BoolRes(false, "invalid upvalue");
 	}
@@ -823,27 +752,37 @@ inline Util::BoolRes Assembler::parseUpvalue(const char *line, size_t len) {
 	return Util::BoolRes(true, "");
 }
 
-Util::BoolRes Assembler::parseLine(const char *line, size_t len) {
+Util::BoolRes Assembler::parseLine(const LineView &view) {
+	const char *line = view.text;
+	size_t len = view.length;
 	if (line[0] == '.') { // directive
+		Stats::Scope scope(stats_, Stats::PROTOS);
 		return parseDirective(line, len);
 	}
 
 	switch(parseStatus_) {
-		case PARSE_CONST:
+		case PARSE_CONST: {
+			Stats::Scope scope(stats_, Stats::CONSTANTS);
 			if (parseConstant(line, line + len, nullptr) == nullptr) {
 				return Util::BoolRes(false, "could not parse constant");
 			}
 			return Util::BoolRes(true, "");
-		case PARSE_CODE:
-			return parseCode(line, len);
-		case PARSE_UPVALUE:
+		}
+		case PARSE_CODE: {
+			Stats::Scope scope(stats_, Stats::CODE);
+			return parseCode(line, len, view.comment);
+		}
+		case PARSE_UPVALUE: {
+			Stats::Scope scope(stats_, Stats::UPVALUES);
 			return parseUpvalue(line, len);
+		}
 		default:
 			return Util::BoolRes(false, "unimplemented");
 	}
 }
 
 Util::BoolRes Assembler::finalizeFunction() {
+	Stats::Scope scope(stats_, Stats::PROTOS);
 	if (!neededLocations_.empty()) {
 		std::string locList = std::string("undeclared locations: ") + neededLocations_[0].first;
 		for (int i = 1; i < neededLocations_.size(); i++) {
@@ -852,196 +791,326 @@ Util::BoolRes Assembler::finalizeFunction() {
 		return Util::BoolRes(false, locList);
 	}
 
+	if (stats_) {
+		stats_->count(Stats::PROTOTYPES);
+		stats_->count(Stats::INSTRUCTIONS, instructions_.size());
+		stats_->count(Stats::CONSTANTS_COUNT, constants_.size());
+	}
+
+	if (f_autostack_ || stackMode_ != STACK_KEEP) {
+		unsigned int needed = Liveness::minStackSize(instructions_, f_params_);
+		if (needed > MAXREGS) {
+			return Util::BoolRes(false, "function " + funcname_ + " needs more than " + std::to_string(MAXREGS) + " registers");
+		}
+		if (!f_autostack_ && f_maxstacksize_ < needed) {
+			return Util::BoolRes(false, "function " + funcname_ + " declares maxstacksize " + std::to_string(f_maxstacksize_) + " but uses " + std::to_string(needed) + " registers");
+		}
+		if (f_autostack_ || stackMode_ == STACK_MINIMIZE) {
+			if (!f_autostack_ && needed < f_maxstacksize_) {
+				// a TValue is 16 bytes with the default configuration
+				report_.push_back(funcname_ + ": maxstacksize " + std::to_string(f_maxstacksize_) + " -> " + std::to_string(needed)
+					+ " (" + std::to_string((f_maxstacksize_ - needed) * 16) + " bytes per frame saved)");
+			}
+			f_maxstacksize_ = needed;
+		}
+	}
+
+	if (!spills_.empty()) {
+		// scratch registers go above everything the function uses, so no live value is clobbered
+		int base = std::max((int)f_maxstacksize_, Liveness::minStackSize(instructions_, f_params_));
+		int top = base;
+		for (const Spill &spill : spills_) {
+			int reg = base + spill.slot;
+			if (reg >= MAXREGS) {
+				return Util::BoolRes(false, "function " + funcname_ + " has no free scratch register for a constant above index " + std::to_string(MAXINDEXRK));
+			}
+			SETARG_A(instructions_[spill.load], reg);
+			if (spill.c) {
+				SETARG_C(instructions_[spill.use], reg);
+			} else {
+				SETARG_B(instructions_[spill.use], reg);
+			}
+			top = std::max(top, reg + 1);
+		}
+		report_.push_back(funcname_ + ": " + std::to_string(spills_.size()) + " RK constants loaded through scratch registers "
+			+ std::to_string(base) + ".." + std::to_string(top - 1));
+		f_maxstacksize_ = top;
+		spills_.clear();
+	}
+	if (f_loadkx_ > 0) {
+		report_.push_back(funcname_ + ": " + std::to_string(f_loadkx_) + " loadk promoted to loadkx");
+		f_loadkx_ = 0;
+	}
+
 	ParsedFunctionPtr func(new ParsedFunction);
 	func->name = std::move(funcname_);
 	func->instructions = std::move(instructions_);
 	func->upvalues = std::move(upvalues_);
-	func->constants = std::move(constants_);
+	func->constants = constants_.take();
 	func->neededSubroutines = std::move(neededSubroutines_);
 	func->usedSubroutines = std::move(f_usedSubroutines_);
 	func->maxstacksize = f_maxstacksize_;
 	func->params = f_params_;
 	func->vararg = f_vararg_;
+	func->source = func->name; // assembly has no source name, the function name stands in for it
+	func->linedefined = 0;
+	func->lastlinedefined = 0;
 
     func->lineinfos = lineinfos_;
     lineinfos_.clear();
 
+	if (streaming_) {
+		patchClosures(*func);
+		EncodedFunctionPtr encoded(new EncodedFunction);
+		auto res = encoder_->encode(*func, *encoded);
+		if (!res.success()) {
+			return Util::BoolRes(false, func->name + ": " + res.error_msg());
+		}
+		encoded_[func->name] = encoded;
+		return Util::BoolRes(true, "");
+	}
+
 	functions_[func->name] = func;
+	order_.push_back(func);
 
 	return Util::BoolRes(true, "");
 }
 
-#define WRITE_ASSERT(f, msg) if (!f) return Util::BoolRes(false, msg);
-
-inline Util::BoolRes Assembler::writeHeader() {
-	if (wbuffer_->writeBytes(LUA_SIGNATURE, sizeof(LUA_SIGNATURE)-1) != sizeof(LUA_SIGNATURE)-1) {
-		return Util::BoolRes(false, "failed to write signature");
+// points the closures of a function at the index of their proto, the order of usedSubroutines
+void Assembler::patchClosures(ParsedFunction &function) {
+	for (size_t i = 0; i < function.usedSubroutines.size(); i++) {
+		const std::string &pName = function.usedSubroutines[i];
+		for (auto it = function.neededSubroutines.begin(); it != function.neededSubroutines.end();) {
+			if (it->first == pName) {
+				SETARG_Bx(function.instructions[it->second], (int)i);
+				it = function.neededSubroutines.erase(it);
+			} else {
+				it++;
+			}
+		}
 	}
-	WRITE_ASSERT(wbuffer_->write<unsigned char>(LUAC_VERSION).success(), "failed to write version");
-	WRITE_ASSERT(wbuffer_->write<unsigned char>(LUAC_FORMAT).success(), "failed to write format");
-	if (wbuffer_->writeBytes(LUAC_DATA, sizeof(LUAC_DATA)-1) != sizeof(LUAC_DATA)-1) {
-		return Util::BoolRes(false, "failed to write LUAC_DATA");
+}
+
+Util::BoolRes Assembler::optimize() {
+	Stats::Scope scope(stats_, Stats::OPTIMIZE);
+	Optimizer optimizer(optimizations_);
+	for (ParsedFunctionPtr function : order_) {
+		AllocStats::Prototype prototype(function->name);
+		auto res = optimizer.run(*function, function->protos);
+		if (!res.success()) {
+			return Util::BoolRes(false, function->name + ": " + res.error_msg());
+		}
 	}
-	WRITE_ASSERT(wbuffer_->write<unsigned char>(sizeof(int)).success(), "failed to write int size");
-	WRITE_ASSERT(wbuffer_->write<unsigned char>(sizeof(LUA_SIZE_T_TYPE)).success(), "failed to write size_t size");
-	WRITE_ASSERT(wbuffer_->write<unsigned char>(sizeof(Instruction)).success(), "failed to write instruction size");
-	WRITE_ASSERT(wbuffer_->write<unsigned char>(sizeof(lua_Integer)).success(), "failed to write integer size");
-	WRITE_ASSERT(wbuffer_->write<unsigned char>(sizeof(lua_Number)).success(), "failed to write number size");
-	WRITE_ASSERT(wbuffer_->write<lua_Integer>(LUAC_INT).success(), "failed to write LUAC_INT");
-	WRITE_ASSERT(wbuffer_->write<lua_Number>(LUAC_NUM).success(), "failed to write LUAC_NUM");
+	report_.insert(report_.end(), optimizer.report().begin(), optimizer.report().end());
 
 	return Util::BoolRes(true, "");
 }
 
+Util::BoolRes Assembler::resolveProtos() {
+	for (ParsedFunctionPtr function : order_) {
+		function->protos.clear();
+		for (size_t i = 0; i < function->usedSubroutines.size(); i++) {
+			std::string pName = function->usedSubroutines[i];
+			auto sub = functions_.find(pName);
+			if (sub == functions_.end()) {
+				return Util::BoolRes(false, std::string("no such function: ") + pName);
+			}
 
-Util::BoolRes Assembler::writeString(const std::string &string) {
-	size_t len = string.size();
-	Util::BoolRes res;
-	if (len < 0xFE) {
-		res = wbuffer_->write<unsigned char>(len + 1);
-	} else {
-		res = wbuffer_->write<unsigned char>(0xFF);
-		if (!res.success()) {
-			return res;
+			function->protos.push_back(sub->second);
 		}
-		res = wbuffer_->write(len + 1);
-	}
-	if (!res.success()) {
-		return res;
-	}
-
-	if (wbuffer_->writeBytes(string.c_str(), len) != len) {
-		return Util::BoolRes(false, "could not write string");
+		patchClosures(*function);
 	}
 	return Util::BoolRes(true, "");
 }
 
-Util::BoolRes Assembler::writeFunction(ParsedFunctionPtr function) {
-	auto res = writeString(function->name);
-	if (!res.success()) {
-		return res;
+// the settings of the assembler a run of functions is parsed for
+void Assembler::inherit(const Assembler &parent) {
+	stackMode_ = parent.stackMode_;
+	optimizations_ = parent.optimizations_;
+	strip_ = parent.strip_;
+	format_ = parent.format_;
+	streaming_ = parent.streaming_;
+	if (streaming_) {
+		encoder_.reset(new Dumper(wbuffer_, strip_, format_));
+		encoder_->setStats(stats_);
 	}
+}
 
-	if (!(res = wbuffer_->write<int>(0)).success()) { // linedefined (unimplemented)
-		return res;
-	}
-	if (!(res = wbuffer_->write<int>(0)).success()) { // lastlinedefined (unimplemented)
-		return res;
-	}
-	if (!(res = wbuffer_->write(function->params)).success()) { // numparams
-		return res;
+Util::BoolRes Assembler::parseLines(const std::vector<LineView> &lines, size_t begin, size_t end) {
+	for (size_t i = begin; i < end; i++) {
+		auto res = parseLine(lines[i]);
+		if (!res.success()) {
+			return Util::BoolRes(false, std::string("error parsing line ") + std::to_string(lines[i].number) + ": " + res.error_msg());
+		}
 	}
-	if (!(res = wbuffer_->write(function->vararg)).success()) { // is_vararg
-		return res;
+	return Util::BoolRes(true, "");
+}
+
+// what the .func starting the next run, or the end of the input, does to the last function of a run
+Util::BoolRes Assembler::endRun(bool last) {
+	if (!last) {
+		if (parseStatus_ != PARSE_FUNC && parseStatus_ != PARSE_NONE) {
+			return Util::BoolRes(false, "func declaration cannot be inside a code or const segment");
+		}
+		// a function without code is not written, but its constants and upvalues go to the next one
+		if (instructions_.empty() && (constants_.size() > 0 || !upvalues_.empty() || !lineinfos_.empty())) {
+			return Util::BoolRes(false, "function " + funcname_ + " has no code");
+		}
 	}
-	if (!(res = wbuffer_->write(function->maxstacksize)).success()) { // maxstacksize
-		return res;
+	if (!instructions_.empty()) {
+		return finalizeFunction();
 	}
+	return Util::BoolRes(true, "");
+}
 
-	std::vector<ParsedFunctionPtr> protos;
-
-	// fix missing closure pointers
-	for (int i = 0; i < function->usedSubroutines.size(); i++) {
-		std::string pName = function->usedSubroutines[i];
-		auto sub = functions_.find(pName);
-		if (sub == functions_.end()) {
-			return Util::BoolRes(false, std::string("no such function: ") + pName);
+// takes over the functions of a run that follows everything merged so far
+Util::BoolRes Assembler::merge(Assembler &run) {
+	if (run.bUpvalues_) {
+		if (bUpvalues_) {
+			return Util::BoolRes(false, "already declared amount of upvalues");
 		}
-
-		protos.push_back(sub->second);
-
-		for (auto it = function->neededSubroutines.begin(); it != function->neededSubroutines.end();) {
-			if (it->first == pName) {
-				SETARG_Bx(function->instructions[it->second], i);
-				it = function->neededSubroutines.erase(it);
-			} else {
-				it++;
-			}
+		bUpvalues_ = true;
+		nUpvalues_ = run.nUpvalues_;
+	}
+	for (auto &used : run.usedSubroutines_) {
+		auto it = usedSubroutines_.find(used.first);
+		if (it != usedSubroutines_.end() && it->second != used.second) {
+			return Util::BoolRes(false, "subroutine " + used.first + " is used by more than one function");
 		}
+		usedSubroutines_.insert(used);
 	}
 
-
-	if (!(res = wbuffer_->write<int>(function->instructions.size())).success()) { // code length	
-		return res;
+	// a later declaration of the same name replaces the earlier one, as when parsed in one go
+	for (ParsedFunctionPtr &function : run.order_) {
+		functions_[function->name] = function;
+		order_.push_back(function);
 	}
-	if (wbuffer_->writeBytes((const char*)function->instructions.data(), function->instructions.size() * sizeof(Instruction))  != function->instructions.size() * sizeof(Instruction)) { // code
-		return Util::BoolRes(false, "failed to write instructions");
+	for (auto &encoded : run.encoded_) {
+		encoded_[encoded.first] = encoded.second;
 	}
+	report_.insert(report_.end(), run.report_.begin(), run.report_.end());
+	funcid_ = run.funcid_;
 
+	return Util::BoolRes(true, "");
+}
 
-	if (!(res = wbuffer_->write<int>(function->constants.size())).success()) { // constants length	
-		return res;
+// the .func lines, where the input is split
+static bool isFunc(const LineView &line) {
+	const char *name = line.text + 1;
+	if (line.text[0] != '.' || std::find_if_not(name, line.text + line.length, CharClass::isIdent) != name + 4) {
+		return false;
 	}
-
-	for (TValuePtr constant : function->constants) {
-		if (!(res = wbuffer_->write<unsigned char>(constant->type())).success()) { // constant type
-			return res;
-		}
-		switch (constant->type()) {
-			case LUA_TSTRING: {
-				if (!(res = writeString(reinterpret_cast<TString*>(constant.get())->string())).success()) {
-					return res;
-				}
-				break;
-			}
-			case LUA_TNUMBER: {
-				if (!(res = wbuffer_->write(reinterpret_cast<TNumber*>(constant.get())->number())).success()) {
-					return res;
-				}
-				break;
-			}
-			case LUA_TBOOLEAN: {
-				if (!(res = wbuffer_->write(reinterpret_cast<TBool*>(constant.get())->value())).success()) {
-					return res;
-				}
-				break;
-			}
+	for (int i = 0; i < 4; i++) {
+		if (CharClass::lower(name[i]) != "func"[i]) {
+			return false;
 		}
 	}
+	return true;
+}
 
-	if (!(res = wbuffer_->write<int>(function->upvalues.size())).success()) { // upvalues length	
-		return res;
+Util::BoolRes Assembler::assembleParallel() {
+	LineScanner scanner(rbuffer_);
+	std::vector<LineView> lines;
+	std::vector<size_t> funcs; // indexes of the .func lines
+	{
+		Stats::Scope scope(stats_, Stats::READ);
+		scanner.scanAll(lines);
+		for (size_t i = 0; i < lines.size(); i++) {
+			if (isFunc(lines[i])) {
+				funcs.push_back(i);
+			}
+		}
 	}
 
-	for (Upvalue upvalue : function->upvalues) {
-		if (!(res = wbuffer_->write(upvalue.instack)).success()) { // instack
+	size_t threads = threads_ ? threads_ : std::max(1u, std::thread::hardware_concurrency());
+	if (threads == 1 || funcs.size() < 2) {
+		Stats::Scope scope(stats_, Stats::READ);
+		auto res = parseLines(lines, 0, lines.size());
+		if (!res.success()) {
 			return res;
 		}
-		if (!(res = wbuffer_->write(upvalue.idx)).success()) { // idx
+		return finish();
+	}
+
+	{
+		// whatever comes before the first function, .upvalues usually
+		Stats::Scope scope(stats_, Stats::READ);
+		auto res = parseLines(lines, 0, funcs.front());
+		if (!res.success()) {
 			return res;
 		}
 	}
 
-	if (!(res = wbuffer_->write<int>(protos.size())).success()) { // protos length	
-		return res;
-	}
-	for (ParsedFunctionPtr proto : protos) {
-		if (!(res = writeFunction(proto)).success()) {
-			return res;
+	// a few runs per thread of about the same number of lines, so that a run of large functions
+	// does not leave the other threads waiting
+	size_t target = std::max<size_t>(1, (lines.size() - funcs.front()) / (threads * 4));
+	std::vector<size_t> starts; // first function of every run
+	for (size_t f = 0; f < funcs.size(); f++) {
+		if (starts.empty() || funcs[f] - funcs[starts.back()] >= target) {
+			starts.push_back(f);
 		}
 	}
+	starts.push_back(funcs.size());
+	funcs.push_back(lines.size());
+
+	size_t count = starts.size() - 1;
+	std::vector<std::unique_ptr<Assembler> > runs(count);
+	std::vector<Stats> stats(stats_ ? count : 0);
+	std::vector<Util::BoolRes> results(count, Util::BoolRes(true, ""));
+	for (size_t r = 0; r < count; r++) {
+		runs[r].reset(new Assembler(nullptr, wbuffer_));
+		runs[r]->stats_ = stats_ ? &stats[r] : nullptr;
+		runs[r]->inherit(*this);
+		runs[r]->funcid_ = (int)starts[r] - 1; // function ids stay those of the whole input
+	}
 
-    // dumpSizeLineinfos and dumpVector(lineinfos)
-	if (!(res = wbuffer_->write<int>(function->lineinfos.size())).success()) { // line info size
-		return res;
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t r; (r = next++) < count; ) {
+			Assembler &run = *runs[r];
+			Stats::Scope scope(run.stats_, Stats::READ);
+			auto res = run.parseLines(lines, funcs[starts[r]], funcs[starts[r + 1]]);
+			if (res.success()) {
+				res = run.endRun(r + 1 == count);
+			}
+			results[r] = res;
+		}
+		AllocStats::restorePrototype(nullptr);
+	};
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < std::min(threads, count); i++) {
+		pool.push_back(std::thread(worker));
+	}
+	worker();
+	for (auto &thread : pool) {
+		thread.join();
 	}
-    // dumpVector(lineinfos)
-    if (function->lineinfos.size() > 0)
-    {
-        wbuffer_->writeBytes((const char *)function->lineinfos.data(), function->lineinfos.size() * sizeof(function->lineinfos[0]));
-    }
 
-	if (!(res = wbuffer_->write<int>(0)).success()) { // local var size (unimplemented)
-		return res;
+	bool merged = true;
+	for (size_t r = 0; r < count && merged; r++) {
+		merged = results[r].success() && merge(*runs[r]).success();
+		if (stats_) {
+			stats_->merge(stats[r]);
+		}
 	}
-	if (!(res = wbuffer_->write<int>(0)).success()) { // upvalue name size (unimplemented)
+	runs.clear();
+
+	if (!merged) {
+		// the first error in input order is the one to report, which only a serial parse knows
+		Assembler serial(nullptr, wbuffer_);
+		serial.inherit(*this);
+		auto res = serial.parseLines(lines, 0, lines.size());
+		if (!res.success()) {
+			return res;
+		}
+		res = serial.finish();
+		report_ = std::move(serial.report_);
 		return res;
 	}
 
-	return Util::BoolRes(true, "");
+	return finish();
 }
 
-
 Util::BoolRes Assembler::assemble() {
 	if (!rbuffer_) {
 		return Util::BoolRes(false, "invalid read buffer");
@@ -1049,47 +1118,69 @@ Util::BoolRes Assembler::assemble() {
 	if (!wbuffer_) {
 		return Util::BoolRes(false, "invalid write buffer");
 	}
-
-	std::string line;
-	unsigned int linen = 0;
-	while (rbuffer_->readLine(line).success()) {
-		linen++;
-
-		Util::trim(line);
-		if (line.empty() || line.front() == ';') {
-			continue;
+	if (streaming_) {
+		if (optimizations_) {
+			return Util::BoolRes(false, "optimizations need the whole program and cannot be used when streaming");
 		}
+		// only encodes, the output buffer is not touched until the end
+		encoder_.reset(new Dumper(wbuffer_, strip_, format_));
+		encoder_->setStats(stats_);
+	}
+
+	if (threads_ != 1) {
+		return assembleParallel();
+	}
 
-		auto res = parseLine(line.c_str(), line.length());
+	LineScanner scanner(rbuffer_);
+	LineView line;
+	Stats::Scope scope(stats_, Stats::READ);
+	while (scanner.next(line)) {
+		auto res = parseLine(line);
 		if (!res.success()) {
-			return Util::BoolRes(false, std::string("error parsing line ") + std::to_string(linen) + ": " + res.error_msg());
+			return Util::BoolRes(false, std::string("error parsing line ") + std::to_string(line.number) + ": " + res.error_msg());
 		}
 	}
+	return finish();
+}
 
+// everything after the last line
+Util::BoolRes Assembler::finish() {
 	if (!instructions_.empty()) {
 		auto res = finalizeFunction();
 		if (!res.success()) {
 			return res;
 		}
 	}
+	AllocStats::restorePrototype(nullptr);
 
 	if (!bUpvalues_) {
 		return Util::BoolRes(false, "amount of upvalues never declared");
 	}
 
-	auto  res = writeHeader();
-	if (!res.success()) {
-		return res;
+	if (streaming_) {
+		if (encoded_.find("main") == encoded_.end()) {
+			return Util::BoolRes(false, "no main function");
+		}
+		Dumper dumper(wbuffer_, strip_, format_);
+		dumper.setStats(stats_);
+		return dumper.dump("main", nUpvalues_, encoded_);
 	}
 
-	WRITE_ASSERT(wbuffer_->write<unsigned char>(nUpvalues_).success(), "failed to write num upvalues");
-
 	auto it = functions_.find("main");
 	if (it == functions_.end()) {
 		return Util::BoolRes(false, "no main function");
 	}
 
-	return writeFunction(it->second);
+	auto res = resolveProtos();
+	if (!res.success()) {
+		return res;
+	}
+
+	if (optimizations_ && !(res = optimize()).success()) {
+		return res;
+	}
 
-	// return Util::BoolRes(true, "");
+	Dumper dumper(wbuffer_, strip_, format_);
+	dumper.setStats(stats_);
+	return dumper.dump(*it->second, nUpvalues_);
 }
\ No newline at end of file
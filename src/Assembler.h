@@ -10,26 +10,65 @@
 #include "Buffer.h"
 #include "lconfig.h"
 #include "Function.h"
-
-struct ParsedFunction;
-typedef std::shared_ptr<ParsedFunction> ParsedFunctionPtr;
-
-struct ParsedFunction {
-	std::string name;
-	std::vector<Instruction> instructions;
-	std::vector<Upvalue> upvalues;
-	std::vector<std::string> usedSubroutines;
-    std::vector<int> lineinfos;
-	std::vector<std::pair<std::string, int> > neededSubroutines;
-	std::vector<TValuePtr> constants;
-	unsigned char maxstacksize, params, vararg;
-};
+#include "Stats.h"
+#include "ConstantPool.h"
+#include "Dumper.h"
+#include "LineScanner.h"
 
 class Assembler {
 public:
+	// how the maxstacksize declared in .func is treated; "auto" in .func always computes it
+	enum StackMode {
+		STACK_KEEP, // write the declared value
+		STACK_VALIDATE, // fail if the declared value is smaller than the registers the code uses
+		STACK_MINIMIZE // replace the declared value with the smallest safe one
+	};
+
 	Assembler(Buffer *rbuffer, WriteBufferPtr wbuffer);
     Util::BoolRes assemble();
 
+	inline void setStats(Stats *stats) {
+		stats_ = stats;
+	}
+
+	inline void setStackMode(StackMode mode) {
+		stackMode_ = mode;
+	}
+
+	// Optimizer passes to run before writing, 0 (the default) writes the code as given
+	inline void setOptimizations(unsigned int passes) {
+		optimizations_ = passes;
+	}
+
+	inline void setStrip(StripLevel strip) {
+		strip_ = strip;
+	}
+
+	// type sizes and byte order of the written chunk, native by default
+	inline void setFormat(const ChunkFormat &format) {
+		format_ = format;
+	}
+
+	// Encodes every function as soon as its .func ends and drops its parsed form, so memory grows
+	// with the output instead of with the parsed program. The optimizer needs the whole program and
+	// cannot be combined with it.
+	inline void setStreaming(bool streaming) {
+		streaming_ = streaming;
+	}
+
+	// Parses the functions on up to this many threads, 0 for one per core. The input is read whole
+	// and split at .func lines into runs of functions, each run parsed with its own constant pool,
+	// labels and stats; the subroutine references are resolved serially afterwards. When any run
+	// fails the input is parsed again serially, so that errors are reported as without threads.
+	inline void setThreads(unsigned int threads) {
+		threads_ = threads;
+	}
+
+	// one line per function whose maxstacksize or code was changed
+	inline const std::vector<std::string> &report() const {
+		return report_;
+	}
+
 private:
 	class Operand {
 	public:
@@ -51,21 +90,33 @@ private:
 		int value_; // stack index, const id, location id (or -1 if unknown), upvalue index, embedded integer
 	};
 
-    Util::BoolRes writeHeader();
+	void inherit(const Assembler &parent);
+	Util::BoolRes parseLines(const std::vector<LineView> &lines, size_t begin, size_t end);
+	Util::BoolRes assembleParallel();
+	Util::BoolRes endRun(bool last);
+	Util::BoolRes merge(Assembler &run);
+	Util::BoolRes finish();
 
-    Util::BoolRes parseLine(const char *line, size_t len);
+    Util::BoolRes parseLine(const LineView &line);
     Util::BoolRes parseDirective(const char *line, size_t len);
     Util::BoolRes finalizeFunction();
+    Util::BoolRes optimize();
+    Util::BoolRes resolveProtos();
+	void patchClosures(ParsedFunction &function);
 	const char *parseConstant(const char *start, const char *end, size_t *id); // returns nullptr if the operand could not be parsed
-    Util::BoolRes parseCode(const char *line, size_t len);
+    Util::BoolRes parseCode(const char *line, size_t len, size_t comment); // comment is the offset of the line comment
     Util::BoolRes parseUpvalue(const char *line, size_t len);
 	const char *parseOperand(Operand &operand, const char *start, const char *end, unsigned int limit = 0xFFFFFFFF); // returns nullptr if the operand could not be parsed
 
-    Util::BoolRes writeFunction(ParsedFunctionPtr function);
-    Util::BoolRes writeString(const std::string &string);
-
 	WriteBufferPtr wbuffer_;
 	BufferPtr rbuffer_;
+	Stats *stats_;
+	StackMode stackMode_;
+	unsigned int optimizations_;
+	StripLevel strip_;
+	ChunkFormat format_;
+	std::vector<std::string> report_;
+	unsigned int threads_;
 
 	enum ParseStatus {
 		PARSE_FUNC,
@@ -82,6 +133,11 @@ private:
 
 
 	std::unordered_map<std::string, ParsedFunctionPtr> functions_;
+	std::vector<ParsedFunctionPtr> order_; // functions in declaration order
+
+	bool streaming_;
+	std::unique_ptr<Dumper> encoder_;
+	std::unordered_map<std::string, EncodedFunctionPtr> encoded_; // instead of functions_ when streaming
 
 	// TODO: automatically detect which subroutines are protos of subroutines through the CLOSURE instruction
 
@@ -97,17 +153,25 @@ private:
 	std::vector<Instruction> instructions_;
 	std::vector<std::pair<std::string, int> > neededSubroutines_;
 	std::vector<std::pair<std::string, int> > neededLocations_; // for jmps to the future
-	std::unordered_map<std::string, int> locations_;
+	std::unordered_map<std::string, int> locations_; // labels of the current function
 
     std::vector<int> lineinfos_;
 
 	unsigned int f_maxstacksize_, f_params_, f_vararg_;
-	std::vector<TValuePtr> constants_;
+	bool f_autostack_;
 
-    std::string get_line_comment_from_asm_line_code(const char *line, size_t len);
+	// a constant that did not fit an RK operand, loaded into a scratch register above the frame
+	struct Spill {
+		int load, use; // pcs of the load and of the instruction reading it
+		bool c; // operand C, otherwise B
+		int slot; // scratch register relative to the top of the frame
+	};
+	std::vector<Spill> spills_;
+	unsigned int f_loadkx_; // loadk promoted to loadkx
+	ConstantPool constants_;
 
     // fetch linenumber from line comment of ";L<digits>;<other_line_comment>" style. -1 for not exist defined line number
-    int get_linenumber_from_asm_line_comment(std::string line_comment);
+    int get_linenumber_from_asm_line_comment(const char *comment, const char *end);
 	/* end of function-specific data */
 };
 
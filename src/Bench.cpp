@@ -0,0 +1,370 @@
+#include "Bench.h"
+#include "Parser.h"
+#include "Assembler.h"
+#include "StringBuffer.h"
+#include "StringWriteBuffer.h"
+#include "NumberFormat.h"
+#include "DecodedCode.h"
+#include "Verifier.h"
+#include "LineScanner.h"
+#include "StringEscape.h"
+#include "Exporter.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+Bench::Bench(size_t iterations, bool perf) : iterations_(iterations ? iterations : 1), perfRequested_(perf) {
+	if (perf) {
+		perf_.reset(new PerfCounters());
+		if (!perf_->available()) {
+			perf_.reset();
+		}
+	}
+}
+
+Util::BoolRes Bench::run(const std::string &name, const std::function<Util::BoolRes()> &stage) {
+	auto res = stage(); // warm-up
+	if (!res.success()) {
+		return Util::BoolRes(false, name + ": " + res.error_msg());
+	}
+
+	BenchResult result;
+	result.name = name;
+	result.iterations = iterations_;
+	result.counters = perf_ != nullptr;
+
+	if (perf_) {
+		perf_->reset();
+		perf_->start();
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations_; i++) {
+		if (!(res = stage()).success()) {
+			return Util::BoolRes(false, name + ": " + res.error_msg());
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	if (perf_) {
+		perf_->stop();
+	}
+
+	result.wall = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	for (int i = 0; i < PerfCounters::NUM_EVENTS; i++) {
+		result.values[i] = perf_ && perf_->available((PerfCounters::Event)i) ? perf_->value((PerfCounters::Event)i) : 0;
+	}
+	results_.push_back(result);
+
+	return Util::BoolRes(true, "");
+}
+
+Util::BoolRes Bench::runFile(const std::string &path) {
+	std::string dump;
+	if (!Util::readFile(path, dump)) {
+		return Util::BoolRes(false, path + ": could not open file");
+	}
+
+	std::string luas;
+	FunctionPtr main;
+	auto res = run("disassemble " + path, [&]() {
+		Parser parser(new StringBuffer(dump));
+		auto res = parser.parse(luas);
+		main = parser.mainFunction();
+		return res;
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	// the structured outputs, which skip the assembly text
+	for (const char *kind : {"json", "binary"}) {
+		res = run(std::string("disassemble (") + kind + ") " + path, [&]() {
+			Parser parser(new StringBuffer(dump));
+			parser.setText(false);
+			std::string out;
+			auto res = parser.parse(out);
+			if (!res.success()) {
+				return res;
+			}
+			out.clear();
+			return Exporter::create(kind, WriteBufferPtr(new StringWriteBuffer(out)))->write(parser.mainFunction(), parser.numUpvalues());
+		});
+		if (!res.success()) {
+			return res;
+		}
+	}
+
+	// field extraction alone, with the vectorized kernel and with the scalar one
+	std::vector<FunctionPtr> functions(1, main);
+	for (size_t i = 0; i < functions.size(); i++) {
+		functions.insert(functions.end(), functions[i]->protos().begin(), functions[i]->protos().end());
+	}
+	DecodedCode decoded;
+	res = run(std::string("decode (") + DecodedCode::kernel() + ") " + path, [&]() {
+		for (const FunctionPtr &f : functions) {
+			decoded.decode(f->code());
+		}
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+	res = run("decode (scalar) " + path, [&]() {
+		for (const FunctionPtr &f : functions) {
+			decoded.decodeScalar(f->code());
+		}
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	std::vector<DecodedCode> decodedAll;
+	for (const FunctionPtr &f : functions) {
+		decodedAll.push_back(DecodedCode(f->code()));
+	}
+	res = run("verify " + path, [&]() {
+		for (size_t i = 0; i < functions.size(); i++) {
+			Verifier verifier(functions[i].get(), decodedAll[i]);
+			auto res = verifier.verify();
+			if (!res.success()) {
+				return res;
+			}
+		}
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	// line splitting of the assembly alone, with the vectorized kernel and with the scalar one
+	std::vector<LineView> lines;
+	res = run(std::string("scan lines (") + LineScanner::kernel() + ") " + path, [&]() {
+		lines.clear();
+		LineScanner::scan(luas.data(), luas.size(), lines);
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+	res = run("scan lines (scalar) " + path, [&]() {
+		lines.clear();
+		LineScanner::scanScalar(luas.data(), luas.size(), lines);
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	res = run("assemble " + path, [&]() {
+		std::string chunk;
+		Assembler assembler(new StringBuffer(luas), WriteBufferPtr(new StringWriteBuffer(chunk)));
+		return assembler.assemble();
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	unsigned int threads = std::thread::hardware_concurrency();
+	if (threads < 2) {
+		return res;
+	}
+	return run("assemble (" + std::to_string(threads) + " threads) " + path, [&]() {
+		std::string chunk;
+		Assembler assembler(new StringBuffer(luas), WriteBufferPtr(new StringWriteBuffer(chunk)));
+		assembler.setThreads(threads);
+		return assembler.assemble();
+	});
+}
+
+Util::BoolRes Bench::runNumbers(size_t count) {
+	// a mix of short decimals, integral floats and arbitrary bit patterns, always the same
+	std::vector<double> numbers;
+	unsigned long long state = 0x9E3779B97F4A7C15ULL;
+	while (numbers.size() < count) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		double n;
+		switch (numbers.size() % 3) {
+			case 0:
+				n = (double)(state % 100000) / 100;
+				break;
+			case 1:
+				n = (double)(state % 1000000) * 1024;
+				break;
+			default:
+				std::memcpy(&n, &state, sizeof(n));
+				break;
+		}
+		if (std::isfinite(n)) {
+			numbers.push_back(n);
+		}
+	}
+
+	std::vector<std::string> texts(numbers.size());
+	std::string suffix = " " + std::to_string(count) + " floats";
+	auto res = run("format" + suffix, [&]() {
+		for (size_t i = 0; i < numbers.size(); i++) {
+			texts[i] = NumberFormat::format(numbers[i]);
+		}
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	res = run("parse" + suffix, [&]() {
+		for (size_t i = 0; i < texts.size(); i++) {
+			double n;
+			long long integer;
+			bool isInteger;
+			const std::string &text = texts[i];
+			if (NumberFormat::parse(text.data(), text.data() + text.size(), n, integer, isInteger) == nullptr || std::memcmp(&n, &numbers[i], sizeof(n)) != 0) {
+				return Util::BoolRes(false, text + " does not read back exactly");
+			}
+		}
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	res = run("strtod" + suffix, [&]() {
+		for (size_t i = 0; i < texts.size(); i++) {
+			if (std::strtod(texts[i].c_str(), nullptr) != numbers[i]) {
+				return Util::BoolRes(false, texts[i] + " does not read back exactly");
+			}
+		}
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	std::string luas = ".upvalues 1\n.func main auto 0 2\n.begin_const\n";
+	for (const std::string &text : texts) {
+		luas += "   " + text + "\n";
+	}
+	luas += ".end_const\n.begin_code\n   return %0 1\n.end_code\n";
+	return run("assemble" + suffix, [&]() {
+		std::string chunk;
+		Assembler assembler(new StringBuffer(luas), WriteBufferPtr(new StringWriteBuffer(chunk)));
+		return assembler.assemble();
+	});
+}
+
+Util::BoolRes Bench::runStrings(size_t size) {
+	// something like embedded JSON: mostly plain text, with quotes, tabs and line breaks in between
+	std::string text;
+	text.reserve(size);
+	for (size_t i = 0; text.size() < size; i++) {
+		text += "{\"key_" + std::to_string(i) + "\": \"a value that needs no escaping at all\",\n\t\"it's\": [1, 2, 3]}\n";
+	}
+	text.resize(size);
+
+	std::string suffix = " " + std::to_string(size) + " byte string";
+	std::string escaped, unescaped;
+	auto res = run(std::string("escape (") + StringEscape::kernel() + ")" + suffix, [&]() {
+		escaped.clear();
+		StringEscape::escape(text.data(), text.size(), escaped);
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+	res = run("escape (scalar)" + suffix, [&]() {
+		std::string scalar;
+		StringEscape::escapeScalar(text.data(), text.size(), scalar);
+		return scalar == escaped ? Util::BoolRes(true, "") : Util::BoolRes(false, "the kernels escape differently");
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	escaped += '"';
+	const char *end = escaped.data() + escaped.size();
+	res = run(std::string("unescape (") + StringEscape::kernel() + ")" + suffix, [&]() {
+		unescaped.clear();
+		if (StringEscape::unescape(escaped.data(), end, '"', unescaped) != end - 1 || unescaped != text) {
+			return Util::BoolRes(false, "the string does not read back");
+		}
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+	res = run("unescape (scalar)" + suffix, [&]() {
+		unescaped.clear();
+		if (StringEscape::unescapeScalar(escaped.data(), end, '"', unescaped) != end - 1 || unescaped != text) {
+			return Util::BoolRes(false, "the string does not read back");
+		}
+		return Util::BoolRes(true, "");
+	});
+	if (!res.success()) {
+		return res;
+	}
+
+	std::string luas = ".upvalues 1\n.func main auto 0 2\n.begin_const\n   \"" + escaped + "\n.end_const\n.begin_code\n   return %0 1\n.end_code\n";
+	std::string chunk;
+	res = run("assemble" + suffix, [&]() {
+		chunk.clear();
+		Assembler assembler(new StringBuffer(luas), WriteBufferPtr(new StringWriteBuffer(chunk)));
+		return assembler.assemble();
+	});
+	if (!res.success()) {
+		return res;
+	}
+	return run("disassemble" + suffix, [&]() {
+		std::string out;
+		Parser parser(new StringBuffer(chunk));
+		return parser.parse(out);
+	});
+}
+
+std::string Bench::report() const {
+	std::string out;
+	char line[256];
+
+	bool counters = perf_ != nullptr;
+	std::snprintf(line, sizeof(line), "%-40s %8s %14s", "stage", "iters", "ns/iter");
+	out += line;
+	if (counters) {
+		for (int i = 0; i < PerfCounters::NUM_EVENTS; i++) {
+			std::snprintf(line, sizeof(line), " %14s", PerfCounters::eventName((PerfCounters::Event)i));
+			out += line;
+		}
+		out += "      IPC";
+	}
+	out += "\n";
+
+	for (const BenchResult &r : results_) {
+		std::snprintf(line, sizeof(line), "%-40s %8zu %14.1f", r.name.c_str(), r.iterations, (double)r.wall / r.iterations);
+		out += line;
+		if (counters) {
+			for (int i = 0; i < PerfCounters::NUM_EVENTS; i++) {
+				if (perf_->available((PerfCounters::Event)i)) {
+					std::snprintf(line, sizeof(line), " %14.1f", (double)r.values[i] / r.iterations);
+				} else {
+					std::snprintf(line, sizeof(line), " %14s", "n/a");
+				}
+				out += line;
+			}
+			if (r.values[PerfCounters::CYCLES] != 0 && perf_->available(PerfCounters::INSTRUCTIONS)) {
+				std::snprintf(line, sizeof(line), " %8.2f", (double)r.values[PerfCounters::INSTRUCTIONS] / r.values[PerfCounters::CYCLES]);
+			} else {
+				std::snprintf(line, sizeof(line), " %8s", "n/a");
+			}
+			out += line;
+		}
+		out += "\n";
+	}
+
+	if (perfRequested_ && !counters) {
+		out += "(hardware counters are not available)\n";
+	}
+	return out;
+}
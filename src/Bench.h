@@ -0,0 +1,52 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "PerfCounters.h"
+#include "lconfig.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+struct BenchResult {
+	std::string name;
+	size_t iterations;
+	uint64_t wall; // nanoseconds over all iterations
+	bool counters;
+	uint64_t values[PerfCounters::NUM_EVENTS];
+};
+
+// Benchmark harness. Every stage is run a fixed number of times after one warm-up run; with perf
+// enabled, hardware counters are collected around the measured iterations.
+class Bench {
+public:
+	Bench(size_t iterations, bool perf);
+
+	// stage returns a failed BoolRes to abort the measurement
+	Util::BoolRes run(const std::string &name, const std::function<Util::BoolRes()> &stage);
+
+	// the standard stages for one bytecode file: disassemble and assemble
+	Util::BoolRes runFile(const std::string &path);
+
+	// number constant stages on count generated floats: formatting, parsing (against strtod) and
+	// assembling a function holding all of them
+	Util::BoolRes runNumbers(size_t count);
+
+	// string constant stages on a generated text of size bytes: escaping and unescaping with the
+	// vectorized kernel and with the scalar one, assembling and disassembling a function holding it
+	Util::BoolRes runStrings(size_t size);
+
+	inline const std::vector<BenchResult> &results() {
+		return results_;
+	}
+
+	std::string report() const;
+
+private:
+	size_t iterations_;
+	bool perfRequested_;
+	std::unique_ptr<PerfCounters> perf_;
+	std::vector<BenchResult> results_;
+};
+
+#endif
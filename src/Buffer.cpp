@@ -1,5 +1,6 @@
 ﻿#include "Buffer.h"
 #include <vector>
+#include <algorithm>
 
 size_t Buffer::read(std::string &buffer, size_t amount) {
     std::vector<char> tbuf;
@@ -13,6 +14,18 @@ size_t Buffer::read(std::string &buffer, size_t amount) {
 	return amount;
 }
 
+size_t Buffer::skip(size_t amount) {
+	char tbuf[256];
+	size_t skipped = 0;
+	while (skipped < amount) {
+		size_t n = readBytes(tbuf, std::min(amount - skipped, sizeof(tbuf)));
+		if (n == 0) {
+			break;
+		}
+		skipped += n;
+	}
+	return skipped;
+}
 
 Util::BoolRes Buffer::read(__int32 &number) {
 	if (readBytes(reinterpret_cast<char*>(&number), sizeof(__int32)) != sizeof(__int32)) {
@@ -29,6 +29,21 @@ public:
 
 	virtual Util::BoolRes readLine(std::string &buffer) =0;
 
+	// discards up to amount bytes, returns the number of bytes skipped
+	virtual size_t skip(size_t amount);
+
+	// bytes left to read, or SIZE_MAX if the buffer cannot tell. Counts read from the input are
+	// checked against this before anything is allocated for them.
+	virtual size_t remaining() const {
+		return SIZE_MAX;
+	}
+
+	// the remaining() bytes, for reading them in place, or nullptr if the buffer does not hold them
+	// in memory
+	virtual const char *view() const {
+		return nullptr;
+	}
+
 	virtual ~Buffer() {};
 
 protected:
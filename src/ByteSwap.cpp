@@ -0,0 +1,53 @@
+#include "ByteSwap.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define SSSE3_SWAP
+#define SSSE3_TARGET __attribute__((target("ssse3")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <tmmintrin.h>
+#define SSSE3_SWAP
+#define SSSE3_TARGET
+#endif
+
+#ifdef SSSE3_SWAP
+static bool hasSSSE3() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("ssse3") != 0;
+#endif
+}
+
+static const bool useSSSE3 = hasSSSE3();
+
+// swaps the 32 bit words of whole 16 byte blocks, returns the number of bytes done
+SSSE3_TARGET static size_t swapBlocks(unsigned char *data, size_t bytes) {
+	const __m128i mask = _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	size_t i = 0;
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_shuffle_epi8(v, mask));
+	}
+	return i;
+}
+#endif
+
+void ByteSwap::swap32(void *data, size_t count) {
+	unsigned char *p = static_cast<unsigned char*>(data);
+	size_t bytes = count * 4;
+	size_t i = 0;
+#ifdef SSSE3_SWAP
+	if (useSSSE3) {
+		i = swapBlocks(p, bytes);
+	}
+#endif
+	for (; i < bytes; i += 4) {
+		std::swap(p[i], p[i + 3]);
+		std::swap(p[i + 1], p[i + 2]);
+	}
+}
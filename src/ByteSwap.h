@@ -0,0 +1,25 @@
+#ifndef BYTESWAP_H
+#define BYTESWAP_H
+
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+
+// Byte order reversal for chunks written on a machine of the other endianness. Arrays are swapped
+// 16 bytes at a time with SSSE3 when the processor has it (checked once at run time on x86), the
+// remainder and other processors use the scalar loop.
+class ByteSwap {
+public:
+	static void swap32(void *data, size_t count);
+
+	template<typename T>
+	static inline T swap(T value) {
+		unsigned char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		std::reverse(bytes, bytes + sizeof(T));
+		std::memcpy(&value, bytes, sizeof(T));
+		return value;
+	}
+};
+
+#endif
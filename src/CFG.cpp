@@ -0,0 +1,123 @@
+#include "CFG.h"
+#include "opcodes.h"
+
+int CFG::jumpTarget(const std::vector<Instruction> &code, int pc) {
+	switch (GET_OPCODE(code[pc])) {
+		case OP_JMP:
+		case OP_FORLOOP:
+		case OP_FORPREP:
+		case OP_TFORLOOP:
+			return pc + 1 + GETARG_sBx(code[pc]);
+		default:
+			return -1;
+	}
+}
+
+bool CFG::skips(Instruction i) {
+	switch (GET_OPCODE(i)) {
+		case OP_EQ:
+		case OP_LT:
+		case OP_LE:
+		case OP_TEST:
+		case OP_TESTSET:
+			return true;
+		case OP_LOADBOOL:
+			return GETARG_C(i) != 0;
+		default:
+			return false;
+	}
+}
+
+bool CFG::noFallThrough(Instruction i) {
+	switch (GET_OPCODE(i)) {
+		case OP_JMP:
+		case OP_FORPREP:
+		case OP_RETURN:
+			return true;
+		case OP_LOADBOOL:
+			return GETARG_C(i) != 0;
+		default:
+			return false;
+	}
+}
+
+CFG::CFG(const std::vector<Instruction> &code) {
+	int n = (int)code.size();
+	blockOf_.assign(n, -1);
+	if (n == 0) {
+		return;
+	}
+
+	// pass 1: mark leaders
+	std::vector<char> leader(n + 2, 0);
+	leader[0] = 1;
+	for (int pc = 0; pc < n; pc++) {
+		Instruction i = code[pc];
+		int target = jumpTarget(code, pc);
+		if (target >= 0 && target < n) {
+			leader[target] = 1;
+		}
+		if (target >= 0 || skips(i) || noFallThrough(i)) {
+			leader[pc + 1] = 1;
+		}
+		if (skips(i)) {
+			leader[pc + 2] = 1;
+		}
+	}
+
+	for (int pc = 0; pc < n; pc++) {
+		if (leader[pc]) {
+			blocks_.push_back(BasicBlock{pc, pc, 0, 0, 0, 0});
+		}
+		blocks_.back().end = pc + 1;
+		blockOf_[pc] = (int)blocks_.size() - 1;
+	}
+
+	// pass 2: successor edges in block order, then predecessors by counting sort
+	auto addEdge = [&](BasicBlock &b, int pc) {
+		if (pc < 0 || pc >= n) {
+			return;
+		}
+		int to = blockOf_[pc];
+		if (b.nsucc > 0 && succ_.back() == to) {
+			return;
+		}
+		succ_.push_back(to);
+		b.nsucc++;
+	};
+
+	std::vector<int> npred(blocks_.size() + 1, 0);
+	for (BasicBlock &b : blocks_) {
+		int last = b.end - 1;
+		Instruction i = code[last];
+
+		b.succ = (int)succ_.size();
+		int target = jumpTarget(code, last);
+		if (target >= 0) {
+			addEdge(b, target);
+		}
+		if (!noFallThrough(i)) {
+			addEdge(b, last + 1);
+		}
+		if (skips(i)) {
+			addEdge(b, last + 2);
+		}
+
+		for (int s = b.succ; s < b.succ + b.nsucc; s++) {
+			npred[succ_[s] + 1]++;
+		}
+	}
+
+	for (size_t i = 0; i < blocks_.size(); i++) {
+		npred[i + 1] += npred[i];
+		blocks_[i].pred = npred[i];
+	}
+	pred_.resize(succ_.size());
+	for (size_t i = 0; i < blocks_.size(); i++) {
+		const BasicBlock &b = blocks_[i];
+		for (int s = b.succ; s < b.succ + b.nsucc; s++) {
+			BasicBlock &to = blocks_[succ_[s]];
+			pred_[to.pred + to.npred++] = (int)i;
+		}
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include "lconfig.h"
+#include <vector>
+
+struct BasicBlock {
+	int start, end; // instruction range [start, end)
+	int succ, nsucc; // range in CFG::successors()
+	int pred, npred; // range in CFG::predecessors()
+};
+
+// Control-flow graph over a function's instruction array. Blocks and edges are kept in flat arrays
+// (edges in compressed-row form) and the graph is built in two linear passes over the code.
+class CFG {
+public:
+	CFG(const std::vector<Instruction> &code);
+
+	inline size_t size() const {
+		return blocks_.size();
+	}
+
+	inline const BasicBlock &block(size_t i) const {
+		return blocks_[i];
+	}
+
+	inline const std::vector<BasicBlock> &blocks() const {
+		return blocks_;
+	}
+
+	inline const int *successors(size_t i) const {
+		return succ_.data() + blocks_[i].succ;
+	}
+
+	inline const int *predecessors(size_t i) const {
+		return pred_.data() + blocks_[i].pred;
+	}
+
+	inline int blockOf(int pc) const {
+		return blockOf_[pc];
+	}
+
+	// the target of a jmp, forloop, forprep or tforloop at pc, -1 for other instructions
+	static int jumpTarget(const std::vector<Instruction> &code, int pc);
+
+	// true if the instruction may skip the next one (comparisons, test, testset, loadbool with C)
+	static bool skips(Instruction i);
+
+	// true if control never reaches the next instruction
+	static bool noFallThrough(Instruction i);
+
+private:
+	std::vector<BasicBlock> blocks_;
+	std::vector<int> succ_, pred_;
+	std::vector<int> blockOf_;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#include "CharClass.h"
+
+#define S CharClass::SPACE
+#define B CharClass::BLANK
+#define D CharClass::DIGIT
+#define A CharClass::ALPHA
+#define X CharClass::XDIGIT
+#define U CharClass::UNDERSCORE
+
+const unsigned char CharClass::table[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, S|B, S, S, S, S, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	S|B, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	D|X, D|X, D|X, D|X, D|X, D|X, D|X, D|X, D|X, D|X, 0, 0, 0, 0, 0, 0,
+	0, A|X, A|X, A|X, A|X, A|X, A|X, A, A, A, A, A, A, A, A, A,
+	A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, U,
+	0, A|X, A|X, A|X, A|X, A|X, A|X, A, A, A, A, A, A, A, A, A,
+	A, A, A, A, A, A, A, A, A, A, A, 0, 0, 0, 0, 0
+	// the rest, bytes 128 to 255, are in no class
+};
@@ -0,0 +1,51 @@
+#ifndef CHARCLASS_H
+#define CHARCLASS_H
+
+// Character classes of the assembly syntax with the meaning they have in the C locale, looked up
+// in one table. Unlike the <cctype> functions these take any char, negative ones included, and do
+// not depend on the global locale.
+namespace CharClass {
+	enum {
+		SPACE = 1, // ' ', \t, \n, \v, \f, \r
+		BLANK = 2, // ' ', \t
+		DIGIT = 4,
+		ALPHA = 8,
+		XDIGIT = 0x10,
+		UNDERSCORE = 0x20
+	};
+
+	extern const unsigned char table[256];
+
+	inline bool is(char c, unsigned char classes) {
+		return (table[(unsigned char)c] & classes) != 0;
+	}
+
+	inline bool isSpace(char c) {
+		return is(c, SPACE);
+	}
+	inline bool isBlank(char c) {
+		return is(c, BLANK);
+	}
+	inline bool isDigit(char c) {
+		return is(c, DIGIT);
+	}
+	inline bool isAlpha(char c) {
+		return is(c, ALPHA);
+	}
+	inline bool isAlnum(char c) {
+		return is(c, ALPHA | DIGIT);
+	}
+	inline bool isXDigit(char c) {
+		return is(c, XDIGIT);
+	}
+	// labels, opcodes and directive names
+	inline bool isIdent(char c) {
+		return is(c, ALPHA | DIGIT | UNDERSCORE);
+	}
+
+	inline char lower(char c) {
+		return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c;
+	}
+}
+
+#endif
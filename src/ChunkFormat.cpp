@@ -0,0 +1,266 @@
+#include "ChunkFormat.h"
+#include "ByteSwap.h"
+
+#include <cstdint>
+#include <sstream>
+
+static bool hostBigEndian() {
+	const uint32_t one = 1;
+	unsigned char first;
+	std::memcpy(&first, &one, 1);
+	return first == 0;
+}
+
+ChunkFormat ChunkFormat::native() {
+	ChunkFormat format;
+	format.intSize = sizeof(int);
+	format.sizetSize = sizeof(LUA_SIZE_T_TYPE);
+	format.instructionSize = sizeof(Instruction);
+	format.integerSize = sizeof(lua_Integer);
+	format.numberSize = sizeof(lua_Number);
+	format.bigEndian = hostBigEndian();
+	return format;
+}
+
+std::string ChunkFormat::unsupported() const {
+	if (intSize != 4) {
+		return "int size " + std::to_string(intSize) + " is not supported";
+	}
+	if (instructionSize != 4) {
+		return "Instruction size " + std::to_string(instructionSize) + " is not supported";
+	}
+	if (sizetSize != 4 && sizetSize != 8) {
+		return "size_t size " + std::to_string(sizetSize) + " is not supported";
+	}
+	if (integerSize != 4 && integerSize != 8) {
+		return "lua_Integer size " + std::to_string(integerSize) + " is not supported";
+	}
+	if (numberSize != 4 && numberSize != 8) {
+		return "lua_Number size " + std::to_string(numberSize) + " is not supported";
+	}
+	return "";
+}
+
+std::string ChunkFormat::str() const {
+	return std::string(bigEndian ? "be" : "le") + ",size_t=" + std::to_string(sizetSize) + ",integer=" + std::to_string(integerSize) + ",number=" + std::to_string(numberSize);
+}
+
+bool ChunkFormat::parse(const std::string &spec, ChunkFormat &format) {
+	format = native();
+	std::stringstream ss(spec);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (item == "native") {
+			format = native();
+		} else if (item == "le" || item == "be") {
+			format.bigEndian = item == "be";
+		} else {
+			size_t eq = item.find('=');
+			if (eq == std::string::npos || eq + 2 != item.size() || (item[eq + 1] != '4' && item[eq + 1] != '8')) {
+				return false;
+			}
+			unsigned char size = item[eq + 1] - '0';
+			std::string name = item.substr(0, eq);
+			if (name == "size_t") {
+				format.sizetSize = size;
+			} else if (name == "integer") {
+				format.integerSize = size;
+			} else if (name == "number") {
+				format.numberSize = size;
+			} else {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+template<bool Swap, typename SizeT, typename Integer, typename Number>
+class FormatReader : public ChunkReader {
+public:
+	FormatReader(const ChunkFormat &format, const BufferPtr &buffer) : buffer_(buffer) {
+		format_ = format;
+	}
+
+	Util::BoolRes readInt(int &n) override {
+		int32_t value;
+		auto res = read(value);
+		n = value;
+		return res;
+	}
+
+	Util::BoolRes readSize(size_t &n) override {
+		SizeT value;
+		auto res = read(value);
+		n = (size_t)value;
+		return res;
+	}
+
+	Util::BoolRes readInteger(lua_Integer &n) override {
+		Integer value;
+		auto res = read(value);
+		n = value;
+		return res;
+	}
+
+	Util::BoolRes readNumber(lua_Number &n) override {
+		Number value;
+		auto res = read(value);
+		n = value;
+		return res;
+	}
+
+	Util::BoolRes readInstructions(std::vector<Instruction> &code, size_t n) override {
+		code.resize(n);
+		if (buffer_->read(reinterpret_cast<char*>(code.data()), n * sizeof(Instruction)) != n * sizeof(Instruction)) {
+			return Util::BoolRes(false, "failed to read code");
+		}
+		if (Swap) {
+			ByteSwap::swap32(code.data(), n);
+		}
+		return Util::BoolRes(true, "");
+	}
+
+	Util::BoolRes readInts(std::vector<int> &ints, size_t n) override {
+		ints.resize(n);
+		if (buffer_->read(reinterpret_cast<char*>(ints.data()), n * sizeof(int)) != n * sizeof(int)) {
+			return Util::BoolRes(false, "failed to read lineinfo (eof?)");
+		}
+		if (Swap) {
+			ByteSwap::swap32(ints.data(), n);
+		}
+		return Util::BoolRes(true, "");
+	}
+
+	Util::BoolRes skipInts(size_t n) override {
+		if (buffer_->skip(n * sizeof(int)) != n * sizeof(int)) {
+			return Util::BoolRes(false, "failed to read lineinfo (eof?)");
+		}
+		return Util::BoolRes(true, "");
+	}
+
+private:
+	template<typename T>
+	inline Util::BoolRes read(T &value) {
+		if (buffer_->read(reinterpret_cast<char*>(&value), sizeof(T)) != sizeof(T)) {
+			return Util::BoolRes(false, "read failed; end of stream?");
+		}
+		if (Swap) {
+			value = ByteSwap::swap(value);
+		}
+		return Util::BoolRes(true, "");
+	}
+
+	BufferPtr buffer_;
+};
+
+template<bool Swap, typename SizeT, typename Integer, typename Number>
+class FormatWriter : public ChunkWriter {
+public:
+	FormatWriter(const ChunkFormat &format, const WriteBufferPtr &buffer) : buffer_(buffer) {
+		format_ = format;
+	}
+
+	Util::BoolRes writeInt(int n) override {
+		return write((int32_t)n);
+	}
+
+	Util::BoolRes writeSize(size_t n) override {
+		if ((size_t)(SizeT)n != n) {
+			return Util::BoolRes(false, "size " + std::to_string(n) + " does not fit the chunk's size_t");
+		}
+		return write((SizeT)n);
+	}
+
+	Util::BoolRes writeInteger(lua_Integer n) override {
+		if ((lua_Integer)(Integer)n != n) {
+			return Util::BoolRes(false, "integer constant " + std::to_string(n) + " does not fit the chunk's lua_Integer");
+		}
+		return write((Integer)n);
+	}
+
+	Util::BoolRes writeNumber(lua_Number n) override {
+		if ((lua_Number)(Number)n != n && n == n) {
+			return Util::BoolRes(false, "float constant " + NumberFormat::format(n) + " is not exact in the chunk's lua_Number");
+		}
+		return write((Number)n);
+	}
+
+	Util::BoolRes writeInstructions(const std::vector<Instruction> &code) override {
+		return writeArray(code, "failed to write instructions");
+	}
+
+	Util::BoolRes writeInts(const std::vector<int> &ints) override {
+		return writeArray(ints, "failed to write lineinfo");
+	}
+
+private:
+	template<typename T>
+	inline Util::BoolRes write(T value) {
+		if (Swap) {
+			value = ByteSwap::swap(value);
+		}
+		return buffer_->write(value);
+	}
+
+	template<typename T>
+	Util::BoolRes writeArray(const std::vector<T> &values, const char *error) {
+		const T *data = values.data();
+		std::vector<T> swapped;
+		if (Swap) {
+			swapped = values;
+			ByteSwap::swap32(swapped.data(), swapped.size());
+			data = swapped.data();
+		}
+		if (buffer_->writeBytes(reinterpret_cast<const char*>(data), values.size() * sizeof(T)) != values.size() * sizeof(T)) {
+			return Util::BoolRes(false, error);
+		}
+		return Util::BoolRes(true, "");
+	}
+
+	WriteBufferPtr buffer_;
+};
+
+// one level per header field picks the instantiation of Impl for the format
+template<typename Base, template<bool, typename, typename, typename> class Impl, bool Swap, typename SizeT, typename Integer, typename B>
+static Base *selectNumber(const ChunkFormat &format, const B &buffer) {
+	if (format.numberSize == 4) {
+		return new Impl<Swap, SizeT, Integer, float>(format, buffer);
+	}
+	return new Impl<Swap, SizeT, Integer, double>(format, buffer);
+}
+
+template<typename Base, template<bool, typename, typename, typename> class Impl, bool Swap, typename SizeT, typename B>
+static Base *selectInteger(const ChunkFormat &format, const B &buffer) {
+	if (format.integerSize == 4) {
+		return selectNumber<Base, Impl, Swap, SizeT, int32_t>(format, buffer);
+	}
+	return selectNumber<Base, Impl, Swap, SizeT, int64_t>(format, buffer);
+}
+
+template<typename Base, template<bool, typename, typename, typename> class Impl, bool Swap, typename B>
+static Base *selectSize(const ChunkFormat &format, const B &buffer) {
+	if (format.sizetSize == 4) {
+		return selectInteger<Base, Impl, Swap, uint32_t>(format, buffer);
+	}
+	return selectInteger<Base, Impl, Swap, uint64_t>(format, buffer);
+}
+
+template<typename Base, template<bool, typename, typename, typename> class Impl, typename B>
+static Base *select(const ChunkFormat &format, const B &buffer) {
+	if (!format.unsupported().empty()) {
+		return nullptr;
+	}
+	if (format.bigEndian != hostBigEndian()) {
+		return selectSize<Base, Impl, true>(format, buffer);
+	}
+	return selectSize<Base, Impl, false>(format, buffer);
+}
+
+std::unique_ptr<ChunkReader> ChunkReader::create(const ChunkFormat &format, const BufferPtr &buffer) {
+	return std::unique_ptr<ChunkReader>(select<ChunkReader, FormatReader>(format, buffer));
+}
+
+std::unique_ptr<ChunkWriter> ChunkWriter::create(const ChunkFormat &format, const WriteBufferPtr &buffer) {
+	return std::unique_ptr<ChunkWriter>(select<ChunkWriter, FormatWriter>(format, buffer));
+}
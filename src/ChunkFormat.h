@@ -0,0 +1,89 @@
+#ifndef CHUNKFORMAT_H
+#define CHUNKFORMAT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "Buffer.h"
+#include "WriteBuffer.h"
+#include "lconfig.h"
+
+// Type sizes and byte order of a binary chunk, as announced by its header. int and Instruction are
+// 4 bytes in every supported format, size_t and lua_Integer 4 or 8, lua_Number 4 (float) or 8.
+struct ChunkFormat {
+	unsigned char intSize, sizetSize, instructionSize, integerSize, numberSize;
+	bool bigEndian;
+
+	// the format of chunks made by this build
+	static ChunkFormat native();
+
+	// empty if the format can be read and written, otherwise the reason it cannot
+	std::string unsupported() const;
+
+	// "le" or "be" followed by the sizes, e.g. "be,size_t=4,integer=4,number=4"
+	std::string str() const;
+
+	// parses "native" or a comma separated list of "le", "be", "size_t=N", "integer=N" and
+	// "number=N", starting from the native format
+	static bool parse(const std::string &spec, ChunkFormat &format);
+
+	inline bool operator==(const ChunkFormat &f) const {
+		return intSize == f.intSize && sizetSize == f.sizetSize && instructionSize == f.instructionSize
+			&& integerSize == f.integerSize && numberSize == f.numberSize && bigEndian == f.bigEndian;
+	}
+	inline bool operator!=(const ChunkFormat &f) const {
+		return !(*this == f);
+	}
+};
+
+// Reads the fixed size fields of a chunk in one format and converts them to the host types. There
+// is one implementation per format, specialized at compile time; create() picks it.
+class ChunkReader {
+public:
+	virtual ~ChunkReader() {};
+
+	virtual Util::BoolRes readInt(int &n) =0;
+	virtual Util::BoolRes readSize(size_t &n) =0;
+	virtual Util::BoolRes readInteger(lua_Integer &n) =0;
+	virtual Util::BoolRes readNumber(lua_Number &n) =0;
+	virtual Util::BoolRes readInstructions(std::vector<Instruction> &code, size_t n) =0;
+	virtual Util::BoolRes readInts(std::vector<int> &ints, size_t n) =0;
+	virtual Util::BoolRes skipInts(size_t n) =0;
+
+	inline const ChunkFormat &format() const {
+		return format_;
+	}
+
+	// nullptr if the format is not supported
+	static std::unique_ptr<ChunkReader> create(const ChunkFormat &format, const BufferPtr &buffer);
+
+protected:
+	ChunkFormat format_;
+};
+
+// Writes the fixed size fields of a chunk in one format. Values the format cannot represent (an
+// integer beyond 32 bits, a float that is not exact in single precision) are errors.
+class ChunkWriter {
+public:
+	virtual ~ChunkWriter() {};
+
+	virtual Util::BoolRes writeInt(int n) =0;
+	virtual Util::BoolRes writeSize(size_t n) =0;
+	virtual Util::BoolRes writeInteger(lua_Integer n) =0;
+	virtual Util::BoolRes writeNumber(lua_Number n) =0;
+	virtual Util::BoolRes writeInstructions(const std::vector<Instruction> &code) =0;
+	virtual Util::BoolRes writeInts(const std::vector<int> &ints) =0;
+
+	inline const ChunkFormat &format() const {
+		return format_;
+	}
+
+	// nullptr if the format is not supported
+	static std::unique_ptr<ChunkWriter> create(const ChunkFormat &format, const WriteBufferPtr &buffer);
+
+protected:
+	ChunkFormat format_;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include "ConstantPool.h"
+
+#include <cstring>
+
+ConstantPool::ConstantPool(std::vector<TValuePtr> &&constants) : values_(std::move(constants)) {
+	index_.reserve(values_.size());
+	for (size_t i = 0; i < values_.size(); i++) {
+		index_.emplace(key(*values_[i]), i); // keeps the first of any duplicates
+	}
+}
+
+std::string ConstantPool::key(TValue &value) {
+	std::string k(1, (char)value.type());
+	switch (value.type()) {
+		case LUA_TBOOLEAN:
+			k += reinterpret_cast<TBool*>(&value)->value() ? '1' : '0';
+			break;
+		case LUA_TNUMBER: {
+			lua_Number number = reinterpret_cast<TNumber*>(&value)->number();
+			char bytes[sizeof(number)];
+			std::memcpy(bytes, &number, sizeof(number));
+			k.append(bytes, sizeof(bytes));
+			break;
+		}
+		case LUA_TNUMINT: {
+			lua_Integer integer = reinterpret_cast<TInteger*>(&value)->integer();
+			char bytes[sizeof(integer)];
+			std::memcpy(bytes, &integer, sizeof(integer));
+			k.append(bytes, sizeof(bytes));
+			break;
+		}
+		case LUA_TSTRING:
+			k += reinterpret_cast<TString*>(&value)->string();
+			break;
+	}
+	return k;
+}
+
+size_t ConstantPool::add(TValuePtr value, bool *found) {
+	auto res = index_.emplace(key(*value), values_.size());
+	if (found != nullptr) {
+		*found = !res.second;
+	}
+	if (res.second) {
+		values_.push_back(value);
+	}
+	return res.first->second;
+}
+
+size_t ConstantPool::find(TValue &value) const {
+	auto it = index_.find(key(value));
+	return it == index_.end() ? npos : it->second;
+}
+
+std::vector<TValuePtr> ConstantPool::take() {
+	std::vector<TValuePtr> values;
+	values.swap(values_);
+	index_.clear();
+	return values;
+}
@@ -0,0 +1,43 @@
+#ifndef CONSTANTPOOL_H
+#define CONSTANTPOOL_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "lconfig.h"
+
+// A function's constant table with hashed deduplication. Constants are keyed by type and exact
+// representation, so 0.0 and -0.0 (which compare equal) stay separate entries.
+class ConstantPool {
+public:
+	ConstantPool() {};
+	ConstantPool(std::vector<TValuePtr> &&constants); // indexes an existing table
+
+	// returns the index of the constant, adding it if there is no identical one yet
+	size_t add(TValuePtr value, bool *found = nullptr);
+
+	// the index of an identical constant, npos if there is none
+	size_t find(TValue &value) const;
+
+	static const size_t npos = (size_t)-1;
+
+	inline size_t size() const {
+		return values_.size();
+	}
+
+	inline const TValuePtr &operator[](size_t i) const {
+		return values_[i];
+	}
+
+	// hands out the table and leaves the pool empty
+	std::vector<TValuePtr> take();
+
+	static std::string key(TValue &value);
+
+private:
+	std::vector<TValuePtr> values_;
+	std::unordered_map<std::string, size_t> index_;
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include "DecodedCode.h"
+#include "opcodes.h"
+#include "Simd.h"
+
+#include <algorithm>
+
+// where the kernels write, indexed like the instructions
+struct Fields {
+	unsigned char *opcode, *a;
+	unsigned short *b, *c;
+	int *bx, *sbx;
+};
+
+static void decodeScalar(const Instruction *code, size_t from, size_t to, const Fields &out) {
+	for (size_t i = from; i < to; i++) {
+		Instruction ins = code[i];
+		out.opcode[i] = GET_OPCODE(ins);
+		out.a[i] = GETARG_A(ins);
+		out.b[i] = GETARG_B(ins);
+		out.c[i] = GETARG_C(ins);
+		out.bx[i] = GETARG_Bx(ins);
+		out.sbx[i] = GETARG_sBx(ins);
+	}
+}
+
+#ifdef SIMD_X86
+static const bool useAVX2 = Simd::avx2();
+static const bool useSSE2 = Simd::sse2();
+
+// 8 instructions per round: the narrow fields are packed to 16 and then 8 bits
+SSE2_TARGET static size_t decodeSSE2(const Instruction *code, size_t n, const Fields &out) {
+	const __m128i maskOp = _mm_set1_epi32(MASK1(SIZE_OP, 0));
+	const __m128i maskA = _mm_set1_epi32(MASK1(SIZE_A, 0));
+	const __m128i maskB = _mm_set1_epi32(MASK1(SIZE_B, 0));
+	const __m128i maskC = _mm_set1_epi32(MASK1(SIZE_C, 0));
+	const __m128i maskBx = _mm_set1_epi32(MASK1(SIZE_Bx, 0));
+	const __m128i bias = _mm_set1_epi32(MAXARG_sBx);
+
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(code + i));
+		__m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(code + i + 4));
+
+		__m128i op = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, POS_OP), maskOp), _mm_and_si128(_mm_srli_epi32(v1, POS_OP), maskOp));
+		__m128i a = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, POS_A), maskA), _mm_and_si128(_mm_srli_epi32(v1, POS_A), maskA));
+		__m128i b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, POS_B), maskB), _mm_and_si128(_mm_srli_epi32(v1, POS_B), maskB));
+		__m128i c = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, POS_C), maskC), _mm_and_si128(_mm_srli_epi32(v1, POS_C), maskC));
+		__m128i bx0 = _mm_and_si128(_mm_srli_epi32(v0, POS_Bx), maskBx);
+		__m128i bx1 = _mm_and_si128(_mm_srli_epi32(v1, POS_Bx), maskBx);
+
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out.opcode + i), _mm_packus_epi16(op, op));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out.a + i), _mm_packus_epi16(a, a));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out.b + i), b);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out.c + i), c);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out.bx + i), bx0);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out.bx + i + 4), bx1);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out.sbx + i), _mm_sub_epi32(bx0, bias));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out.sbx + i + 4), _mm_sub_epi32(bx1, bias));
+	}
+	return i;
+}
+
+// packs two vectors of 8 fields into 16 x 16 bits in instruction order (the pack works per lane)
+AVX2_TARGET static inline __m256i pack16(__m256i v0, __m256i v1, int shift, __m256i mask) {
+	__m256i x0 = _mm256_and_si256(_mm256_srl_epi32(v0, _mm_cvtsi32_si128(shift)), mask);
+	__m256i x1 = _mm256_and_si256(_mm256_srl_epi32(v1, _mm_cvtsi32_si128(shift)), mask);
+	return _mm256_permute4x64_epi64(_mm256_packs_epi32(x0, x1), 0xD8);
+}
+
+// 16 instructions per round
+AVX2_TARGET static size_t decodeAVX2(const Instruction *code, size_t n, const Fields &out) {
+	const __m256i maskOp = _mm256_set1_epi32(MASK1(SIZE_OP, 0));
+	const __m256i maskA = _mm256_set1_epi32(MASK1(SIZE_A, 0));
+	const __m256i maskB = _mm256_set1_epi32(MASK1(SIZE_B, 0));
+	const __m256i maskC = _mm256_set1_epi32(MASK1(SIZE_C, 0));
+	const __m256i maskBx = _mm256_set1_epi32(MASK1(SIZE_Bx, 0));
+	const __m256i bias = _mm256_set1_epi32(MAXARG_sBx);
+
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(code + i));
+		__m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(code + i + 8));
+
+		__m256i op = pack16(v0, v1, POS_OP, maskOp);
+		__m256i a = pack16(v0, v1, POS_A, maskA);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out.opcode + i), _mm_packus_epi16(_mm256_castsi256_si128(op), _mm256_extracti128_si256(op, 1)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out.a + i), _mm_packus_epi16(_mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out.b + i), pack16(v0, v1, POS_B, maskB));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out.c + i), pack16(v0, v1, POS_C, maskC));
+
+		__m256i bx0 = _mm256_and_si256(_mm256_srli_epi32(v0, POS_Bx), maskBx);
+		__m256i bx1 = _mm256_and_si256(_mm256_srli_epi32(v1, POS_Bx), maskBx);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out.bx + i), bx0);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out.bx + i + 8), bx1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out.sbx + i), _mm256_sub_epi32(bx0, bias));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out.sbx + i + 8), _mm256_sub_epi32(bx1, bias));
+	}
+	return i;
+}
+
+// the range checks return how many leading values they covered; a round with a failing value stops
+// them, the scalar code then finds the value again
+SSE2_TARGET static size_t maxSSE2(const unsigned char *v, size_t n, unsigned char &max) {
+	__m128i m = _mm_setzero_si128();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		m = _mm_max_epu8(m, _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i)));
+	}
+	unsigned char bytes[16];
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(bytes), m);
+	max = *std::max_element(bytes, bytes + 16);
+	return i;
+}
+
+AVX2_TARGET static size_t maxAVX2(const unsigned char *v, size_t n, unsigned char &max) {
+	__m256i m = _mm256_setzero_si256();
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		m = _mm256_max_epu8(m, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i)));
+	}
+	unsigned char bytes[32];
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(bytes), m);
+	max = *std::max_element(bytes, bytes + 32);
+	return i;
+}
+
+// limits are clamped to 256 and indexes are at most 255, so signed 16 bit compares are enough
+SSE2_TARGET static size_t rkSSE2(const unsigned short *v, size_t n, int registers, int constants) {
+	const __m128i bitrk = _mm_set1_epi16(BITRK);
+	const __m128i index = _mm_set1_epi16(MAXINDEXRK);
+	const __m128i regs = _mm_set1_epi16((short)registers);
+	const __m128i consts = _mm_set1_epi16((short)constants);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i));
+		__m128i isk = _mm_cmpeq_epi16(_mm_and_si128(x, bitrk), bitrk);
+		__m128i limit = _mm_or_si128(_mm_and_si128(isk, consts), _mm_andnot_si128(isk, regs));
+		if (_mm_movemask_epi8(_mm_cmpgt_epi16(limit, _mm_and_si128(x, index))) != 0xFFFF) {
+			break;
+		}
+	}
+	return i;
+}
+
+AVX2_TARGET static size_t rkAVX2(const unsigned short *v, size_t n, int registers, int constants) {
+	const __m256i bitrk = _mm256_set1_epi16(BITRK);
+	const __m256i index = _mm256_set1_epi16(MAXINDEXRK);
+	const __m256i regs = _mm256_set1_epi16((short)registers);
+	const __m256i consts = _mm256_set1_epi16((short)constants);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+		__m256i isk = _mm256_cmpeq_epi16(_mm256_and_si256(x, bitrk), bitrk);
+		__m256i limit = _mm256_blendv_epi8(regs, consts, isk);
+		if ((unsigned int)_mm256_movemask_epi8(_mm256_cmpgt_epi16(limit, _mm256_and_si256(x, index))) != 0xFFFFFFFFu) {
+			break;
+		}
+	}
+	return i;
+}
+#endif
+
+DecodedCode::DecodedCode() {
+
+}
+
+DecodedCode::DecodedCode(const std::vector<Instruction> &code) {
+	decode(code);
+}
+
+const char *DecodedCode::kernel() {
+	return Simd::kernel();
+}
+
+void DecodedCode::resize(size_t n) {
+	opcode.resize(n);
+	a.resize(n);
+	b.resize(n);
+	c.resize(n);
+	bx.resize(n);
+	sbx.resize(n);
+}
+
+void DecodedCode::decode(const std::vector<Instruction> &code) {
+	resize(code.size());
+	Fields out = {opcode.data(), a.data(), b.data(), c.data(), bx.data(), sbx.data()};
+	size_t done = 0;
+#ifdef SIMD_X86
+	if (useAVX2) {
+		done = decodeAVX2(code.data(), code.size(), out);
+	} else if (useSSE2) {
+		done = decodeSSE2(code.data(), code.size(), out);
+	}
+#endif
+	::decodeScalar(code.data(), done, code.size(), out);
+}
+
+void DecodedCode::decodeScalar(const std::vector<Instruction> &code) {
+	resize(code.size());
+	Fields out = {opcode.data(), a.data(), b.data(), c.data(), bx.data(), sbx.data()};
+	::decodeScalar(code.data(), 0, code.size(), out);
+}
+
+unsigned char DecodedCode::max(const std::vector<unsigned char> &field) {
+	unsigned char max = 0;
+	size_t i = 0;
+#ifdef SIMD_X86
+	if (useAVX2) {
+		i = maxAVX2(field.data(), field.size(), max);
+	} else if (useSSE2) {
+		i = maxSSE2(field.data(), field.size(), max);
+	}
+#endif
+	for (; i < field.size(); i++) {
+		max = std::max(max, field[i]);
+	}
+	return max;
+}
+
+bool DecodedCode::rkInRange(const std::vector<unsigned short> &field, int registers, int constants) {
+	registers = std::min(registers, MAXINDEXRK + 1);
+	constants = std::min(constants, MAXINDEXRK + 1);
+	size_t i = 0;
+#ifdef SIMD_X86
+	if (useAVX2) {
+		i = rkAVX2(field.data(), field.size(), registers, constants);
+	} else if (useSSE2) {
+		i = rkSSE2(field.data(), field.size(), registers, constants);
+	}
+#endif
+	for (; i < field.size(); i++) {
+		if (INDEXK(field[i]) >= (ISK(field[i]) ? constants : registers)) {
+			return false;
+		}
+	}
+	return true;
+}
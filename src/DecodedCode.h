@@ -0,0 +1,46 @@
+#ifndef DECODEDCODE_H
+#define DECODEDCODE_H
+
+#include "lconfig.h"
+#include <vector>
+
+// The fields of every instruction of a function in separate arrays, decoded in one pass. Which of
+// them are meaningful depends on the opcode's mode, like with the GETARG_* macros. The decoding
+// kernel is AVX2 or SSE2 on x86 processors that have it (picked once at run time) and scalar
+// otherwise.
+class DecodedCode {
+public:
+	DecodedCode();
+	DecodedCode(const std::vector<Instruction> &code);
+
+	void decode(const std::vector<Instruction> &code);
+
+	inline size_t size() const {
+		return opcode.size();
+	}
+
+	std::vector<unsigned char> opcode, a;
+	std::vector<unsigned short> b, c;
+	std::vector<int> bx, sbx;
+
+	// "avx2", "sse2" or "scalar"
+	static const char *kernel();
+
+	// decodes with the scalar kernel only, for comparison
+	void decodeScalar(const std::vector<Instruction> &code);
+
+	// Whole-array range checks with the same kernels, for validating every instruction at once
+	// before looking at individual ones.
+
+	// the largest value of a byte field, 0 if empty
+	static unsigned char max(const std::vector<unsigned char> &field);
+
+	// whether every value of a B or C field, read as RK, is a register below 'registers' or a
+	// constant (ISK) whose index is below 'constants'
+	static bool rkInRange(const std::vector<unsigned short> &field, int registers, int constants);
+
+private:
+	void resize(size_t n);
+};
+
+#endif
@@ -0,0 +1,318 @@
+#include "Dumper.h"
+#include "AllocStats.h"
+#include "StringWriteBuffer.h"
+
+#define WRITE_ASSERT(f, msg) if (!f) return Util::BoolRes(false, msg);
+
+Dumper::Dumper(WriteBufferPtr wbuffer, StripLevel strip, const ChunkFormat &format) : wbuffer_(wbuffer), strip_(strip), format_(format), writer_(ChunkWriter::create(format, wbuffer)), stats_(nullptr) {
+
+}
+
+bool Dumper::parseStripLevel(const std::string &name, StripLevel &level) {
+	if (name == "none") {
+		level = STRIP_NONE;
+	} else if (name == "lines") {
+		level = STRIP_KEEP_LINES;
+	} else if (name == "all") {
+		level = STRIP_ALL;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+ParsedFunctionPtr Dumper::fromFunction(const FunctionPtr &function) {
+	ParsedFunctionPtr func(new ParsedFunction);
+	func->name = function->label();
+	func->instructions = function->code();
+	func->upvalues = function->upvalues();
+	func->constants = function->constants();
+	func->maxstacksize = function->maxStackSize();
+	func->params = function->numParams();
+	func->vararg = function->isVarArg();
+	func->source = function->source();
+	func->linedefined = function->lineDefined();
+	func->lastlinedefined = function->lastLineDefined();
+	func->lineinfos = function->lineInfo();
+	func->locvars = function->locVars();
+
+	for (const FunctionPtr &proto : function->protos()) {
+		func->protos.push_back(fromFunction(proto));
+	}
+	return func;
+}
+
+Util::BoolRes Dumper::dump(const ParsedFunction &main, unsigned char numUpvalues) {
+	if (!writer_) {
+		return Util::BoolRes(false, format_.unsupported());
+	}
+	auto res = writeHeader();
+	if (!res.success()) {
+		return res;
+	}
+
+	WRITE_ASSERT(wbuffer_->write<unsigned char>(numUpvalues).success(), "failed to write num upvalues");
+
+	return writeFunction(main, "");
+}
+
+Util::BoolRes Dumper::dump(const std::string &main, unsigned char numUpvalues, std::unordered_map<std::string, EncodedFunctionPtr> &functions) {
+	if (!writer_) {
+		return Util::BoolRes(false, format_.unsupported());
+	}
+	auto res = writeHeader();
+	if (!res.success()) {
+		return res;
+	}
+
+	WRITE_ASSERT(wbuffer_->write<unsigned char>(numUpvalues).success(), "failed to write num upvalues");
+
+	return writeEncoded(main, "", functions);
+}
+
+Util::BoolRes Dumper::encode(const ParsedFunction &function, EncodedFunction &out) {
+	if (!writer_) {
+		return Util::BoolRes(false, format_.unsupported());
+	}
+	out.name = function.name;
+	out.source = function.source;
+	out.protos = function.usedSubroutines;
+
+	Dumper head(WriteBufferPtr(new StringWriteBuffer(out.head)), strip_, format_);
+	head.setStats(stats_);
+	auto res = head.writeHead(function);
+	if (!res.success()) {
+		return res;
+	}
+	Dumper tail(WriteBufferPtr(new StringWriteBuffer(out.tail)), strip_, format_);
+	tail.setStats(stats_);
+	return tail.writeTail(function);
+}
+
+Util::BoolRes Dumper::writeEncoded(const std::string &name, const std::string &parentSource, std::unordered_map<std::string, EncodedFunctionPtr> &functions) {
+	Stats::Scope scope(stats_, Stats::WRITE);
+	AllocStats::Prototype prototype(name);
+	auto it = functions.find(name);
+	if (it == functions.end()) {
+		return Util::BoolRes(false, std::string("no such function: ") + name);
+	}
+	EncodedFunctionPtr function = it->second;
+	functions.erase(it);
+
+	bool source = strip_ != STRIP_ALL && function->source != parentSource;
+	auto res = writeString(source ? function->source : "");
+	if (!res.success()) {
+		return res;
+	}
+	if (wbuffer_->writeBytes(function->head.data(), function->head.size()) != function->head.size()) {
+		return Util::BoolRes(false, "failed to write function " + name);
+	}
+	std::string().swap(function->head);
+
+	if (!(res = writer_->writeInt(function->protos.size())).success()) { // protos length
+		return res;
+	}
+	for (const std::string &proto : function->protos) {
+		if (!(res = writeEncoded(proto, function->source, functions)).success()) {
+			return res;
+		}
+	}
+
+	if (wbuffer_->writeBytes(function->tail.data(), function->tail.size()) != function->tail.size()) {
+		return Util::BoolRes(false, "failed to write function " + name);
+	}
+	return Util::BoolRes(true, "");
+}
+
+Util::BoolRes Dumper::writeHeader() {
+	Stats::Scope scope(stats_, Stats::HEADER);
+	if (wbuffer_->writeBytes(LUA_SIGNATURE, sizeof(LUA_SIGNATURE)-1) != sizeof(LUA_SIGNATURE)-1) {
+		return Util::BoolRes(false, "failed to write signature");
+	}
+	WRITE_ASSERT(wbuffer_->write<unsigned char>(LUAC_VERSION).success(), "failed to write version");
+	WRITE_ASSERT(wbuffer_->write<unsigned char>(LUAC_FORMAT).success(), "failed to write format");
+	if (wbuffer_->writeBytes(LUAC_DATA, sizeof(LUAC_DATA)-1) != sizeof(LUAC_DATA)-1) {
+		return Util::BoolRes(false, "failed to write LUAC_DATA");
+	}
+	WRITE_ASSERT(wbuffer_->write<unsigned char>(format_.intSize).success(), "failed to write int size");
+	WRITE_ASSERT(wbuffer_->write<unsigned char>(format_.sizetSize).success(), "failed to write size_t size");
+	WRITE_ASSERT(wbuffer_->write<unsigned char>(format_.instructionSize).success(), "failed to write instruction size");
+	WRITE_ASSERT(wbuffer_->write<unsigned char>(format_.integerSize).success(), "failed to write integer size");
+	WRITE_ASSERT(wbuffer_->write<unsigned char>(format_.numberSize).success(), "failed to write number size");
+	WRITE_ASSERT(writer_->writeInteger(LUAC_INT).success(), "failed to write LUAC_INT");
+	WRITE_ASSERT(writer_->writeNumber(LUAC_NUM).success(), "failed to write LUAC_NUM");
+
+	return Util::BoolRes(true, "");
+}
+
+// an empty string is written as the NULL string
+Util::BoolRes Dumper::writeString(const std::string &string) {
+	if (string.empty()) {
+		return wbuffer_->write<unsigned char>(0);
+	}
+
+	size_t len = string.size();
+	Util::BoolRes res;
+	if (len < 0xFE) {
+		res = wbuffer_->write<unsigned char>(len + 1);
+	} else {
+		res = wbuffer_->write<unsigned char>(0xFF);
+		if (!res.success()) {
+			return res;
+		}
+		res = writer_->writeSize(len + 1);
+	}
+	if (!res.success()) {
+		return res;
+	}
+
+	if (wbuffer_->writeBytes(string.c_str(), len) != len) {
+		return Util::BoolRes(false, "could not write string");
+	}
+	return Util::BoolRes(true, "");
+}
+
+Util::BoolRes Dumper::writeFunction(const ParsedFunction &function, const std::string &parentSource) {
+	Stats::Scope scope(stats_, Stats::WRITE);
+	AllocStats::Prototype prototype(function.name);
+
+	// like ldump.c, a source equal to the parent's is not repeated
+	bool source = strip_ != STRIP_ALL && function.source != parentSource;
+	auto res = writeString(source ? function.source : "");
+	if (!res.success()) {
+		return res;
+	}
+	if (!(res = writeHead(function)).success()) {
+		return res;
+	}
+
+	if (!(res = writer_->writeInt(function.protos.size())).success()) { // protos length
+		return res;
+	}
+	for (const ParsedFunctionPtr &proto : function.protos) {
+		if (!(res = writeFunction(*proto, function.source)).success()) {
+			return res;
+		}
+	}
+
+	return writeTail(function);
+}
+
+// everything from linedefined up to the protos
+Util::BoolRes Dumper::writeHead(const ParsedFunction &function) {
+	Util::BoolRes res;
+	if (!(res = writer_->writeInt(function.linedefined)).success()) { // linedefined
+		return res;
+	}
+	if (!(res = writer_->writeInt(function.lastlinedefined)).success()) { // lastlinedefined
+		return res;
+	}
+	if (!(res = wbuffer_->write(function.params)).success()) { // numparams
+		return res;
+	}
+	if (!(res = wbuffer_->write(function.vararg)).success()) { // is_vararg
+		return res;
+	}
+	if (!(res = wbuffer_->write(function.maxstacksize)).success()) { // maxstacksize
+		return res;
+	}
+
+	if (!(res = writer_->writeInt(function.instructions.size())).success()) { // code length
+		return res;
+	}
+	if (!(res = writer_->writeInstructions(function.instructions)).success()) { // code
+		return res;
+	}
+
+	if (!(res = writer_->writeInt(function.constants.size())).success()) { // constants length
+		return res;
+	}
+
+	for (const TValuePtr &constant : function.constants) {
+		if (!(res = wbuffer_->write<unsigned char>(constant->type())).success()) { // constant type
+			return res;
+		}
+		switch (constant->type()) {
+			case LUA_TSTRING: {
+				if (!(res = writeString(reinterpret_cast<TString*>(constant.get())->string())).success()) {
+					return res;
+				}
+				break;
+			}
+			case LUA_TNUMBER: {
+				if (!(res = writer_->writeNumber(reinterpret_cast<TNumber*>(constant.get())->number())).success()) {
+					return res;
+				}
+				break;
+			}
+			case LUA_TNUMINT: {
+				if (!(res = writer_->writeInteger(reinterpret_cast<TInteger*>(constant.get())->integer())).success()) {
+					return res;
+				}
+				break;
+			}
+			case LUA_TBOOLEAN: {
+				if (!(res = wbuffer_->write(reinterpret_cast<TBool*>(constant.get())->value())).success()) {
+					return res;
+				}
+				break;
+			}
+		}
+	}
+
+	if (!(res = writer_->writeInt(function.upvalues.size())).success()) { // upvalues length
+		return res;
+	}
+
+	for (const Upvalue &upvalue : function.upvalues) {
+		if (!(res = wbuffer_->write(upvalue.instack)).success()) { // instack
+			return res;
+		}
+		if (!(res = wbuffer_->write(upvalue.idx)).success()) { // idx
+			return res;
+		}
+	}
+
+	return Util::BoolRes(true, "");
+}
+
+// the debug information after the protos
+Util::BoolRes Dumper::writeTail(const ParsedFunction &function) {
+	Util::BoolRes res;
+	const std::vector<int> none;
+	const std::vector<int> &lineinfos = strip_ == STRIP_ALL ? none : function.lineinfos;
+	if (!(res = writer_->writeInt(lineinfos.size())).success()) { // line info size
+		return res;
+	}
+	if (!(res = writer_->writeInts(lineinfos)).success()) {
+		return res;
+	}
+
+	bool names = strip_ == STRIP_NONE;
+	if (!(res = writer_->writeInt(names ? function.locvars.size() : 0)).success()) { // local var size
+		return res;
+	}
+	for (size_t i = 0; names && i < function.locvars.size(); i++) {
+		const LocVar &var = function.locvars[i];
+		if (!(res = writeString(var.varName)).success() || !(res = writer_->writeInt(var.startpc)).success() || !(res = writer_->writeInt(var.endpc)).success()) {
+			return res;
+		}
+	}
+
+	// upvalue names are only written when there are any, assembly does not declare them
+	bool upvalueNames = false;
+	for (const Upvalue &upvalue : function.upvalues) {
+		upvalueNames |= !upvalue.name.empty();
+	}
+	names = names && upvalueNames;
+	if (!(res = writer_->writeInt(names ? function.upvalues.size() : 0)).success()) { // upvalue name size
+		return res;
+	}
+	for (size_t i = 0; names && i < function.upvalues.size(); i++) {
+		if (!(res = writeString(function.upvalues[i].name)).success()) {
+			return res;
+		}
+	}
+
+	return Util::BoolRes(true, "");
+}
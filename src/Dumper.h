@@ -0,0 +1,86 @@
+#ifndef DUMPER_H
+#define DUMPER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "WriteBuffer.h"
+#include "lconfig.h"
+#include "Function.h"
+#include "Stats.h"
+#include "ChunkFormat.h"
+
+struct ParsedFunction;
+typedef std::shared_ptr<ParsedFunction> ParsedFunctionPtr;
+
+struct ParsedFunction {
+	std::string name;
+	std::vector<Instruction> instructions;
+	std::vector<Upvalue> upvalues;
+	std::vector<std::string> usedSubroutines;
+    std::vector<int> lineinfos;
+	std::vector<std::pair<std::string, int> > neededSubroutines;
+	std::vector<TValuePtr> constants;
+	unsigned char maxstacksize, params, vararg;
+
+	std::vector<ParsedFunctionPtr> protos; // resolved from usedSubroutines before dumping
+	std::string source; // empty for none
+	int linedefined, lastlinedefined;
+	std::vector<LocVar> locvars;
+};
+
+// A function already written out except for its source and its protos, which are spliced in when
+// the chunk is put together. Lets the assembler drop each function's parsed form as soon as the
+// function is complete.
+struct EncodedFunction {
+	std::string name;
+	std::string source;
+	std::string head; // linedefined up to the upvalues
+	std::string tail; // debug information
+	std::vector<std::string> protos; // names, in closure index order
+};
+typedef std::shared_ptr<EncodedFunction> EncodedFunctionPtr;
+
+// Writes a chunk in the format of lundump.c from a tree of functions
+class Dumper {
+public:
+	Dumper(WriteBufferPtr wbuffer, StripLevel strip = STRIP_NONE, const ChunkFormat &format = ChunkFormat::native());
+
+	inline void setStats(Stats *stats) {
+		stats_ = stats;
+	}
+
+	Util::BoolRes dump(const ParsedFunction &main, unsigned char numUpvalues);
+
+	// encodes a function whose protos are named by usedSubroutines, in the format and strip level
+	// of this dumper
+	Util::BoolRes encode(const ParsedFunction &function, EncodedFunction &out);
+
+	// writes the chunk from encoded functions, starting at main. Each function is released once it
+	// is written, so the map only holds what is still to be written.
+	Util::BoolRes dump(const std::string &main, unsigned char numUpvalues, std::unordered_map<std::string, EncodedFunctionPtr> &functions);
+
+	// builds the tree for a function loaded by the Parser, including its debug information
+	static ParsedFunctionPtr fromFunction(const FunctionPtr &function);
+
+	// parses "none", "lines" or "all"
+	static bool parseStripLevel(const std::string &name, StripLevel &level);
+
+private:
+	Util::BoolRes writeHeader();
+	Util::BoolRes writeFunction(const ParsedFunction &function, const std::string &parentSource);
+	Util::BoolRes writeHead(const ParsedFunction &function);
+	Util::BoolRes writeTail(const ParsedFunction &function);
+	Util::BoolRes writeEncoded(const std::string &name, const std::string &parentSource, std::unordered_map<std::string, EncodedFunctionPtr> &functions);
+	Util::BoolRes writeString(const std::string &string);
+
+	WriteBufferPtr wbuffer_;
+	StripLevel strip_;
+	ChunkFormat format_;
+	std::unique_ptr<ChunkWriter> writer_;
+	Stats *stats_;
+};
+
+#endif
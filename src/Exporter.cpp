@@ -0,0 +1,579 @@
+#include "Exporter.h"
+#include "DecodedCode.h"
+#include "NumberFormat.h"
+#include "opcodes.h"
+
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#define FLUSH_SIZE 0x10000 // bytes of JSON collected before they are written
+
+static_assert(sizeof(Instruction) == 4, "the binary export stores instructions as uint32_t");
+static_assert(sizeof(BinaryExport::Header) == 24 && sizeof(BinaryExport::Prototype) == 48 && sizeof(BinaryExport::Constant) == 16, "binary export layout");
+static_assert(sizeof(BinaryExport::Operands) == 12 && sizeof(BinaryExport::Upvalue) == 8 && sizeof(BinaryExport::Local) == 12, "binary export layout");
+
+// exports do not go through the InstructionParser, whose check this is
+static Util::BoolRes invalidOpcode(int op, size_t pc) {
+	return Util::BoolRes(false, "invalid opcode " + std::to_string(op) + " at pc " + std::to_string(pc));
+}
+
+static void appendInt(std::string &out, long long n) {
+	char digits[24];
+	char *end = digits + sizeof(digits), *p = end;
+	unsigned long long u = n < 0 ? 0ULL - (unsigned long long)n : (unsigned long long)n;
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u != 0);
+	if (n < 0) {
+		*--p = '-';
+	}
+	out.append(p, end - p);
+}
+
+// well-formed UTF-8: no overlong forms, surrogates or code points past U+10FFFF
+static bool isUtf8(const std::string &s) {
+	const unsigned char *c = reinterpret_cast<const unsigned char*>(s.data()), *end = c + s.size();
+	while (c != end) {
+		if (*c < 0x80) {
+			c++;
+			continue;
+		}
+		size_t n;
+		unsigned int cp;
+		if ((*c & 0xE0) == 0xC0) {
+			n = 1;
+			cp = *c & 0x1F;
+		} else if ((*c & 0xF0) == 0xE0) {
+			n = 2;
+			cp = *c & 0x0F;
+		} else if ((*c & 0xF8) == 0xF0) {
+			n = 3;
+			cp = *c & 0x07;
+		} else {
+			return false;
+		}
+		if ((size_t)(end - c) <= n) {
+			return false;
+		}
+		for (size_t i = 1; i <= n; i++) {
+			if ((c[i] & 0xC0) != 0x80) {
+				return false;
+			}
+			cp = (cp << 6) | (c[i] & 0x3F);
+		}
+		if ((n == 1 && cp < 0x80) || (n == 2 && cp < 0x800) || (n == 3 && cp < 0x10000) || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) {
+			return false;
+		}
+		c += n + 1;
+	}
+	return true;
+}
+
+// s as a JSON string, bytes that are not part of UTF-8 being read as Latin-1 unless utf8 is set
+static void appendString(std::string &out, const std::string &s, bool utf8) {
+	static const char hex[] = "0123456789abcdef";
+	out += '"';
+	size_t run = 0;
+	for (size_t i = 0; i < s.size(); i++) {
+		unsigned char c = s[i];
+		if (c >= 0x20 && c != '"' && c != '\\' && (c < 0x80 || utf8)) {
+			continue;
+		}
+		out.append(s.data() + run, i - run);
+		run = i + 1;
+		switch (c) {
+			case '"':
+				out += "\\\"";
+				break;
+			case '\\':
+				out += "\\\\";
+				break;
+			case '\n':
+				out += "\\n";
+				break;
+			case '\r':
+				out += "\\r";
+				break;
+			case '\t':
+				out += "\\t";
+				break;
+			default:
+				out += "\\u00";
+				out += hex[c >> 4];
+				out += hex[c & 15];
+				break;
+		}
+	}
+	out.append(s.data() + run, s.size() - run);
+	out += '"';
+}
+
+static void appendHex(std::string &out, const std::string &s) {
+	static const char hex[] = "0123456789abcdef";
+	out += '"';
+	for (unsigned char c : s) {
+		out += hex[c >> 4];
+		out += hex[c & 15];
+	}
+	out += '"';
+}
+
+// One object per function with its protos nested in it. Instructions are objects with the op
+// name and the operands of its mode: a, b and c (kb and kc instead for RK operands that are
+// constants, none for unused ones), a and bx, a, sbx and the jump target, or ax.
+class JsonExporter : public Exporter {
+public:
+	JsonExporter(const WriteBufferPtr &buffer) : buffer_(buffer) {}
+
+	Util::BoolRes write(const FunctionPtr &main, unsigned char numUpvalues) override {
+		out_ = "{\"numupvalues\":";
+		appendInt(out_, numUpvalues);
+		out_ += ",\"main\":";
+		auto res = writeFunction(*main);
+		if (!res.success()) {
+			return res;
+		}
+		out_ += "}\n";
+		return flush(0);
+	}
+
+private:
+	// writes what has been collected once there is more than limit
+	Util::BoolRes flush(size_t limit) {
+		if (out_.size() > limit) {
+			if (buffer_->writeBytes(out_.data(), out_.size()) != out_.size()) {
+				return Util::BoolRes(false, "write failed");
+			}
+			out_.clear();
+		}
+		return Util::BoolRes(true, "");
+	}
+
+	inline void field(const char *name, long long value) {
+		out_ += ",\"";
+		out_ += name;
+		out_ += "\":";
+		appendInt(out_, value);
+	}
+
+	void writeConstant(TValue &k) {
+		switch (k.type()) {
+			case LUA_TBOOLEAN:
+				out_ += reinterpret_cast<TBool*>(&k)->value() ? "{\"type\":\"boolean\",\"value\":true}" : "{\"type\":\"boolean\",\"value\":false}";
+				break;
+			case LUA_TNUMFLT: {
+				lua_Number number = reinterpret_cast<TNumber*>(&k)->number();
+				out_ += "{\"type\":\"number\",\"value\":";
+				if (std::isfinite(number)) {
+					out_ += NumberFormat::format(number);
+				} else {
+					out_ += '"' + NumberFormat::format(number) + '"'; // inf and nan are not JSON numbers
+				}
+				out_ += '}';
+				break;
+			}
+			case LUA_TNUMINT:
+				out_ += "{\"type\":\"integer\",\"value\":";
+				appendInt(out_, reinterpret_cast<TInteger*>(&k)->integer());
+				out_ += '}';
+				break;
+			case LUA_TSTRING: {
+				const std::string &string = reinterpret_cast<TString*>(&k)->string();
+				if (isUtf8(string)) {
+					out_ += "{\"type\":\"string\",\"value\":";
+					appendString(out_, string, true);
+				} else {
+					out_ += "{\"type\":\"string\",\"hex\":"; // arbitrary bytes, kept exactly
+					appendHex(out_, string);
+				}
+				out_ += '}';
+				break;
+			}
+			default:
+				out_ += "{\"type\":\"nil\"}";
+				break;
+		}
+	}
+
+	void writeOperand(const char *name, const char *constant, int value, OpArgMask mode) {
+		if (mode == OpArgN) {
+			return;
+		}
+		if (mode == OpArgK && ISK(value)) {
+			field(constant, INDEXK(value));
+		} else {
+			field(name, value);
+		}
+	}
+
+	Util::BoolRes writeCode(Function &f) {
+		const std::vector<Instruction> &code = f.code();
+		DecodedCode d(code);
+		out_ += ",\"code\":[";
+		for (size_t pc = 0; pc < d.size(); pc++) {
+			int op = d.opcode[pc];
+			if (op >= NUM_OPCODES) {
+				return invalidOpcode(op, pc);
+			}
+			if (pc != 0) {
+				out_ += ',';
+			}
+			out_ += "{\"op\":\"";
+			out_ += luaP_opnames[op];
+			out_ += '"';
+			switch (getOpMode(op)) {
+				case iABC:
+					field("a", d.a[pc]);
+					writeOperand("b", "kb", d.b[pc], getBMode(op));
+					writeOperand("c", "kc", d.c[pc], getCMode(op));
+					break;
+				case iABx:
+					field("a", d.a[pc]);
+					field("bx", d.bx[pc]);
+					break;
+				case iAsBx:
+					field("a", d.a[pc]);
+					field("sbx", d.sbx[pc]);
+					field("target", (long long)pc + 1 + d.sbx[pc]);
+					break;
+				case iAx:
+					field("ax", GETARG_Ax(code[pc]));
+					break;
+			}
+			out_ += '}';
+		}
+		out_ += ']';
+		return Util::BoolRes(true, "");
+	}
+
+	Util::BoolRes writeFunction(Function &f) {
+		out_ += "{\"name\":";
+		appendString(out_, f.label(), true);
+		out_ += ",\"source\":";
+		if (f.source().empty()) {
+			out_ += "null";
+		} else {
+			appendString(out_, f.source(), isUtf8(f.source()));
+		}
+		field("linedefined", f.lineDefined());
+		field("lastlinedefined", f.lastLineDefined());
+		field("params", f.numParams());
+		field("vararg", f.isVarArg());
+		field("maxstacksize", f.maxStackSize());
+
+		out_ += ",\"constants\":[";
+		for (size_t i = 0; i < f.constants().size(); i++) {
+			if (i != 0) {
+				out_ += ',';
+			}
+			writeConstant(*f.constants()[i]);
+		}
+		out_ += ']';
+
+		out_ += ",\"upvalues\":[";
+		for (size_t i = 0; i < f.upvalues().size(); i++) {
+			const Upvalue &u = f.upvalues()[i];
+			out_ += i != 0 ? ",{\"instack\":" : "{\"instack\":";
+			appendInt(out_, u.instack);
+			field("idx", u.idx);
+			out_ += ",\"name\":";
+			appendString(out_, u.name, isUtf8(u.name));
+			out_ += '}';
+		}
+		out_ += ']';
+
+		auto res = writeCode(f);
+		if (!res.success()) {
+			return res;
+		}
+
+		out_ += ",\"lineinfo\":[";
+		for (size_t i = 0; i < f.lineInfo().size(); i++) {
+			if (i != 0) {
+				out_ += ',';
+			}
+			appendInt(out_, f.lineInfo()[i]);
+		}
+		out_ += ']';
+
+		out_ += ",\"locals\":[";
+		for (size_t i = 0; i < f.locVars().size(); i++) {
+			const LocVar &var = f.locVars()[i];
+			out_ += i != 0 ? ",{\"name\":" : "{\"name\":";
+			appendString(out_, var.varName, isUtf8(var.varName));
+			field("startpc", var.startpc);
+			field("endpc", var.endpc);
+			out_ += '}';
+		}
+		out_ += ']';
+
+		if (!(res = flush(FLUSH_SIZE)).success()) {
+			return res;
+		}
+
+		out_ += ",\"protos\":[";
+		for (size_t i = 0; i < f.protos().size(); i++) {
+			if (i != 0) {
+				out_ += ',';
+			}
+			if (!(res = writeFunction(*f.protos()[i])).success()) {
+				return res;
+			}
+		}
+		out_ += "]}";
+		return Util::BoolRes(true, "");
+	}
+
+	WriteBufferPtr buffer_;
+	std::string out_;
+};
+
+// where the arrays and the strings of a function go in its record
+struct Layout {
+	size_t constants, code, operands, upvalues, protos, lineinfo, locals, strings, size;
+};
+
+static inline size_t stringSize(const std::string &s) {
+	return (sizeof(uint32_t) + s.size() + 1 + 3) & ~(size_t)3;
+}
+
+static Layout layout(Function &f) {
+	Layout l;
+	l.constants = sizeof(BinaryExport::Prototype);
+	l.code = l.constants + f.constants().size() * sizeof(BinaryExport::Constant);
+	l.operands = l.code + f.code().size() * sizeof(uint32_t);
+	l.upvalues = l.operands + f.code().size() * sizeof(BinaryExport::Operands);
+	l.protos = l.upvalues + f.upvalues().size() * sizeof(BinaryExport::Upvalue);
+	l.lineinfo = l.protos + f.protos().size() * sizeof(uint32_t);
+	l.locals = l.lineinfo + f.lineInfo().size() * sizeof(int32_t);
+	l.strings = l.locals + f.locVars().size() * sizeof(BinaryExport::Local);
+
+	size_t size = l.strings + stringSize(f.label());
+	if (!f.source().empty()) {
+		size += stringSize(f.source());
+	}
+	for (const TValuePtr &k : f.constants()) {
+		if (k->type() == LUA_TSTRING) {
+			size += stringSize(reinterpret_cast<TString*>(k.get())->string());
+		}
+	}
+	for (const Upvalue &u : f.upvalues()) {
+		if (!u.name.empty()) {
+			size += stringSize(u.name);
+		}
+	}
+	for (const LocVar &var : f.locVars()) {
+		size += stringSize(var.varName);
+	}
+	l.size = (size + 7) & ~(size_t)7;
+	return l;
+}
+
+// Functions are numbered in preorder. Their sizes are worked out first, so that the offset index
+// can be written ahead of them; each record is then built and written on its own.
+class BinaryExporter : public Exporter {
+public:
+	BinaryExporter(const WriteBufferPtr &buffer) : buffer_(buffer) {}
+
+	Util::BoolRes write(const FunctionPtr &main, unsigned char numUpvalues) override {
+		functions_.clear();
+		indices_.clear();
+		collect(main.get());
+
+		std::vector<Layout> layouts;
+		std::vector<uint64_t> offsets;
+		uint64_t offset = sizeof(BinaryExport::Header) + functions_.size() * sizeof(uint64_t);
+		for (Function *f : functions_) {
+			layouts.push_back(layout(*f));
+			if (layouts.back().size > UINT32_MAX) {
+				return Util::BoolRes(false, f->label() + " is too large for a binary export record");
+			}
+			offsets.push_back(offset);
+			offset += layouts.back().size;
+		}
+
+		BinaryExport::Header header;
+		std::memcpy(header.magic, BinaryExport::MAGIC, sizeof(BinaryExport::MAGIC));
+		header.version = BinaryExport::VERSION;
+		header.byteOrder = BinaryExport::ORDER_MARK;
+		header.functions = (uint32_t)functions_.size();
+		header.numUpvalues = numUpvalues;
+		auto res = writeBytes(reinterpret_cast<const char*>(&header), sizeof(header));
+		if (!res.success()) {
+			return res;
+		}
+		if (!(res = writeBytes(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t))).success()) {
+			return res;
+		}
+
+		for (size_t i = 0; i < functions_.size(); i++) {
+			if (!(res = writeFunction(*functions_[i], layouts[i])).success()) {
+				return res;
+			}
+		}
+		return Util::BoolRes(true, "");
+	}
+
+private:
+	void collect(Function *f) {
+		indices_[f] = (uint32_t)functions_.size();
+		functions_.push_back(f);
+		for (const FunctionPtr &proto : f->protos()) {
+			collect(proto.get());
+		}
+	}
+
+	Util::BoolRes writeBytes(const char *data, size_t size) {
+		if (buffer_->writeBytes(data, size) != size) {
+			return Util::BoolRes(false, "write failed");
+		}
+		return Util::BoolRes(true, "");
+	}
+
+	// copies a string into the record at the next free place and returns its offset
+	uint32_t putString(const std::string &s, size_t &next) {
+		size_t at = next;
+		uint32_t size = (uint32_t)s.size();
+		std::memcpy(&record_[at], &size, sizeof(size));
+		std::memcpy(&record_[at + sizeof(size)], s.data(), s.size());
+		next += stringSize(s);
+		return (uint32_t)at;
+	}
+
+	template<typename T>
+	inline void put(size_t offset, const T &value) {
+		std::memcpy(&record_[offset], &value, sizeof(T));
+	}
+
+	Util::BoolRes writeFunction(Function &f, const Layout &l) {
+		const std::vector<Instruction> &code = f.code();
+		DecodedCode d(code);
+		record_.assign(l.size, '\0');
+		size_t next = l.strings;
+
+		BinaryExport::Prototype p;
+		std::memset(&p, 0, sizeof(p));
+		p.size = (uint32_t)l.size;
+		p.name = putString(f.label(), next);
+		p.source = f.source().empty() ? BinaryExport::NONE : putString(f.source(), next);
+		p.lineDefined = f.lineDefined();
+		p.lastLineDefined = f.lastLineDefined();
+		p.params = f.numParams();
+		p.vararg = f.isVarArg();
+		p.maxStackSize = f.maxStackSize();
+		p.code = (uint32_t)code.size();
+		p.constants = (uint32_t)f.constants().size();
+		p.upvalues = (uint32_t)f.upvalues().size();
+		p.protos = (uint32_t)f.protos().size();
+		p.lineinfo = (uint32_t)f.lineInfo().size();
+		p.locals = (uint32_t)f.locVars().size();
+		put(0, p);
+
+		for (size_t i = 0; i < f.constants().size(); i++) {
+			TValue &k = *f.constants()[i];
+			BinaryExport::Constant c;
+			std::memset(&c, 0, sizeof(c));
+			c.type = (uint8_t)k.type();
+			c.string = BinaryExport::NONE;
+			switch (k.type()) {
+				case LUA_TBOOLEAN:
+					c.integer = reinterpret_cast<TBool*>(&k)->value() ? 1 : 0;
+					break;
+				case LUA_TNUMFLT:
+					c.number = reinterpret_cast<TNumber*>(&k)->number();
+					break;
+				case LUA_TNUMINT:
+					c.integer = reinterpret_cast<TInteger*>(&k)->integer();
+					break;
+				case LUA_TSTRING:
+					c.string = putString(reinterpret_cast<TString*>(&k)->string(), next);
+					break;
+			}
+			put(l.constants + i * sizeof(BinaryExport::Constant), c);
+		}
+
+		if (!code.empty()) {
+			std::memcpy(&record_[l.code], code.data(), code.size() * sizeof(uint32_t));
+		}
+		for (size_t pc = 0; pc < d.size(); pc++) {
+			int op = d.opcode[pc];
+			if (op >= NUM_OPCODES) {
+				return invalidOpcode(op, pc);
+			}
+			BinaryExport::Operands o;
+			std::memset(&o, 0, sizeof(o));
+			o.op = (uint8_t)op;
+			o.mode = (uint8_t)getOpMode(op);
+			switch (getOpMode(op)) {
+				case iABC:
+					o.a = d.a[pc];
+					o.b = d.b[pc];
+					o.c = d.c[pc];
+					break;
+				case iABx:
+					o.a = d.a[pc];
+					o.x = d.bx[pc];
+					break;
+				case iAsBx:
+					o.a = d.a[pc];
+					o.x = d.sbx[pc];
+					break;
+				case iAx:
+					o.x = GETARG_Ax(code[pc]);
+					break;
+			}
+			put(l.operands + pc * sizeof(BinaryExport::Operands), o);
+		}
+
+		for (size_t i = 0; i < f.upvalues().size(); i++) {
+			const Upvalue &u = f.upvalues()[i];
+			BinaryExport::Upvalue out;
+			std::memset(&out, 0, sizeof(out));
+			out.instack = u.instack;
+			out.idx = u.idx;
+			out.name = u.name.empty() ? BinaryExport::NONE : putString(u.name, next);
+			put(l.upvalues + i * sizeof(BinaryExport::Upvalue), out);
+		}
+
+		for (size_t i = 0; i < f.protos().size(); i++) {
+			put(l.protos + i * sizeof(uint32_t), indices_[f.protos()[i].get()]);
+		}
+
+		for (size_t i = 0; i < f.lineInfo().size(); i++) {
+			put(l.lineinfo + i * sizeof(int32_t), (int32_t)f.lineInfo()[i]);
+		}
+
+		for (size_t i = 0; i < f.locVars().size(); i++) {
+			const LocVar &var = f.locVars()[i];
+			BinaryExport::Local local;
+			local.name = putString(var.varName, next);
+			local.startPc = var.startpc;
+			local.endPc = var.endpc;
+			put(l.locals + i * sizeof(BinaryExport::Local), local);
+		}
+
+		return writeBytes(record_.data(), record_.size());
+	}
+
+	WriteBufferPtr buffer_;
+	std::vector<Function*> functions_;
+	std::unordered_map<Function*, uint32_t> indices_;
+	std::string record_;
+};
+
+std::unique_ptr<Exporter> Exporter::create(const std::string &kind, const WriteBufferPtr &buffer) {
+	if (kind == "json") {
+		return std::unique_ptr<Exporter>(new JsonExporter(buffer));
+	}
+	if (kind == "binary") {
+		return std::unique_ptr<Exporter>(new BinaryExporter(buffer));
+	}
+	return nullptr;
+}
+
+bool Exporter::supported(const std::string &kind) {
+	return kind == "json" || kind == "binary";
+}
@@ -0,0 +1,87 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include "WriteBuffer.h"
+#include "Function.h"
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+// Writes the functions loaded by the Parser for tools that would otherwise parse the assembly
+// text. "json" streams one JSON document, "binary" writes the layout of BinaryExport, which is
+// meant to be mapped and read in place. Both carry every prototype with its constants, upvalues,
+// decoded instructions and debug information; the output goes out one function at a time.
+class Exporter {
+public:
+	virtual ~Exporter() {};
+
+	virtual Util::BoolRes write(const FunctionPtr &main, unsigned char numUpvalues) =0;
+
+	// nullptr if the kind is not "json" or "binary"
+	static std::unique_ptr<Exporter> create(const std::string &kind, const WriteBufferPtr &buffer);
+
+	static bool supported(const std::string &kind);
+};
+
+// The binary export, in the byte order of the machine that wrote it. Every structure sits at an
+// offset that is a multiple of its alignment, so a mapped file can be read through these types.
+namespace BinaryExport {
+	const char MAGIC[8] = {'L', 'U', 'A', 'D', 'I', 'S', 'B', '\0'};
+	const uint32_t VERSION = 1;
+	const uint32_t ORDER_MARK = 0x01020304; // reads back differently with the other byte order
+	const uint32_t NONE = 0xFFFFFFFF; // no string
+
+	// at offset 0, followed by the file offset (uint64_t) of every function, then the functions
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		uint32_t functions; // in preorder, the main function first
+		uint32_t numUpvalues; // of the chunk
+	};
+
+	// A function is this record followed by its arrays, each right after the one before:
+	// Constant[constants], uint32_t code[code], Operands[code], Upvalue[upvalues],
+	// uint32_t protos[protos] (function indices), int32_t lineinfo[lineinfo], Local[locals],
+	// and last the strings, each a uint32_t length, the bytes and a 0, padded to 4 bytes.
+	// Strings are referred to by their offset from the start of the record.
+	struct Prototype {
+		uint32_t size; // with the arrays and strings, a multiple of 8
+		uint32_t name, source;
+		int32_t lineDefined, lastLineDefined;
+		uint8_t params, vararg, maxStackSize, reserved;
+		uint32_t code, constants, upvalues, protos, lineinfo, locals; // counts
+	};
+
+	struct Constant {
+		uint8_t type; // LUA_TNIL, LUA_TBOOLEAN, LUA_TNUMFLT, LUA_TNUMINT or LUA_TSTRING
+		uint8_t reserved[3];
+		uint32_t string;
+		union {
+			int64_t integer; // booleans are 0 or 1
+			double number;
+		};
+	};
+
+	// the fields of an instruction by its mode, RK operands with BITRK set for constants
+	struct Operands {
+		uint8_t op, a;
+		uint16_t b, c;
+		uint8_t mode; // OpMode
+		uint8_t reserved;
+		int32_t x; // Bx, sBx or Ax
+	};
+
+	struct Upvalue {
+		uint8_t instack, idx;
+		uint8_t reserved[2];
+		uint32_t name;
+	};
+
+	struct Local {
+		uint32_t name;
+		int32_t startPc, endPc;
+	};
+}
+
+#endif
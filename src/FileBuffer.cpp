@@ -0,0 +1,32 @@
+#include "FileBuffer.h"
+
+FileBuffer::FileBuffer(const std::string &path) : file_(path, std::ifstream::binary), size_(0), pos_(0) {
+	if (file_.is_open()) {
+		file_.seekg(0, std::ifstream::end);
+		size_ = (size_t)file_.tellg();
+		file_.seekg(0, std::ifstream::beg);
+	}
+}
+
+size_t FileBuffer::readBytes(char *buffer, size_t amount) {
+	file_.read(buffer, amount);
+	size_t n = (size_t)file_.gcount();
+	pos_ += n;
+	return n;
+}
+
+size_t FileBuffer::remaining() const {
+	return size_ - pos_;
+}
+
+Util::BoolRes FileBuffer::readLine(std::string &buffer) {
+	if (pos_ == size_ || !std::getline(file_, buffer)) {
+		return Util::BoolRes(false, "end of stream");
+	}
+	pos_ = file_.eof() ? size_ : pos_ + buffer.size() + 1;
+
+	if (!buffer.empty() && buffer.back() == '\r') {
+		buffer.pop_back();
+	}
+	return Util::BoolRes(true, "");
+}
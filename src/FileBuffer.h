@@ -0,0 +1,27 @@
+#ifndef FILEBUFFER_H
+#define FILEBUFFER_H
+
+#include "Buffer.h"
+#include "util.h"
+
+#include <fstream>
+
+// Reads a file as it goes instead of loading it whole
+class FileBuffer : public Buffer {
+public:
+	FileBuffer(const std::string &path);
+
+	inline bool isOpen() const {
+		return file_.is_open();
+	}
+
+	size_t readBytes(char *buffer, size_t amount) override;
+	Util::BoolRes readLine(std::string &buffer) override;
+	size_t remaining() const override;
+
+private:
+	std::ifstream file_;
+	size_t size_, pos_;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#include "FileWriteBuffer.h"
+
+FileWriteBuffer::FileWriteBuffer(const std::string &path) : file_(path, std::ofstream::binary), written_(0) {
+
+}
+
+size_t FileWriteBuffer::writeBytes(const char *buffer, size_t amount) {
+	if (!file_.write(buffer, amount)) {
+		return 0;
+	}
+	written_ += amount;
+	return amount;
+}
@@ -0,0 +1,29 @@
+#ifndef FILEWRITEBUFFER_H
+#define FILEWRITEBUFFER_H
+
+#include "WriteBuffer.h"
+
+#include <fstream>
+#include <string>
+
+// Writes straight to a file
+class FileWriteBuffer : public WriteBuffer {
+public:
+	FileWriteBuffer(const std::string &path);
+
+	inline bool isOpen() const {
+		return file_.is_open();
+	}
+
+	size_t writeBytes(const char *buffer, size_t amount) override;
+
+	inline size_t written() const {
+		return written_;
+	}
+
+private:
+	std::ofstream file_;
+	size_t written_;
+};
+
+#endif
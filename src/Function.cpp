@@ -2,15 +2,22 @@
 #include "InstructionParser.h"
 #include "Parser.h"
 #include "util.h"
+#include "Stats.h"
+#include "AllocStats.h"
+#include "DecodedCode.h"
+#include "Verifier.h"
+
+#define MAXDEPTH 200 // prototype nesting; the reference compiler stops at the same C call limit
 
 Util::BoolRes Function::loadString(std::string &out) {
-	size_t size = 0;
-	auto res = buffer_->read((unsigned char&)size);
+	unsigned char small;
+	auto res = buffer_->read(small);
 	if (!res.success()) {
 		return res;
 	}
+	size_t size = small;
 	if (size == 0xFF) {
-		res = buffer_->read(size);
+		res = parser_->reader().readSize(size);
 		if (!res.success()) {
 			return res;
 		}
@@ -19,74 +26,108 @@ Util::BoolRes Function::loadString(std::string &out) {
 	if (size == 0) {
 		return Util::BoolRes(true, "");
 	}
+	if (size - 1 > buffer_->remaining()) {
+		return Util::BoolRes(false, "string of " + std::to_string(size - 1) + " bytes exceeds the rest of the chunk");
+	}
 
 	buffer_->read(out, size - 1);
 	return Util::BoolRes(true, "");
 }
 
+// reads the size of an array and checks that the rest of the chunk can hold that many elements of
+// at least minSize bytes, so a corrupted size fails here instead of allocating for it
+Util::BoolRes Function::loadCount(int &n, size_t minSize, const char *what) {
+	auto res = parser_->reader().readInt(n);
+	if (!res.success()) {
+		return res;
+	}
+	if (n < 0 || (size_t)n > buffer_->remaining() / minSize) {
+		return Util::BoolRes(false, std::string(what) + " count " + std::to_string(n) + " exceeds the rest of the chunk");
+	}
+	return Util::BoolRes(true, "");
+}
+
 Util::BoolRes Function::loadCode() {
+	Stats *stats = parser_->stats();
+	Stats::Scope scope(stats, Stats::CODE);
+	ChunkReader &reader = parser_->reader();
 	int n;
-	auto res = buffer_->read(n);
+	auto res = loadCount(n, sizeof(Instruction), "instruction");
 	if (!res.success()) {
 		return res;
 	}
 
-	code_.resize(n);
-
-	if (buffer_->read((char*)code_.data(), n * sizeof(Instruction)) != n * sizeof(Instruction)) {
-		return Util::BoolRes(false, "failed to read code");
+	if (!(res = reader.readInstructions(code_, n)).success()) {
+		return res;
+	}
+	if (stats) {
+		stats->count(Stats::INSTRUCTIONS, n);
 	}
 	return Util::BoolRes(true, "");
 }
 
 Util::BoolRes Function::loadProtos() {
+	Stats::Scope scope(parser_->stats(), Stats::PROTOS);
 	int n;
-	auto res = buffer_->read(n);
+	auto res = loadCount(n, 1, "prototype");
 	if (!res.success()) {
 		return res;
 	}
+	if (n > 0 && depth_ == MAXDEPTH) {
+		return Util::BoolRes(false, "prototypes nested deeper than " + std::to_string(MAXDEPTH) + " levels");
+	}
 
 	for (int i = 0; i < n; i++) {
-		FunctionPtr function = FunctionPtr(new Function(parser_, buffer_));
+		FunctionPtr function = FunctionPtr(new Function(parser_, buffer_, depth_ + 1));
 		if (!(res = function->loadFunction()).success()) {
 			return res;
 		}
 		protos_.push_back(function);
 	}
-    throw std::exception();
+	return Util::BoolRes(true, "");
 }
 
 Util::BoolRes Function::loadDebug() {
+	Stats::Scope scope(parser_->stats(), Stats::DEBUG);
+	StripLevel strip = parser_->strip();
+	ChunkReader &reader = parser_->reader();
 	int n;
-	auto res = buffer_->read(n); // lineinfo
+	auto res = loadCount(n, sizeof(int), "lineinfo");
 	if (!res.success()) {
 		return res;
 	}
 
-	lineInfo_.resize(n);
-	if (buffer_->read((char*)lineInfo_.data(), n * sizeof(int)) != n * sizeof(int)) {
-		return Util::BoolRes(false, "failed to read lineinfo (eof?)");
+	if (strip == STRIP_ALL) {
+		res = reader.skipInts(n);
+	} else {
+		res = reader.readInts(lineInfo_, n);
+	}
+	if (!res.success()) {
+		return res;
 	}
 
-	if (!(res = buffer_->read(n)).success()) { // locvars
+	if (!(res = loadCount(n, 1 + 2 * sizeof(int), "local variable")).success()) { // name, startpc, endpc
 		return res;
 	}
 
-	locVars_.resize(n);
+	std::string name;
+	bool names = strip == STRIP_NONE;
+	locVars_.resize(names ? n : 0);
 
 	for (int i = 0; i < n; i++) {
-		if (!(res = loadString(locVars_[i].varName)).success()) {
+		LocVar var;
+		if (!(res = loadString(names ? locVars_[i].varName : name)).success()) {
 			return res;
 		}
-		if (!(res = buffer_->read(locVars_[i].startpc)).success()) {
+		if (!(res = reader.readInt(names ? locVars_[i].startpc : var.startpc)).success()) {
 			return res;
 		}
-		if (!(res = buffer_->read(locVars_[i].endpc)).success()) {
+		if (!(res = reader.readInt(names ? locVars_[i].endpc : var.endpc)).success()) {
 			return res;
 		}
 	}
 
-	if (!(res = buffer_->read(n)).success()) { // upvalue names
+	if (!(res = loadCount(n, 1, "upvalue name")).success()) {
 		return res;
 	}
 
@@ -95,7 +136,7 @@ Util::BoolRes Function::loadDebug() {
 	}
 
 	for (int i = 0; i < n; i++) {
-		if (!(res = loadString(upvalues_[i].name)).success()) {
+		if (!(res = loadString(names ? upvalues_[i].name : name)).success()) {
 			return res;
 		}
 	}
@@ -105,8 +146,9 @@ Util::BoolRes Function::loadDebug() {
 }
 
 Util::BoolRes Function::loadUpvalues() {
+	Stats::Scope scope(parser_->stats(), Stats::UPVALUES);
 	int n;
-	auto res = buffer_->read(n);
+	auto res = loadCount(n, 2, "upvalue"); // instack, idx
 	if (!res.success()) {
 		return res;
 	}
@@ -125,11 +167,18 @@ Util::BoolRes Function::loadUpvalues() {
 }
 
 Util::BoolRes Function::loadConstants() {
+	Stats *stats = parser_->stats();
+	Stats::Scope scope(stats, Stats::CONSTANTS);
+	ChunkReader &reader = parser_->reader();
+
 	int n;
-	auto res = buffer_->read(n);
+	auto res = loadCount(n, 1, "constant"); // the type byte
 	if (!res.success()) {
 		return res;
 	}
+	if (stats) {
+		stats->count(Stats::CONSTANTS_COUNT, n);
+	}
 
 	for (int i = 0; i < n; i++) {
 		unsigned char t;
@@ -149,17 +198,17 @@ Util::BoolRes Function::loadConstants() {
 			break;
 		case LUA_TNUMFLT:
 			lua_Number num;
-			if (!(res = buffer_->read(num)).success()) {
+			if (!(res = reader.readNumber(num)).success()) {
 				return res;
 			}
 			constants_.push_back(TValuePtr(new TNumber(num)));
 			break;
 		case LUA_TNUMINT:
 			lua_Integer in;
-			if (!(res = buffer_->read(in)).success()) {
+			if (!(res = reader.readInteger(in)).success()) {
 				return res;
 			}
-			constants_.push_back(TValuePtr(new TNumber(in)));
+			constants_.push_back(TValuePtr(new TInteger(in)));
 			break;
 		case LUA_TSHRSTR:
 		case LUA_TLNGSTR: {
@@ -167,6 +216,9 @@ Util::BoolRes Function::loadConstants() {
 			if (!(res = loadString(string)).success()) {
 				return res;
 			}
+			if (stats) {
+				stats->count(Stats::STRING_BYTES, string.size());
+			}
 			constants_.push_back(TValuePtr(new TString(std::move(string))));
 			break;
 		}
@@ -180,16 +232,24 @@ Util::BoolRes Function::loadConstants() {
 }
 
 Util::BoolRes Function::loadFunction() {
-	std::string source;
-	auto res = loadString(source);
+	AllocStats::Prototype prototype(label_);
+
+	Stats *stats = parser_->stats();
+	if (stats) {
+		stats->count(Stats::PROTOTYPES);
+	}
+
+	Stats::Scope scope(stats, Stats::HEADER);
+
+	auto res = loadString(source_);
 	if (!res.success()) {
 		return res;
 	}
 
-	if (!(res = buffer_->read(lineDefined_)).success()) {
+	if (!(res = parser_->reader().readInt(lineDefined_)).success()) {
 		return res;
 	}
-	if (!(res = buffer_->read(lastLineDefined_)).success()) {
+	if (!(res = parser_->reader().readInt(lastLineDefined_)).success()) {
 		return res;
 	}
 	if (!(res = buffer_->read(numParams_)).success()) {
@@ -218,14 +278,36 @@ Util::BoolRes Function::loadFunction() {
 		return res;
 	}
 
-	InstructionParser parser(this, std::move(code_));
-	if (!(res = parser.parse()).success()) {
+	// the decoded fields are only read by the verifier and the formatter
+	if (!parser_->verify() && !parser_->text()) {
+		return Util::BoolRes(true, "");
+	}
+
+	DecodedCode decoded(code_);
+	if (parser_->verify()) {
+		Stats::Scope verify(stats, Stats::VERIFY);
+		Verifier verifier(this, decoded);
+		if (!(res = verifier.verify()).success()) {
+			return res;
+		}
+	}
+	if (!parser_->text()) {
+		return Util::BoolRes(true, "");
+	}
+
+	Stats::Scope format(stats, Stats::FORMAT);
+
+	InstructionParser parser(this, code_);
+	if (!(res = parser.parse(decoded)).success()) {
 		return res;
 	}
+	if (stats) {
+		stats->count(Stats::LABELS, parser.labels());
+	}
 
 	disas_ << ".func " << label_ << " " << (int)maxStackSize_ << " " << (int)numParams_ << " " << (int)isVarArg_;
-	if (!source.empty()) {
-		disas_ << " ; source: " << source;
+	if (!source_.empty()) {
+		disas_ << " ; source: " << source_;
 	}
 
 	disas_ << " ; maxstacksize: " << (int)maxStackSize_ << ", params: " << (int)numParams_ << ", vararg: " << (int)isVarArg_ << " (" << (isVarArg_ == 0 ? "does not use varag" : (isVarArg_ == 1 ? "uses vararg" : "declared vararg")) << ")\n";
@@ -253,6 +335,6 @@ Util::BoolRes Function::loadFunction() {
 	return Util::BoolRes(true, "");
 }
 
-Function::Function(Parser *parser, const BufferPtr &buffer) : parser_(parser), buffer_(buffer) {
+Function::Function(Parser *parser, const BufferPtr &buffer, unsigned int depth) : buffer_(buffer), parser_(parser), depth_(depth) {
 	label_ = parser_->label();
 }
\ No newline at end of file
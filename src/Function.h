@@ -18,6 +18,13 @@ struct LocVar {
 	int startpc, endpc;
 };
 
+// How much debug information is written (or kept when loading)
+enum StripLevel {
+	STRIP_NONE, // everything
+	STRIP_KEEP_LINES, // source, line defined and lineinfo, without local and upvalue names
+	STRIP_ALL // no debug information, like luac -s
+};
+
 class Function;
 typedef std::shared_ptr<Function> FunctionPtr;
 
@@ -25,7 +32,8 @@ class Parser;
 
 class Function {
 public:
-	Function(Parser *parser, const BufferPtr &buffer);
+	// depth is the nesting level of the prototype, 0 for the main function
+	Function(Parser *parser, const BufferPtr &buffer, unsigned int depth = 0);
 
 	Util::BoolRes loadFunction();
 
@@ -57,8 +65,57 @@ public:
 		}
 		return FunctionPtr(nullptr);
 	}
+
+	inline const std::vector<Instruction> &code() {
+		return code_;
+	}
+
+	inline const std::vector<TValuePtr> &constants() {
+		return constants_;
+	}
+
+	inline const std::vector<Upvalue> &upvalues() {
+		return upvalues_;
+	}
+
+	inline const std::vector<FunctionPtr> &protos() {
+		return protos_;
+	}
+
+	inline unsigned char maxStackSize() {
+		return maxStackSize_;
+	}
+
+	inline unsigned char numParams() {
+		return numParams_;
+	}
+
+	inline unsigned char isVarArg() {
+		return isVarArg_;
+	}
+
+	inline const std::string &source() {
+		return source_;
+	}
+
+	inline int lineDefined() {
+		return lineDefined_;
+	}
+
+	inline int lastLineDefined() {
+		return lastLineDefined_;
+	}
+
+	inline const std::vector<int> &lineInfo() {
+		return lineInfo_;
+	}
+
+	inline const std::vector<LocVar> &locVars() {
+		return locVars_;
+	}
 private:
 	Util::BoolRes loadString(std::string &out);
+	Util::BoolRes loadCount(int &n, size_t minSize, const char *what);
 	Util::BoolRes loadCode();
 	Util::BoolRes loadConstants();
 	Util::BoolRes loadUpvalues();
@@ -69,7 +126,9 @@ private:
 	std::vector<Instruction> code_;
 
 	std::string label_;
+	std::string source_;
 	Parser *parser_;
+	unsigned int depth_;
 
 	int lineDefined_, lastLineDefined_;
 	// unsigned char numUpvalues_;
@@ -0,0 +1,111 @@
+#include "StringBuffer.h"
+#include "StringWriteBuffer.h"
+#include "Parser.h"
+#include "Assembler.h"
+#include "Exporter.h"
+
+#include <stdint.h>
+#include <string>
+
+// Fuzzing entry point for the chunk parser and the assembler (cmake -DLUADISASS_FUZZ=ON). The
+// first byte of an input picks the target, the rest is the chunk or the assembly: bit 0 for the
+// assembler, bit 1 for the exports of the parsed chunk instead of the assembly text. Built with
+// clang this links against libFuzzer, which reports executions per second and the peak RSS itself
+// and fails inputs beyond -rss_limit_mb / -malloc_limit_mb. Other compilers (afl-g++ included)
+// get the driver below instead.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size == 0) {
+		return 0;
+	}
+	std::string input(reinterpret_cast<const char*>(data) + 1, size - 1);
+
+	if (data[0] & 1) {
+		std::string chunk;
+		Assembler assembler(new StringBuffer(std::move(input)), WriteBufferPtr(new StringWriteBuffer(chunk)));
+		if (assembler.assemble().success()) {
+			// the output goes through the parser as well, it is the chunk most likely to get far
+			Parser parser(new StringBuffer(std::move(chunk)));
+			std::string out;
+			parser.parse(out);
+		}
+	} else if (data[0] & 2) {
+		Parser parser(new StringBuffer(std::move(input)));
+		parser.setText(false);
+		std::string out;
+		if (parser.parse(out).success()) {
+			for (const char *kind : {"json", "binary"}) {
+				out.clear();
+				Exporter::create(kind, WriteBufferPtr(new StringWriteBuffer(out)))->write(parser.mainFunction(), parser.numUpvalues());
+			}
+		}
+	} else {
+		Parser parser(new StringBuffer(std::move(input)));
+		std::string out;
+		parser.parse(out);
+	}
+	return 0;
+}
+
+#ifdef LUADISASS_FUZZ_DRIVER
+#include "util.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <sys/resource.h>
+
+// peak resident set size of the process in KiB
+static long peakRSS() {
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return usage.ru_maxrss / 1024; // bytes there
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+// Runs every file given, or stdin when there are none (one input per process, as AFL runs it),
+// then prints the executions per second and the peak RSS. An input that takes the RSS beyond
+// --rss-limit (MiB) aborts, so that the fuzzer records it.
+int main(int argc, char *argv[]) {
+	long limit = 2048;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++) {
+		if (std::string("--rss-limit") == argv[i] && i + 1 < argc) {
+			limit = std::atol(argv[++i]);
+		} else {
+			files.push_back(argv[i]);
+		}
+	}
+
+	std::vector<std::string> inputs;
+	if (files.empty()) {
+		inputs.push_back(std::string(std::istreambuf_iterator<char>(std::cin), std::istreambuf_iterator<char>()));
+	}
+	for (auto &file : files) {
+		std::string input;
+		if (!Util::readFile(file, input)) {
+			std::cerr << "could not open file " << file << std::endl;
+			return 1;
+		}
+		inputs.push_back(std::move(input));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < inputs.size(); i++) {
+		LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(inputs[i].data()), inputs[i].size());
+		if (peakRSS() > limit * 1024) {
+			std::cerr << (files.empty() ? std::string("stdin") : files[i]) << ": peak RSS " << peakRSS() / 1024 << " MiB exceeds the limit of " << limit << " MiB" << std::endl;
+			std::abort();
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cerr << inputs.size() << " inputs, " << (seconds > 0 ? inputs.size() / seconds : 0) << " exec/s, peak RSS " << peakRSS() / 1024 << " MiB" << std::endl;
+	return 0;
+}
+#endif
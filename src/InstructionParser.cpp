@@ -1,6 +1,7 @@
 ﻿#include "InstructionParser.h"
 #include "opcodes.h"
 #include "Function.h"
+#include "DecodedCode.h"
 
 #include <iostream>
 #include <algorithm>
@@ -8,30 +9,48 @@
 //#define IHINTS // show instruction hints as a comment
 
 
-InstructionParser::InstructionParser(Function *function, const std::vector<Instruction> &code) : function_(function), code_(code) {
+InstructionParser::InstructionParser(Function *function, const std::vector<Instruction> &code) : code_(code), function_(function), labels_(0) {
 
 }
 
-InstructionParser::InstructionParser(Function *function, std::vector<Instruction> &&code) : function_(function), code_(std::move(code)) {
+InstructionParser::InstructionParser(Function *function, std::vector<Instruction> &&code) : code_(std::move(code)), function_(function), labels_(0) {
 
 }
 
+// unverified code can reference constants that do not exist
+std::string InstructionParser::constant(int index) {
+	TValuePtr k = function_->constant(index);
+	if (!k) {
+		return std::to_string(index) + " (invalid)";
+	}
+	return k->str();
+}
+
 Util::BoolRes InstructionParser::parse() {
+	return parse(DecodedCode(code_));
+}
+
+Util::BoolRes InstructionParser::parse(const DecodedCode &d) {
 	std::stringstream opout;
 
 	std::vector<std::string> lines;
+	std::vector<int> pcs; // pc of each line, extraarg does not get a line of its own
 	std::vector<int> locations;
 
-	for (auto it = code_.begin(); it != code_.end(); it++) {
+	for (size_t pc = 0; pc < d.size(); pc++) {
+		if (d.opcode[pc] >= NUM_OPCODES) {
+			return Util::BoolRes(false, "invalid opcode " + std::to_string(d.opcode[pc]) + " at pc " + std::to_string(pc));
+		}
+		pcs.push_back(pc);
 		opout.str("");
-		opout << luaP_opnames[GET_OPCODE(*it)];
+		opout << luaP_opnames[d.opcode[pc]];
 
-		short a = GETARG_A(*it);
+		short a = d.a[pc];
 
-		switch (GET_OPCODE(*it)) {
+		switch (d.opcode[pc]) {
 			case OP_MOVE:
 				opout << " %" << a;
-				opout << " %" << GETARG_B(*it);
+				opout << " %" << d.b[pc];
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, src";
@@ -39,7 +58,7 @@ Util::BoolRes InstructionParser::parse() {
 				break;
 			case OP_LOADK:
 				opout << " %" << a;
-				opout << " const " << function_->constant(INDEXK(GETARG_Bx(*it)))->str();
+				opout << " const " << constant(d.bx[pc]);
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, const";
@@ -47,10 +66,10 @@ Util::BoolRes InstructionParser::parse() {
 				break;
 			case OP_LOADKX:
 				opout << " %" << a;
-				if (GET_OPCODE(*it++) != OP_EXTRAARG) {
+				if (++pc == d.size() || d.opcode[pc] != OP_EXTRAARG) {
 					return Util::BoolRes(false, "OP_LOADKK needs to be proceded by an OP_EXTRAARG");
 				}
-				opout << " const " << function_->constant(INDEXK(GETARG_Ax(*it)))->str();
+				opout << " const " << constant(GETARG_Ax(code_[pc]));
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; (load extended: uses OP_EXTRAARG) dst, const";
@@ -58,9 +77,9 @@ Util::BoolRes InstructionParser::parse() {
 				break;
 			case OP_LOADBOOL: {
 				opout << " %" << a;
-				int b = GETARG_B(*it);
+				int b = d.b[pc];
 				opout << " " << (b == 0 ? "false" : "true");
-				opout << " " << GETARG_C(*it);
+				opout << " " << d.c[pc];
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, src, skip (if skip != 0, skip next instruction)";
@@ -69,7 +88,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_LOADNIL:
 				opout << " %" << a;
-				opout << " " << GETARG_B(*it);
+				opout << " " << d.b[pc];
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, amount (amount = amount of bytes to set i.e. dst...dst+amount";
@@ -77,8 +96,8 @@ Util::BoolRes InstructionParser::parse() {
 				break;
 			case OP_GETUPVAL: {
 				opout << " %" << a;
-				opout << " @" << GETARG_B(*it);
-				Upvalue *upval = function_->upvalue(GETARG_B(*it));
+				opout << " @" << d.b[pc];
+				Upvalue *upval = function_->upvalue(d.b[pc]);
 				if (upval != nullptr) {
 					opout << " ; debug name: " << upval->name;
 				}
@@ -86,16 +105,17 @@ Util::BoolRes InstructionParser::parse() {
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, upidx";
 				#endif
+				break;
 			}
 			case OP_GETTABUP: {
 				opout << " %" << a;
-				opout << " @" << GETARG_B(*it);
-				if (ISK(GETARG_C(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_C(*it)))->str();
+				opout << " @" << d.b[pc];
+				if (ISK(d.c[pc])) {
+					opout << " const " << constant(INDEXK(d.c[pc]));
 				} else {
-					opout << " %" << GETARG_C(*it);
+					opout << " %" << d.c[pc];
 				}
-				Upvalue *upval = function_->upvalue(GETARG_B(*it));
+				Upvalue *upval = function_->upvalue(d.b[pc]);
 				if (upval != nullptr) {
 					opout << " ; debug name: " << upval->name;
 				}
@@ -107,11 +127,11 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_GETTABLE: {
 				opout << " %" << a;
-				opout << " %" << GETARG_B(*it);
-				if (ISK(GETARG_C(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_C(*it)))->str();
+				opout << " %" << d.b[pc];
+				if (ISK(d.c[pc])) {
+					opout << " const " << constant(INDEXK(d.c[pc]));
 				} else {
-					opout << " %" << GETARG_C(*it);
+					opout << " %" << d.c[pc];
 				}
 
 				#ifdef IHINTS
@@ -121,20 +141,20 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_SETTABUP: {
 				opout << " @" << a;
-				if (ISK(GETARG_B(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_B(*it)))->str();
+				if (ISK(d.b[pc])) {
+					opout << " const " << constant(INDEXK(d.b[pc]));
 				} else {
-					opout << " %" << GETARG_B(*it);
+					opout << " %" << d.b[pc];
 				}
 
-				if (ISK(GETARG_C(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_C(*it)))->str();
+				if (ISK(d.c[pc])) {
+					opout << " const " << constant(INDEXK(d.c[pc]));
 				} else {
-					opout << " %" << GETARG_C(*it);
+					opout << " %" << d.c[pc];
 				}
 
 
-				Upvalue *upval = function_->upvalue(GETARG_A(*it));
+				Upvalue *upval = function_->upvalue(d.a[pc]);
 				if (upval != nullptr) {
 					opout << " ; debug name: " << upval->name;
 				}
@@ -145,10 +165,10 @@ Util::BoolRes InstructionParser::parse() {
 				break;
 			}
 			case OP_SETUPVAL: {
-				opout << " @" << GETARG_B(*it);
+				opout << " @" << d.b[pc];
 				opout << " %" << a;
 
-				Upvalue *upval = function_->upvalue(GETARG_B(*it));
+				Upvalue *upval = function_->upvalue(d.b[pc]);
 				if (upval != nullptr) {
 					opout << " ; debug name: " << upval->name;
 				}
@@ -161,16 +181,16 @@ Util::BoolRes InstructionParser::parse() {
 			case OP_SETTABLE: {
 				opout << " %" << a;
 
-				if (ISK(GETARG_B(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_B(*it)))->str();
+				if (ISK(d.b[pc])) {
+					opout << " const " << constant(INDEXK(d.b[pc]));
 				} else {
-					opout << " %" << GETARG_B(*it);
+					opout << " %" << d.b[pc];
 				}
 
-				if (ISK(GETARG_C(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_C(*it)))->str();
+				if (ISK(d.c[pc])) {
+					opout << " const " << constant(INDEXK(d.c[pc]));
 				} else {
-					opout << " %" << GETARG_C(*it);
+					opout << " %" << d.c[pc];
 				}
 
 				#ifdef IHINTS
@@ -180,8 +200,8 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_NEWTABLE: {
 				opout << " %" << a;
-				opout << " " << GETARG_B(*it);
-				opout << " " << GETARG_C(*it);
+				opout << " " << d.b[pc];
+				opout << " " << d.c[pc];
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, narr, nrec (narr is a hint for how many elements the table will have as a sequence; nrec is a hint for how many other elements the table will have)";
@@ -190,12 +210,12 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_SELF: {
 				opout << " %" << a;
-				opout << " %" << GETARG_B(*it);
+				opout << " %" << d.b[pc];
 
-				if (ISK(GETARG_C(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_C(*it)))->str();
+				if (ISK(d.c[pc])) {
+					opout << " const " << constant(INDEXK(d.c[pc]));
 				} else {
-					opout << " %" << GETARG_C(*it);
+					opout << " %" << d.c[pc];
 				}
 
 				#ifdef IHINTS
@@ -413,16 +433,16 @@ Util::BoolRes InstructionParser::parse() {
 			case OP_POW: {
 				opout << " %" << a;
 
-				if (ISK(GETARG_B(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_B(*it)))->str();
+				if (ISK(d.b[pc])) {
+					opout << " const " << constant(INDEXK(d.b[pc]));
 				} else {
-					opout << " %" << GETARG_B(*it);
+					opout << " %" << d.b[pc];
 				}
 
-				if (ISK(GETARG_C(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_C(*it)))->str();
+				if (ISK(d.c[pc])) {
+					opout << " const " << constant(INDEXK(d.c[pc]));
 				} else {
-					opout << " %" << GETARG_C(*it);
+					opout << " %" << d.c[pc];
 				}
 
 				#ifdef IHINTS
@@ -432,7 +452,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_UNM: {
 				opout << " %" << a;
-				opout << " %" << GETARG_B(*it);
+				opout << " %" << d.b[pc];
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, a (a can be a stack index, dst = -a)";
@@ -441,7 +461,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_BNOT: {
 				opout << " %" << a;
-				opout << " %" << GETARG_B(*it);
+				opout << " %" << d.b[pc];
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, src";
@@ -450,7 +470,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_NOT: {
 				opout << " %" << a;
-				opout << " %" << GETARG_B(*it);
+				opout << " %" << d.b[pc];
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, src (dst = not src)";
@@ -459,7 +479,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_LEN: {
 				opout << " %" << a;
-				opout << " %" << GETARG_B(*it);
+				opout << " %" << d.b[pc];
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, src";
@@ -468,8 +488,8 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_CONCAT: {
 				opout << " %" << a;
-				opout << " %" << GETARG_B(*it);
-				opout << " %" << GETARG_C(*it);
+				opout << " %" << d.b[pc];
+				opout << " %" << d.c[pc];
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; dst, a, b (concat values from %a..%b and store result is dst)";
@@ -478,7 +498,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_JMP: {
 				opout << " " << a;
-				int loc = (it - code_.begin()) + GETARG_sBx(*it) + 1;
+				int loc = (int)pc + d.sbx[pc] + 1;
 				opout << " $location_" << loc;
 
 				locations.push_back(loc);
@@ -493,16 +513,16 @@ Util::BoolRes InstructionParser::parse() {
 			case OP_EQ: {
 				opout << " " << (a == 0 ? "false" : "true");
 
-				if (ISK(GETARG_B(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_B(*it)))->str();
+				if (ISK(d.b[pc])) {
+					opout << " const " << constant(INDEXK(d.b[pc]));
 				} else {
-					opout << " %" << GETARG_B(*it);
+					opout << " %" << d.b[pc];
 				}
 
-				if (ISK(GETARG_C(*it))) {
-					opout << " const " << function_->constant(INDEXK(GETARG_C(*it)))->str();
+				if (ISK(d.c[pc])) {
+					opout << " const " << constant(INDEXK(d.c[pc]));
 				} else {
-					opout << " %" << GETARG_C(*it);
+					opout << " %" << d.c[pc];
 				}
 
 				#ifdef IHINTS
@@ -544,7 +564,7 @@ Util::BoolRes InstructionParser::parse() {
 			}*/
 			case OP_TEST: {
 				opout << " %" << a;
-				opout << " " << (GETARG_C(*it) == 0 ? "false" : "true");
+				opout << " " << (d.c[pc] == 0 ? "false" : "true");
 
 				#ifdef IHINTS
 				opout << "\t\t\t ; a, invert (skips next instruction if a is not false. If invert then skips if a is false)";
@@ -553,8 +573,8 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_TESTSET: {
 				opout << " %" << a;
-				opout << " %" << GETARG_B(*it);
-				opout << " " << (GETARG_C(*it) == 0 ? "false" : "true");
+				opout << " %" << d.b[pc];
+				opout << " " << (d.c[pc] == 0 ? "false" : "true");
 				#ifdef IHINTS
 				opout << "\t\t\t ; a, b, invert (skips next instruction if a is not false. If invert then skips if a is false. sets a to b when not skipping)";
 				#endif
@@ -562,8 +582,8 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_CALL: {
 				opout << " %" << a;
-				opout << " " << GETARG_B(*it);
-				opout << " " << GETARG_C(*it);
+				opout << " " << d.b[pc];
+				opout << " " << d.c[pc];
 				#ifdef IHINTS
 				opout  << "\t\t\t ; func, nargs+1, nresults+1";
 				#endif
@@ -571,8 +591,8 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_TAILCALL: {
 				opout << " %" << a;
-				opout << " " << GETARG_B(*it);
-				opout << " " << GETARG_C(*it);
+				opout << " " << d.b[pc];
+				opout << " " << d.c[pc];
 
 				#ifdef IHINTS
 				opout  << "\t\t\t ; func, nargs, nresults+1(0) (nresults MUST be LUA_MULTRET (-1))";
@@ -581,7 +601,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_RETURN: {
 				opout << " %" << a;
-				opout << " " << GETARG_B(*it);
+				opout << " " << d.b[pc];
 
 				#ifdef IHINTS
 				opout  << "\t\t\t ; firstRes, nres+1";
@@ -590,7 +610,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_FORLOOP: {
 				opout << " %" << a;
-				int loc = (it - code_.begin()) + GETARG_sBx(*it) + 1;
+				int loc = (int)pc + d.sbx[pc] + 1;
 				opout << " $location_" << loc;
 
 				locations.push_back(loc);
@@ -602,7 +622,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_FORPREP: {
 				opout << " %" << a;
-				int loc = (it - code_.begin()) + GETARG_sBx(*it) + 1;
+				int loc = (int)pc + d.sbx[pc] + 1;
 				opout << " $location_" << loc;
 
 				locations.push_back(loc);
@@ -614,7 +634,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_TFORCALL: {
 				opout << " %" << a;
-				opout << " " << GETARG_C(*it);
+				opout << " " << d.c[pc];
 
 				#ifdef IHINTS
 				opout  << "\t\t\t ; func, nresults (OP_TFORLOOP must be the next instruction)";
@@ -623,7 +643,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_TFORLOOP: {
 				opout << " %" << a;
-				int loc = (it - code_.begin()) + GETARG_sBx(*it) + 1;
+				int loc = (int)pc + d.sbx[pc] + 1;
 				opout << " $location_" << loc;
 
 				locations.push_back(loc);
@@ -635,15 +655,15 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_SETLIST: {
 				opout << " %" << a;
-				opout << " " << GETARG_B(*it);
+				opout << " " << d.b[pc];
 
-				if (GETARG_C(*it) == 0) {
-					if (GET_OPCODE(*it++) != OP_EXTRAARG) {
+				if (d.c[pc] == 0) {
+					if (++pc == d.size() || d.opcode[pc] != OP_EXTRAARG) {
 						return Util::BoolRes(false, "OP_SETLIST C=0 needs to be proceded by an OP_EXTRAARG");
 					}
-					opout << " " << GETARG_Ax(*it);
+					opout << " " << GETARG_Ax(code_[pc]);
 				} else {
-					opout << " " << GETARG_C(*it);
+					opout << " " << d.c[pc];
 				}
 
 				#ifdef IHINTS
@@ -653,7 +673,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_CLOSURE: {
 				opout << " %" << a;
-				int index = GETARG_Bx(*it);
+				int index = d.bx[pc];
 
 				FunctionPtr f = function_->proto(index);
 				if (f) {
@@ -669,7 +689,7 @@ Util::BoolRes InstructionParser::parse() {
 			}
 			case OP_VARARG: {
 				opout << " %" << a;
-				opout << " " << GETARG_B(*it);
+				opout << " " << d.b[pc];
 
 				#ifdef IHINTS
 				opout  << "\t\t\t ; base, rres+1";
@@ -688,8 +708,9 @@ Util::BoolRes InstructionParser::parse() {
 	for (int i = 0; i < lines.size(); i++) {
 		if (!locations.empty()) {
 			std::vector<int>::iterator newEnd;
-			if (locations.end() != (newEnd = std::remove(locations.begin(), locations.end(), i))) {
-				decomp_ << "location_" << i << ":\n";
+			if (locations.end() != (newEnd = std::remove(locations.begin(), locations.end(), pcs[i]))) {
+				decomp_ << "location_" << pcs[i] << ":\n";
+				labels_++;
 				locations.erase(newEnd, locations.end());
 			}
 		}
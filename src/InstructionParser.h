@@ -8,6 +8,7 @@
 #include <sstream>
 
 class Function;
+class DecodedCode;
 
 class InstructionParser {
 public:
@@ -15,13 +16,22 @@ public:
 	InstructionParser(Function *function, std::vector<Instruction> &&code);
 
 	Util::BoolRes parse();
+	// with the code already decoded
+	Util::BoolRes parse(const DecodedCode &d);
 
 	inline std::string disas() {
 		return decomp_.str();
 	}
+
+	inline size_t labels() {
+		return labels_;
+	}
 private:
+	std::string constant(int index);
+
 	std::vector<Instruction> code_;
 	Function *function_;
+	size_t labels_;
 
 	std::stringstream decomp_;
 };
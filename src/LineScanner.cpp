@@ -0,0 +1,219 @@
+#include "LineScanner.h"
+#include "CharClass.h"
+#include "Simd.h"
+
+#include <algorithm>
+
+#define WINDOW 0x10000 // bytes indexed at once, doubled for a line that does not fit
+#define BLOCK 0x100000 // bytes read at once from buffers that cannot be viewed in place
+
+// sets the bits of the bytes from..n, the words they are in are zero
+static void indexScalar(const char *data, size_t from, size_t n, uint64_t *newlines, uint64_t *semicolons) {
+	for (size_t i = from; i < n; i++) {
+		if (data[i] == '\n') {
+			newlines[i >> 6] |= 1ULL << (i & 63);
+		} else if (data[i] == ';') {
+			semicolons[i >> 6] |= 1ULL << (i & 63);
+		}
+	}
+}
+
+#ifdef SIMD_X86
+static const bool useAVX2 = Simd::avx2();
+static const bool useSSE2 = Simd::sse2();
+
+// one word of each bitmap per round, from four 16 byte compares
+SSE2_TARGET static size_t indexSSE2(const char *data, size_t n, uint64_t *newlines, uint64_t *semicolons) {
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i semi = _mm_set1_epi8(';');
+	size_t i = 0;
+	for (; i + 64 <= n; i += 64) {
+		uint64_t l = 0, s = 0;
+		for (int k = 0; k < 4; k++) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + k * 16));
+			l |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (k * 16);
+			s |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, semi)) << (k * 16);
+		}
+		newlines[i >> 6] = l;
+		semicolons[i >> 6] = s;
+	}
+	return i;
+}
+
+AVX2_TARGET static size_t indexAVX2(const char *data, size_t n, uint64_t *newlines, uint64_t *semicolons) {
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i semi = _mm256_set1_epi8(';');
+	size_t i = 0;
+	for (; i + 64 <= n; i += 64) {
+		__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		__m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+		newlines[i >> 6] = (uint64_t)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))
+			| (uint64_t)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+		semicolons[i >> 6] = (uint64_t)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, semi))
+			| (uint64_t)(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, semi)) << 32;
+	}
+	return i;
+}
+#endif
+
+static void index(const char *data, size_t n, bool scalar, std::vector<uint64_t> &newlines, std::vector<uint64_t> &semicolons) {
+	newlines.resize((n + 63) / 64);
+	semicolons.resize(newlines.size());
+	size_t done = 0;
+#ifdef SIMD_X86
+	if (!scalar && useAVX2) {
+		done = indexAVX2(data, n, newlines.data(), semicolons.data());
+	} else if (!scalar && useSSE2) {
+		done = indexSSE2(data, n, newlines.data(), semicolons.data());
+	}
+#endif
+	std::fill(newlines.begin() + done / 64, newlines.end(), 0);
+	std::fill(semicolons.begin() + done / 64, semicolons.end(), 0);
+	indexScalar(data, done, n, newlines.data(), semicolons.data());
+}
+
+// the first set bit at or after from, limit if there is none before it
+static inline size_t nextBit(const uint64_t *bits, size_t from, size_t limit) {
+	if (from >= limit) {
+		return limit;
+	}
+	size_t word = from >> 6;
+	uint64_t w = bits[word] & (~0ULL << (from & 63));
+	while (w == 0) {
+		if (++word << 6 >= limit) {
+			return limit;
+		}
+		w = bits[word];
+	}
+	return std::min(limit, (word << 6) + Simd::lowestBit(w));
+}
+
+// Indexes one window of data and appends its lines. Without final, a line that is cut off by the
+// end of the window is left for the next one. Returns the bytes consumed; when that is 0 the
+// window was too small for the line and has been doubled.
+static size_t scanWindow(const char *data, size_t size, bool final, bool scalar, size_t &window, unsigned int &number,
+		std::vector<uint64_t> &newlines, std::vector<uint64_t> &semicolons, std::vector<LineView> &lines) {
+	size_t n = std::min(size, window);
+	final = final && n == size;
+	index(data, n, scalar, newlines, semicolons);
+
+	size_t start = 0;
+	while (start < n) {
+		size_t end = nextBit(newlines.data(), start, n);
+		if (end == n && !final) {
+			break;
+		}
+		number++;
+
+		const char *b = data + start, *e = data + end;
+		while (b != e && CharClass::isSpace(*b)) {
+			b++;
+		}
+		while (e != b && CharClass::isSpace(e[-1])) {
+			e--;
+		}
+		if (b != e && *b != ';') {
+			size_t offset = b - data;
+			lines.push_back(LineView{b, (size_t)(e - b), nextBit(semicolons.data(), offset + 1, e - data) - offset, number});
+		}
+		start = end + 1;
+	}
+
+	if (start == 0 && !final) {
+		window *= 2;
+	}
+	return std::min(start, n);
+}
+
+static void scanAll(const char *data, size_t size, bool scalar, std::vector<LineView> &lines) {
+	std::vector<uint64_t> newlines, semicolons;
+	size_t window = WINDOW;
+	unsigned int number = 0;
+	for (size_t pos = 0; pos < size; ) {
+		pos += scanWindow(data + pos, size - pos, true, scalar, window, number, newlines, semicolons, lines);
+	}
+}
+
+void LineScanner::scan(const char *data, size_t size, std::vector<LineView> &lines) {
+	::scanAll(data, size, false, lines);
+}
+
+void LineScanner::scanScalar(const char *data, size_t size, std::vector<LineView> &lines) {
+	::scanAll(data, size, true, lines);
+}
+
+const char *LineScanner::kernel() {
+	return Simd::kernel();
+}
+
+LineScanner::LineScanner(const BufferPtr &buffer) : buffer_(buffer), data_(nullptr), size_(0), pos_(0), eof_(false), window_(WINDOW), number_(0), current_(0) {
+	const char *view = buffer_->view();
+	if (view != nullptr) {
+		// the scanner owns the rest of the input from here on
+		data_ = view;
+		size_ = buffer_->remaining();
+		eof_ = true;
+		buffer_->skip(size_);
+	}
+}
+
+bool LineScanner::read(size_t amount) {
+	size_t size = block_.size();
+	block_.resize(size + amount);
+	size_t n = buffer_->read(&block_[size], amount);
+	block_.resize(size + n);
+	eof_ = n < amount;
+	data_ = block_.data();
+	size_ = block_.size();
+	return n > 0;
+}
+
+bool LineScanner::refill() {
+	lines_.clear();
+	current_ = 0;
+	while (lines_.empty()) {
+		if (!eof_ && size_ - pos_ < window_) {
+			// only the unconsumed tail is kept, the views into the block handed out are done with
+			block_.erase(0, pos_);
+			pos_ = 0;
+			read(std::max<size_t>(BLOCK, window_));
+		}
+		if (pos_ == size_ && eof_) {
+			return false;
+		}
+		pos_ += scanWindow(data_ + pos_, size_ - pos_, eof_, false, window_, number_, newlines_, semicolons_, lines_);
+	}
+	return true;
+}
+
+bool LineScanner::next(LineView &line) {
+	if (current_ == lines_.size() && !refill()) {
+		return false;
+	}
+	line = lines_[current_++];
+	return true;
+}
+
+void LineScanner::scanAll(std::vector<LineView> &lines) {
+	size_t pending = lines.size();
+	lines.insert(lines.end(), lines_.begin() + current_, lines_.end());
+	lines_.clear();
+	current_ = 0;
+	if (!eof_) {
+		// everything is read first, so that the block does not move under the views
+		const char *base = data_;
+		size_t remaining = buffer_->remaining();
+		if (remaining != SIZE_MAX) {
+			block_.reserve(block_.size() + remaining);
+		}
+		while (!eof_) {
+			read(BLOCK);
+		}
+		for (size_t i = pending; i < lines.size(); i++) {
+			lines[i].text = data_ + (lines[i].text - base);
+		}
+	}
+	while (pos_ < size_) {
+		pos_ += scanWindow(data_ + pos_, size_ - pos_, true, false, window_, number_, newlines_, semicolons_, lines);
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef LINESCANNER_H
+#define LINESCANNER_H
+
+#include "Buffer.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// One line of assembly pointing into the scanned input, trimmed of white space
+struct LineView {
+	const char *text;
+	size_t length;
+	size_t comment; // offset of the first ';' after the first character, length if there is none
+	unsigned int number; // 1 based
+};
+
+// Splits assembly into lines without copying them. A window of input is indexed at once: the
+// AVX2 or SSE2 kernel (scalar without them) sets a bit for every line end and every ';' in it,
+// then lines and their comments are found by walking the set bits. Blank lines and lines that are
+// only a comment are skipped. Input that can be viewed in place (a StringBuffer) is never copied
+// and the views stay valid as long as the scanner; other buffers are read a block at a time.
+class LineScanner {
+public:
+	LineScanner(const BufferPtr &buffer);
+
+	// the next line, false at the end of the input. Unless the input is viewed in place, the text
+	// is only valid until the next call.
+	bool next(LineView &line);
+
+	// appends all remaining lines, valid as long as the scanner
+	void scanAll(std::vector<LineView> &lines);
+
+	// every line of data at once, with the vectorized kernel and with the scalar one
+	static void scan(const char *data, size_t size, std::vector<LineView> &lines);
+	static void scanScalar(const char *data, size_t size, std::vector<LineView> &lines);
+
+	// "avx2", "sse2" or "scalar"
+	static const char *kernel();
+
+private:
+	bool refill();
+	bool read(size_t amount); // appends to block_, false at the end of the input
+
+	BufferPtr buffer_;
+	const char *data_; // the input seen so far, size_ bytes of it
+	size_t size_, pos_;
+	std::string block_; // the input when it cannot be viewed in place
+	bool eof_;
+	size_t window_;
+	unsigned int number_;
+
+	std::vector<LineView> lines_;
+	size_t current_;
+	std::vector<uint64_t> newlines_, semicolons_;
+};
+
+#endif
@@ -0,0 +1,269 @@
+#include "Liveness.h"
+#include "opcodes.h"
+
+#include <algorithm>
+
+static inline void use(RegisterEffects &e, int from, int to) {
+	for (int r = from; r <= to && r <= MAXREGS; r++) {
+		e.use.set(r);
+	}
+	e.highest = std::max(e.highest, std::min(to, MAXREGS));
+}
+
+static inline void useOpen(RegisterEffects &e, int from) {
+	for (int r = from; r <= MAXREGS; r++) {
+		e.use.set(r);
+	}
+}
+
+static inline void useRK(RegisterEffects &e, int rk) {
+	if (!ISK(rk)) {
+		use(e, rk, rk);
+	}
+}
+
+static inline void def(RegisterEffects &e, int from, int to, bool kill = true) {
+	for (int r = from; r <= to && r <= MAXREGS; r++) {
+		e.def.set(r);
+		if (kill) {
+			e.kill.set(r);
+		}
+	}
+	e.highest = std::max(e.highest, std::min(to, MAXREGS));
+}
+
+// A call runs the callee in the frame above its base, which may overwrite every register from
+// there to the top; the instruction's own results are defined on top of that. The top of the frame
+// does not count towards 'highest'.
+static inline void clobber(RegisterEffects &e, int from) {
+	for (int r = from; r <= MAXREGS; r++) {
+		e.def.set(r);
+		e.kill.set(r);
+	}
+}
+
+RegisterEffects Liveness::effects(Instruction i) {
+	RegisterEffects e;
+	e.highest = -1;
+
+	int a = GETARG_A(i);
+	int b = GETARG_B(i);
+	int c = GETARG_C(i);
+
+	switch (GET_OPCODE(i)) {
+		case OP_MOVE:
+		case OP_UNM:
+		case OP_BNOT:
+		case OP_NOT:
+		case OP_LEN:
+			use(e, b, b);
+			def(e, a, a);
+			break;
+		case OP_LOADK:
+		case OP_LOADKX:
+		case OP_LOADBOOL:
+		case OP_GETUPVAL:
+		case OP_NEWTABLE:
+		case OP_CLOSURE:
+			def(e, a, a);
+			break;
+		case OP_LOADNIL:
+			def(e, a, a + b);
+			break;
+		case OP_GETTABUP:
+			useRK(e, c);
+			def(e, a, a);
+			break;
+		case OP_GETTABLE:
+			use(e, b, b);
+			useRK(e, c);
+			def(e, a, a);
+			break;
+		case OP_SETTABUP:
+			useRK(e, b);
+			useRK(e, c);
+			break;
+		case OP_SETUPVAL:
+			use(e, a, a);
+			break;
+		case OP_SETTABLE:
+			use(e, a, a);
+			useRK(e, b);
+			useRK(e, c);
+			break;
+		case OP_SELF:
+			use(e, b, b);
+			useRK(e, c);
+			def(e, a, a + 1);
+			break;
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_MOD:
+		case OP_POW:
+		case OP_DIV:
+		case OP_IDIV:
+		case OP_BAND:
+		case OP_BOR:
+		case OP_BXOR:
+		case OP_SHL:
+		case OP_SHR:
+			useRK(e, b);
+			useRK(e, c);
+			def(e, a, a);
+			break;
+		case OP_CONCAT:
+			use(e, b, c);
+			def(e, b, c); // concatenates in place, the result ends up in b
+			def(e, a, a);
+			break;
+		case OP_EQ:
+		case OP_LT:
+		case OP_LE:
+			useRK(e, b);
+			useRK(e, c);
+			break;
+		case OP_TEST:
+			use(e, a, a);
+			break;
+		case OP_TESTSET:
+			use(e, b, b);
+			def(e, a, a, false);
+			break;
+		case OP_CALL:
+			if (b == 0) {
+				use(e, a, a);
+				useOpen(e, a + 1);
+			} else {
+				use(e, a, a + b - 1);
+			}
+			if (c == 0) {
+				def(e, a, a, false);
+			} else if (c > 1) {
+				def(e, a, a + c - 2);
+			}
+			clobber(e, a);
+			break;
+		case OP_TAILCALL:
+			if (b == 0) {
+				use(e, a, a);
+				useOpen(e, a + 1);
+			} else {
+				use(e, a, a + b - 1);
+			}
+			break;
+		case OP_RETURN:
+			if (b == 0) {
+				useOpen(e, a);
+				e.highest = std::max(e.highest, a);
+			} else if (b > 1) {
+				use(e, a, a + b - 2);
+			}
+			break;
+		case OP_FORLOOP:
+			use(e, a, a + 2);
+			def(e, a, a);
+			def(e, a + 3, a + 3, false);
+			break;
+		case OP_FORPREP:
+			use(e, a, a + 2);
+			def(e, a, a + 2);
+			break;
+		case OP_TFORCALL:
+			use(e, a, a + 2);
+			def(e, a + 3, a + 2 + c);
+			clobber(e, a + 3);
+			e.highest = std::max(e.highest, std::min(a + 5, MAXREGS)); // the generator is called from a + 3
+			break;
+		case OP_TFORLOOP:
+			use(e, a + 1, a + 1);
+			def(e, a, a, false);
+			break;
+		case OP_SETLIST:
+			if (b == 0) {
+				use(e, a, a);
+				useOpen(e, a + 1);
+			} else {
+				use(e, a, a + b);
+			}
+			break;
+		case OP_VARARG:
+			if (b == 0) {
+				def(e, a, a, false);
+			} else if (b > 1) {
+				def(e, a, a + b - 2);
+			}
+			break;
+		default: // jmp, extraarg
+			break;
+	}
+
+	return e;
+}
+
+int Liveness::minStackSize(const std::vector<Instruction> &code, int params) {
+	int size = std::max(2, params); // registers 0 and 1 are always valid, like in the reference compiler
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		if (GET_OPCODE(code[pc]) == OP_EXTRAARG) {
+			continue;
+		}
+		size = std::max(size, effects(code[pc]).highest + 1);
+	}
+	return size;
+}
+
+Liveness::Liveness(const std::vector<Instruction> &code, const CFG &cfg, const RegisterSet &escaping) : code_(code), cfg_(cfg), escaping_(escaping) {
+	size_t n = cfg.size();
+	in_.assign(n, escaping_);
+	out_.assign(n, escaping_);
+
+	std::vector<RegisterEffects> effects(code.size());
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		if (GET_OPCODE(code[pc]) != OP_EXTRAARG) {
+			effects[pc] = Liveness::effects(code[pc]);
+		}
+	}
+
+	// backward dataflow; visiting blocks in reverse order converges in a few rounds for reducible code
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t b = n; b-- > 0;) {
+			const BasicBlock &block = cfg.block(b);
+
+			RegisterSet out = escaping_;
+			const int *succ = cfg.successors(b);
+			for (int s = 0; s < block.nsucc; s++) {
+				out |= in_[succ[s]];
+			}
+
+			RegisterSet live = out;
+			for (int pc = block.end - 1; pc >= block.start; pc--) {
+				live = (live & ~effects[pc].kill) | effects[pc].use;
+			}
+			live |= escaping_;
+
+			if (out != out_[b] || live != in_[b]) {
+				out_[b] = out;
+				in_[b] = live;
+				changed = true;
+			}
+		}
+	}
+}
+
+std::vector<RegisterSet> Liveness::liveAfter() const {
+	std::vector<RegisterSet> after(code_.size());
+	for (size_t b = 0; b < cfg_.size(); b++) {
+		const BasicBlock &block = cfg_.block(b);
+		RegisterSet live = out_[b];
+		for (int pc = block.end - 1; pc >= block.start; pc--) {
+			after[pc] = live;
+			if (GET_OPCODE(code_[pc]) != OP_EXTRAARG) {
+				RegisterEffects e = effects(code_[pc]);
+				live = ((live & ~e.kill) | e.use) | escaping_;
+			}
+		}
+	}
+	return after;
+}
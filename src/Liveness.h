@@ -0,0 +1,51 @@
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include "lconfig.h"
+#include "CFG.h"
+#include <vector>
+#include <bitset>
+
+#define MAXREGS 255
+
+typedef std::bitset<MAXREGS + 1> RegisterSet;
+
+struct RegisterEffects {
+	RegisterSet use, def;
+	RegisterSet kill; // the part of def that is always overwritten (conditional writes do not kill)
+	int highest; // highest register the instruction needs in the frame, -1 if none
+};
+
+// Register usage and backward liveness over a CFG. Open ranges (B or C == 0 on call, return,
+// setlist, vararg) read up to the top of the frame and are treated as using every register above
+// their base; calls define and kill every register from their base up. Registers in 'escaping'
+// (captured as upvalues) are considered live everywhere.
+class Liveness {
+public:
+	Liveness(const std::vector<Instruction> &code, const CFG &cfg, const RegisterSet &escaping = RegisterSet());
+
+	inline const RegisterSet &liveIn(size_t block) const {
+		return in_[block];
+	}
+
+	inline const RegisterSet &liveOut(size_t block) const {
+		return out_[block];
+	}
+
+	// live registers right after each instruction
+	std::vector<RegisterSet> liveAfter() const;
+
+	static RegisterEffects effects(Instruction i);
+
+	// the smallest maxstacksize that covers every register the code uses
+	static int minStackSize(const std::vector<Instruction> &code, int params);
+
+private:
+	const std::vector<Instruction> &code_;
+	const CFG &cfg_;
+	RegisterSet escaping_;
+
+	std::vector<RegisterSet> in_, out_;
+};
+
+#endif
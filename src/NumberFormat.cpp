@@ -0,0 +1,458 @@
+#include "NumberFormat.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#if defined(__has_include) && __cplusplus >= 201703L
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+// powers of ten that are exact doubles
+static const double powersOfTen[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#ifndef __cpp_lib_to_chars
+// Grisu3 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers"): the
+// digits come from 64 bit integer arithmetic on the number scaled by a cached power of ten. It
+// finds the shortest digits for about 99.5% of the doubles and reports the rest as undecided.
+namespace {
+	// f * 2^e
+	struct DiyFp {
+		uint64_t f;
+		int e;
+	};
+
+	// the upper 64 bits of the product, rounded
+	DiyFp multiply(DiyFp x, DiyFp y) {
+		const uint64_t M32 = 0xFFFFFFFFu;
+		uint64_t a = x.f >> 32, b = x.f & M32, c = y.f >> 32, d = y.f & M32;
+		uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+		uint64_t middle = (bd >> 32) + (ad & M32) + (bc & M32) + (1u << 31);
+		DiyFp r = {ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64};
+		return r;
+	}
+
+	DiyFp normalize(DiyFp x) {
+		while (!(x.f & (1ULL << 63))) {
+			x.f <<= 1;
+			x.e--;
+		}
+		return x;
+	}
+
+	// 10^decimal rounded to 64 bits, for every 8th decimal exponent from -348 to 340
+	struct CachedPower {
+		uint64_t f;
+		int e;
+		int decimal;
+	};
+
+	const CachedPower cachedPowers[] = {
+	{0xfa8fd5a0081c0288ULL, -1220, -348}, {0xbaaee17fa23ebf76ULL, -1193, -340}, {0x8b16fb203055ac76ULL, -1166, -332},
+	{0xcf42894a5dce35eaULL, -1140, -324}, {0x9a6bb0aa55653b2dULL, -1113, -316}, {0xe61acf033d1a45dfULL, -1087, -308},
+	{0xab70fe17c79ac6caULL, -1060, -300}, {0xff77b1fcbebcdc4fULL, -1034, -292}, {0xbe5691ef416bd60cULL, -1007, -284},
+	{0x8dd01fad907ffc3cULL, -980, -276}, {0xd3515c2831559a83ULL, -954, -268}, {0x9d71ac8fada6c9b5ULL, -927, -260},
+	{0xea9c227723ee8bcbULL, -901, -252}, {0xaecc49914078536dULL, -874, -244}, {0x823c12795db6ce57ULL, -847, -236},
+	{0xc21094364dfb5637ULL, -821, -228}, {0x9096ea6f3848984fULL, -794, -220}, {0xd77485cb25823ac7ULL, -768, -212},
+	{0xa086cfcd97bf97f4ULL, -741, -204}, {0xef340a98172aace5ULL, -715, -196}, {0xb23867fb2a35b28eULL, -688, -188},
+	{0x84c8d4dfd2c63f3bULL, -661, -180}, {0xc5dd44271ad3cdbaULL, -635, -172}, {0x936b9fcebb25c996ULL, -608, -164},
+	{0xdbac6c247d62a584ULL, -582, -156}, {0xa3ab66580d5fdaf6ULL, -555, -148}, {0xf3e2f893dec3f126ULL, -529, -140},
+	{0xb5b5ada8aaff80b8ULL, -502, -132}, {0x87625f056c7c4a8bULL, -475, -124}, {0xc9bcff6034c13053ULL, -449, -116},
+	{0x964e858c91ba2655ULL, -422, -108}, {0xdff9772470297ebdULL, -396, -100}, {0xa6dfbd9fb8e5b88fULL, -369, -92},
+	{0xf8a95fcf88747d94ULL, -343, -84}, {0xb94470938fa89bcfULL, -316, -76}, {0x8a08f0f8bf0f156bULL, -289, -68},
+	{0xcdb02555653131b6ULL, -263, -60}, {0x993fe2c6d07b7facULL, -236, -52}, {0xe45c10c42a2b3b06ULL, -210, -44},
+	{0xaa242499697392d3ULL, -183, -36}, {0xfd87b5f28300ca0eULL, -157, -28}, {0xbce5086492111aebULL, -130, -20},
+	{0x8cbccc096f5088ccULL, -103, -12}, {0xd1b71758e219652cULL, -77, -4}, {0x9c40000000000000ULL, -50, 4},
+	{0xe8d4a51000000000ULL, -24, 12}, {0xad78ebc5ac620000ULL, 3, 20}, {0x813f3978f8940984ULL, 30, 28},
+	{0xc097ce7bc90715b3ULL, 56, 36}, {0x8f7e32ce7bea5c70ULL, 83, 44}, {0xd5d238a4abe98068ULL, 109, 52},
+	{0x9f4f2726179a2245ULL, 136, 60}, {0xed63a231d4c4fb27ULL, 162, 68}, {0xb0de65388cc8ada8ULL, 189, 76},
+	{0x83c7088e1aab65dbULL, 216, 84}, {0xc45d1df942711d9aULL, 242, 92}, {0x924d692ca61be758ULL, 269, 100},
+	{0xda01ee641a708deaULL, 295, 108}, {0xa26da3999aef774aULL, 322, 116}, {0xf209787bb47d6b85ULL, 348, 124},
+	{0xb454e4a179dd1877ULL, 375, 132}, {0x865b86925b9bc5c2ULL, 402, 140}, {0xc83553c5c8965d3dULL, 428, 148},
+	{0x952ab45cfa97a0b3ULL, 455, 156}, {0xde469fbd99a05fe3ULL, 481, 164}, {0xa59bc234db398c25ULL, 508, 172},
+	{0xf6c69a72a3989f5cULL, 534, 180}, {0xb7dcbf5354e9beceULL, 561, 188}, {0x88fcf317f22241e2ULL, 588, 196},
+	{0xcc20ce9bd35c78a5ULL, 614, 204}, {0x98165af37b2153dfULL, 641, 212}, {0xe2a0b5dc971f303aULL, 667, 220},
+	{0xa8d9d1535ce3b396ULL, 694, 228}, {0xfb9b7cd9a4a7443cULL, 720, 236}, {0xbb764c4ca7a44410ULL, 747, 244},
+	{0x8bab8eefb6409c1aULL, 774, 252}, {0xd01fef10a657842cULL, 800, 260}, {0x9b10a4e5e9913129ULL, 827, 268},
+	{0xe7109bfba19c0c9dULL, 853, 276}, {0xac2820d9623bf429ULL, 880, 284}, {0x80444b5e7aa7cf85ULL, 907, 292},
+	{0xbf21e44003acdd2dULL, 933, 300}, {0x8e679c2f5e44ff8fULL, 960, 308}, {0xd433179d9c8cb841ULL, 986, 316},
+	{0x9e19db92b4e31ba9ULL, 1013, 324}, {0xeb96bf6ebadf77d9ULL, 1039, 332}, {0xaf87023b9bf0ee6bULL, 1066, 340},
+	};
+
+	// Moves the last digit down while that brings the digits closer to the number, then tells
+	// whether they are certainly the closest ones inside the boundaries. All distances are in units
+	// of the scaled number, each known to within 'unit'.
+	bool roundWeed(char *digits, int length, uint64_t distanceTooHigh, uint64_t unsafeInterval, uint64_t rest, uint64_t tenKappa, uint64_t unit) {
+		uint64_t smallDistance = distanceTooHigh - unit;
+		uint64_t bigDistance = distanceTooHigh + unit;
+		while (rest < smallDistance && unsafeInterval - rest >= tenKappa &&
+				(rest + tenKappa < smallDistance || smallDistance - rest >= rest + tenKappa - smallDistance)) {
+			digits[length - 1]--;
+			rest += tenKappa;
+		}
+		if (rest < bigDistance && unsafeInterval - rest >= tenKappa &&
+				(rest + tenKappa < bigDistance || bigDistance - rest > rest + tenKappa - bigDistance)) {
+			return false;
+		}
+		return 2 * unit <= rest && rest <= unsafeInterval - 4 * unit;
+	}
+
+	// generates digits of high until they are inside (low, high); number = digits * 10^kappa
+	bool generateDigits(DiyFp low, DiyFp w, DiyFp high, char *digits, int &length, int &kappa) {
+		uint64_t unit = 1;
+		DiyFp tooLow = {low.f - unit, low.e};
+		DiyFp tooHigh = {high.f + unit, high.e};
+		uint64_t unsafeInterval = tooHigh.f - tooLow.f;
+		int shift = -w.e;
+		uint64_t one = 1ULL << shift;
+		uint32_t integrals = (uint32_t)(tooHigh.f >> shift);
+		uint64_t fractionals = tooHigh.f & (one - 1);
+
+		uint32_t divisor = 1;
+		kappa = 0;
+		for (uint32_t n = integrals; n; n /= 10) {
+			kappa++;
+		}
+		for (int i = 1; i < kappa; i++) {
+			divisor *= 10;
+		}
+
+		length = 0;
+		while (kappa > 0) {
+			digits[length++] = (char)('0' + integrals / divisor);
+			integrals %= divisor;
+			kappa--;
+			uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+			if (rest < unsafeInterval) {
+				return roundWeed(digits, length, tooHigh.f - w.f, unsafeInterval, rest, (uint64_t)divisor << shift, unit);
+			}
+			divisor /= 10;
+		}
+		for (;;) {
+			fractionals *= 10;
+			unit *= 10;
+			unsafeInterval *= 10;
+			digits[length++] = (char)('0' + (fractionals >> shift));
+			fractionals &= one - 1;
+			kappa--;
+			if (fractionals < unsafeInterval) {
+				return roundWeed(digits, length, (tooHigh.f - w.f) * unit, unsafeInterval, fractionals, one, unit);
+			}
+		}
+	}
+}
+#endif
+
+// Shortest digits of a positive finite number, which is digits * 10^exponent. Returns false when
+// they could not be told apart from a longer candidate.
+static bool shortestDigits(double number, char *digits, int &length, int &exponent) {
+#ifdef __cpp_lib_to_chars
+	// d.ddde+XX
+	char buffer[32];
+	std::to_chars_result r = std::to_chars(buffer, buffer + sizeof(buffer), number, std::chars_format::scientific);
+	length = 0;
+	const char *c = buffer;
+	for (; c != r.ptr && *c != 'e'; ++c) {
+		if (*c != '.') {
+			digits[length++] = *c;
+		}
+	}
+	*r.ptr = '\0';
+	exponent = std::atoi(c + 1) - (length - 1);
+	return true;
+#else
+	uint64_t bits;
+	std::memcpy(&bits, &number, sizeof(bits));
+	int biased = (int)(bits >> 52);
+	uint64_t significand = bits & ((1ULL << 52) - 1);
+	DiyFp v = {significand, -1074};
+	if (biased) {
+		v.f |= 1ULL << 52;
+		v.e = biased - 1075;
+	}
+
+	// halfway to the neighbours; the one below is closer when the significand just wrapped
+	DiyFp plus = normalize(DiyFp{(v.f << 1) + 1, v.e - 1});
+	DiyFp minus = significand == 0 && biased > 1 ? DiyFp{(v.f << 2) - 1, v.e - 2} : DiyFp{(v.f << 1) - 1, v.e - 1};
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+	DiyFp w = normalize(v);
+
+	// a power of ten that brings the binary exponent of the product into [-60, -32]
+	int k = (int)std::ceil((-60 - (w.e + 64) + 63) * 0.30102999566398114);
+	const CachedPower &power = cachedPowers[(348 + k - 1) / 8 + 1];
+	DiyFp scale = {power.f, power.e};
+
+	int kappa;
+	bool exact = generateDigits(multiply(minus, scale), multiply(w, scale), multiply(plus, scale), digits, length, kappa);
+	exponent = kappa - power.decimal;
+	return exact;
+#endif
+}
+
+std::string NumberFormat::format(double number) {
+	if (std::isnan(number)) {
+		return std::signbit(number) ? "-nan" : "nan";
+	}
+	if (std::isinf(number)) {
+		return number < 0 ? "-inf" : "inf";
+	}
+	if (number == 0) {
+		return std::signbit(number) ? "-0.0" : "0.0";
+	}
+
+	char buffer[48]; // at most 24 characters and ".0", with room for what -Wformat-truncation assumes
+	char digits[20];
+	int length, exponent;
+	if (shortestDigits(std::fabs(number), digits, length, exponent)) {
+		while (length > 1 && digits[length - 1] == '0') {
+			length--;
+			exponent++;
+		}
+
+		// laid out like %.*g with 15 digits, or just the digits there are for subnormals
+		int point = exponent + length - 1;
+		int precision = std::fabs(number) < std::numeric_limits<double>::min() ? length : std::max(length, 15);
+		char *c = buffer;
+		if (number < 0) {
+			*c++ = '-';
+		}
+		if (point < -4 || point >= precision) {
+			*c++ = digits[0];
+			if (length > 1) {
+				*c++ = '.';
+				std::memcpy(c, digits + 1, length - 1);
+				c += length - 1;
+			}
+			std::snprintf(c, buffer + sizeof(buffer) - c, "e%c%02d", point < 0 ? '-' : '+', std::abs(point));
+		} else if (point < 0) {
+			*c++ = '0';
+			*c++ = '.';
+			std::memset(c, '0', -point - 1);
+			c += -point - 1;
+			std::memcpy(c, digits, length);
+			*(c + length) = '\0';
+		} else if (point < length - 1) {
+			std::memcpy(c, digits, point + 1);
+			c += point + 1;
+			*c++ = '.';
+			std::memcpy(c, digits + point + 1, length - point - 1);
+			*(c + length - point - 1) = '\0';
+		} else {
+			std::memcpy(c, digits, length);
+			c += length;
+			std::memset(c, '0', point + 1 - length);
+			c += point + 1 - length;
+			std::strcpy(c, ".0");
+		}
+		return buffer;
+	}
+
+	// The nearest decimal with n digits reads back whenever any n digit decimal does, so the first
+	// precision that reads back is the shortest. Every decimal of up to 15 digits survives the trip
+	// through a normal double, so %.15g already is the shortest when one of those exists; subnormals
+	// have fewer significant digits and are searched from 1. 17 digits always read back.
+	int precision = std::fabs(number) < std::numeric_limits<double>::min() ? 1 : 15;
+	for (; precision <= 17; precision++) {
+		std::snprintf(buffer, sizeof(buffer), "%.*g", precision, number);
+		if (std::strtod(buffer, nullptr) == number) {
+			break;
+		}
+	}
+
+	// integral values would otherwise read back as integers
+	if (buffer[std::strspn(buffer, "-0123456789")] == '\0') {
+		std::strcat(buffer, ".0");
+	}
+	return buffer;
+}
+
+// strtod on text that is not null-terminated, copied to the stack unless it is unusually long
+static double toDouble(const char *start, const char *end) {
+	char buffer[128];
+	size_t n = end - start;
+	if (n >= sizeof(buffer)) {
+		return std::strtod(std::string(start, end).c_str(), nullptr);
+	}
+	std::memcpy(buffer, start, n);
+	buffer[n] = '\0';
+	return std::strtod(buffer, nullptr);
+}
+
+// case-insensitive match of a whole word
+static bool isWord(const char *start, const char *end, const char *word) {
+	for (; start != end && *word; ++start, ++word) {
+		if (CharClass::lower(*start) != *word) {
+			return false;
+		}
+	}
+	return start == end && *word == '\0';
+}
+
+// reads the exponent after 'e' or 'p', returns nullptr if there are no digits
+static const char *parseExponent(const char *c, const char *end, int &exponent) {
+	bool negative = false;
+	if (c != end && (*c == '+' || *c == '-')) {
+		negative = *c == '-';
+		c++;
+	}
+	if (c == end || !CharClass::isDigit(*c)) {
+		return nullptr;
+	}
+	int value = 0;
+	for (; c != end && CharClass::isDigit(*c); ++c) {
+		if (value < 100000) { // far beyond any double, saturating keeps it from overflowing
+			value = value * 10 + (*c - '0');
+		}
+	}
+	exponent += negative ? -value : value;
+	return c;
+}
+
+const char *NumberFormat::parse(const char *start, const char *end, double &number, long long &integer, bool &isInteger) {
+	const char *c = start;
+	bool negative = false;
+	if (c != end && (*c == '-' || *c == '+')) {
+		negative = *c == '-';
+		c++;
+	}
+	if (c == end) {
+		return nullptr;
+	}
+
+	if (CharClass::isAlpha(*c)) {
+		const char *w = std::find_if_not(c, end, CharClass::isAlnum);
+		if (isWord(c, w, "inf")) {
+			number = std::numeric_limits<double>::infinity();
+		} else if (isWord(c, w, "nan")) {
+			number = std::numeric_limits<double>::quiet_NaN();
+		} else {
+			return nullptr;
+		}
+		number = negative ? -number : number;
+		isInteger = false;
+		return w;
+	}
+
+	if (*c == '0' && c + 1 != end && (c[1] == 'x' || c[1] == 'X')) {
+		return parseHex(start, c + 2, end, negative, number, integer, isInteger);
+	}
+
+	// the first 19 significant digits are kept exactly, the rest only move the exponent
+	unsigned long long mantissa = 0, magnitude = 0;
+	unsigned long long limit = negative ? 1ULL << 63 : (1ULL << 63) - 1;
+	int exponent = 0, digits = 0;
+	bool point = false, truncated = false, fits = true;
+	for (; c != end; ++c) {
+		if (CharClass::isDigit(*c)) {
+			int digit = *c - '0';
+			digits++;
+			if (mantissa <= (std::numeric_limits<unsigned long long>::max() - 9) / 10) {
+				mantissa = mantissa * 10 + digit;
+				exponent -= point;
+			} else {
+				exponent += !point;
+				truncated |= digit != 0;
+			}
+			if (!point) {
+				if (magnitude > (limit - digit) / 10) {
+					fits = false;
+				} else {
+					magnitude = magnitude * 10 + digit;
+				}
+			}
+		} else if (*c == '.' && !point) {
+			point = true;
+		} else {
+			break;
+		}
+	}
+	if (digits == 0) {
+		return nullptr;
+	}
+
+	bool scaled = false;
+	if (c != end && (*c == 'e' || *c == 'E')) {
+		if ((c = parseExponent(c + 1, end, exponent)) == nullptr) {
+			return nullptr;
+		}
+		scaled = true;
+	}
+
+	if (!point && !scaled && fits) {
+		isInteger = true;
+		integer = (long long)(negative ? 0 - magnitude : magnitude);
+		return c;
+	}
+	isInteger = false;
+
+	// exact mantissa and power of ten: one correctly rounded operation (Clinger's fast path)
+	if (!truncated && mantissa <= 1ULL << 53 && exponent >= -22 && exponent <= 22) {
+		number = exponent < 0 ? (double)mantissa / powersOfTen[-exponent] : (double)mantissa * powersOfTen[exponent];
+		number = negative ? -number : number;
+	} else {
+		number = toDouble(start, c);
+	}
+	return c;
+}
+
+const char *NumberFormat::parseHex(const char *start, const char *c, const char *end, bool negative, double &number, long long &integer, bool &isInteger) {
+	// the first 15 hexadecimal digits are kept exactly, integers wrap around
+	unsigned long long mantissa = 0, wrapped = 0;
+	int exponent = 0, digits = 0;
+	bool point = false, truncated = false;
+	for (; c != end; ++c) {
+		if (CharClass::isXDigit(*c)) {
+			int digit = CharClass::isDigit(*c) ? *c - '0' : CharClass::lower(*c) - 'a' + 10;
+			digits++;
+			if (mantissa >> 56 == 0) {
+				mantissa = mantissa * 16 + digit;
+				exponent -= point ? 4 : 0;
+			} else {
+				exponent += point ? 0 : 4;
+				truncated |= digit != 0;
+			}
+			wrapped = wrapped * 16 + digit;
+		} else if (*c == '.' && !point) {
+			point = true;
+		} else {
+			break;
+		}
+	}
+	if (digits == 0) {
+		return nullptr;
+	}
+
+	bool scaled = false;
+	if (c != end && (*c == 'p' || *c == 'P')) {
+		if ((c = parseExponent(c + 1, end, exponent)) == nullptr) {
+			return nullptr;
+		}
+		scaled = true;
+	}
+
+	if (!point && !scaled) {
+		isInteger = true;
+		integer = (long long)(negative ? 0 - wrapped : wrapped);
+		return c;
+	}
+	isInteger = false;
+
+	// a mantissa that fits a double is scaled exactly, rounding at most once
+	if (!truncated && mantissa <= 1ULL << 53) {
+		number = std::ldexp((double)mantissa, exponent);
+		number = negative ? -number : number;
+	} else {
+		number = toDouble(start, c);
+	}
+	return c;
+}
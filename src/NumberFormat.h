@@ -0,0 +1,24 @@
+#ifndef NUMBERFORMAT_H
+#define NUMBERFORMAT_H
+
+#include <string>
+
+// Conversion of number constants to and from assembly text. Floats are written with the fewest
+// significant digits that read back to the same double (5e-324, not 4.94065645841247e-324) and
+// always carry a decimal point or exponent, so they never read back as integers. Works on double
+// and long long, the lua_Number and lua_Integer of lconfig.h, which includes this header.
+class NumberFormat {
+public:
+	static std::string format(double number);
+
+	// parses an optionally signed number: decimal or hexadecimal integers, decimal floats with an
+	// exponent, hexadecimal floats (0x1.8p3), inf and nan. Integers without a decimal point or
+	// exponent set isInteger; decimal ones that do not fit 64 bits are read as floats, hexadecimal
+	// ones wrap around like in Lua. Returns the end of the number, or nullptr if there is none.
+	static const char *parse(const char *start, const char *end, double &number, long long &integer, bool &isInteger);
+
+private:
+	static const char *parseHex(const char *start, const char *c, const char *end, bool negative, double &number, long long &integer, bool &isInteger);
+};
+
+#endif
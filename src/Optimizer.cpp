@@ -0,0 +1,980 @@
+#include "Optimizer.h"
+#include "CFG.h"
+#include "ConstantPool.h"
+#include "opcodes.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+// in the order the passes run
+static const struct {
+	const char *name;
+	unsigned int pass;
+} passNames[] = {
+	{"unreachable", Optimizer::OPT_UNREACHABLE},
+	{"fold", Optimizer::OPT_FOLD},
+	{"coalesce", Optimizer::OPT_COALESCE},
+	{"peephole", Optimizer::OPT_PEEPHOLE},
+	{"layout", Optimizer::OPT_LAYOUT},
+	{"constants", Optimizer::OPT_CONSTANTS}
+};
+
+static const size_t NUM_PASSES = sizeof(passNames) / sizeof(passNames[0]);
+
+Optimizer::Optimizer(unsigned int passes) : passes_(passes), dropped_(0), folded_(0) {
+
+}
+
+bool Optimizer::parsePasses(const std::string &list, unsigned int &passes) {
+	passes = 0;
+	std::stringstream ss(list);
+	std::string name;
+	while (std::getline(ss, name, ',')) {
+		Util::trim(name);
+		Util::lower(name);
+		if (name == "all") {
+			passes |= OPT_ALL;
+			continue;
+		}
+		bool found = false;
+		for (const auto &n : passNames) {
+			if (name == n.name) {
+				passes |= n.pass;
+				found = true;
+				break;
+			}
+		}
+		if (!found) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void Optimizer::removeInstructions(ParsedFunction &function, const std::vector<char> &remove) {
+	std::vector<Instruction> &code = function.instructions;
+	int n = (int)code.size();
+
+	// map[pc] is the new index of the first kept instruction at or after pc
+	std::vector<int> map(n + 1);
+	int kept = 0;
+	for (int pc = 0; pc < n; pc++) {
+		map[pc] = kept;
+		if (!remove[pc]) {
+			kept++;
+		}
+	}
+	map[n] = kept;
+
+	bool lines = function.lineinfos.size() == code.size();
+	for (int pc = 0; pc < n; pc++) {
+		if (remove[pc]) {
+			continue;
+		}
+		int target = CFG::jumpTarget(code, pc);
+		if (target >= 0 && target <= n) {
+			SETARG_sBx(code[pc], map[target] - map[pc] - 1);
+		}
+		code[map[pc]] = code[pc];
+		if (lines) {
+			function.lineinfos[map[pc]] = function.lineinfos[pc];
+		}
+	}
+	code.resize(kept);
+	if (lines) {
+		function.lineinfos.resize(kept);
+	}
+
+	for (auto it = function.neededSubroutines.begin(); it != function.neededSubroutines.end();) {
+		if (remove[it->second]) {
+			it = function.neededSubroutines.erase(it);
+		} else {
+			it->second = map[it->second];
+			it++;
+		}
+	}
+}
+
+// replaces reads of register 'from' by 'to' where the instruction accepts any register
+static void rewriteUses(Instruction &i, int from, int to) {
+	auto reg = [&](int r) {
+		return r == from ? to : r;
+	};
+	auto rk = [&](int r) {
+		return !ISK(r) && r == from ? to : r;
+	};
+
+	switch (GET_OPCODE(i)) {
+		case OP_MOVE:
+		case OP_UNM:
+		case OP_BNOT:
+		case OP_NOT:
+		case OP_LEN:
+		case OP_TESTSET:
+			SETARG_B(i, reg(GETARG_B(i)));
+			break;
+		case OP_GETTABLE:
+		case OP_SELF:
+			SETARG_B(i, reg(GETARG_B(i)));
+			SETARG_C(i, rk(GETARG_C(i)));
+			break;
+		case OP_GETTABUP:
+			SETARG_C(i, rk(GETARG_C(i)));
+			break;
+		case OP_SETTABLE:
+			SETARG_A(i, reg(GETARG_A(i)));
+			// fall through
+		case OP_SETTABUP:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_MOD:
+		case OP_POW:
+		case OP_DIV:
+		case OP_IDIV:
+		case OP_BAND:
+		case OP_BOR:
+		case OP_BXOR:
+		case OP_SHL:
+		case OP_SHR:
+		case OP_EQ:
+		case OP_LT:
+		case OP_LE:
+			SETARG_B(i, rk(GETARG_B(i)));
+			SETARG_C(i, rk(GETARG_C(i)));
+			break;
+		case OP_SETUPVAL:
+		case OP_TEST:
+			SETARG_A(i, reg(GETARG_A(i)));
+			break;
+		default: // operands that are part of a register range keep their position
+			break;
+	}
+}
+
+// true if the instruction writes exactly register A and can write any other register instead
+static bool retargetable(Instruction i) {
+	switch (GET_OPCODE(i)) {
+		case OP_MOVE:
+		case OP_LOADK:
+		case OP_GETUPVAL:
+		case OP_GETTABUP:
+		case OP_GETTABLE:
+		case OP_NEWTABLE:
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_MOD:
+		case OP_POW:
+		case OP_DIV:
+		case OP_IDIV:
+		case OP_BAND:
+		case OP_BOR:
+		case OP_BXOR:
+		case OP_SHL:
+		case OP_SHR:
+		case OP_UNM:
+		case OP_BNOT:
+		case OP_NOT:
+		case OP_LEN:
+		case OP_CONCAT:
+		case OP_CLOSURE:
+			return true;
+		case OP_LOADBOOL:
+			return GETARG_C(i) == 0;
+		case OP_LOADNIL:
+			return GETARG_B(i) == 0;
+		case OP_VARARG:
+			return GETARG_B(i) == 2;
+		default:
+			return false;
+	}
+}
+
+size_t Optimizer::propagateCopies(ParsedFunction &function, const RegisterSet &escaping) {
+	std::vector<Instruction> &code = function.instructions;
+	CFG cfg(code);
+
+	// forward: reads of a move's destination are redirected to its source until either is redefined
+	for (size_t b = 0; b < cfg.size(); b++) {
+		const BasicBlock &block = cfg.block(b);
+		for (int pc = block.start; pc < block.end; pc++) {
+			Instruction move = code[pc];
+			if (GET_OPCODE(move) != OP_MOVE) {
+				continue;
+			}
+			int a = GETARG_A(move), src = GETARG_B(move);
+			if (a == src || escaping[a] || escaping[src]) {
+				continue;
+			}
+
+			for (int j = pc + 1; j < block.end; j++) {
+				OpCode op = GET_OPCODE(code[j]);
+				if (op == OP_EXTRAARG) {
+					continue;
+				}
+				if (op == OP_CALL || op == OP_TAILCALL || op == OP_TFORCALL) {
+					break; // the callee may overwrite either register
+				}
+				rewriteUses(code[j], a, src);
+				RegisterEffects e = Liveness::effects(code[j]);
+				if (e.use[a] || e.def[a] || e.def[src]) {
+					break;
+				}
+			}
+		}
+	}
+
+	// then moves whose destination is never read again are dropped
+	Liveness liveness(code, cfg, escaping);
+	std::vector<RegisterSet> after = liveness.liveAfter();
+
+	std::vector<char> remove(code.size(), 0);
+	size_t removed = 0;
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		Instruction i = code[pc];
+		if (GET_OPCODE(i) != OP_MOVE || (pc > 0 && CFG::skips(code[pc - 1]))) {
+			continue;
+		}
+		if (GETARG_A(i) == GETARG_B(i) || !after[pc][GETARG_A(i)]) {
+			remove[pc] = 1;
+			removed++;
+		}
+	}
+
+	if (removed) {
+		removeInstructions(function, remove);
+	}
+	return removed;
+}
+
+size_t Optimizer::coalesceMoves(ParsedFunction &function, const RegisterSet &escaping) {
+	std::vector<Instruction> &code = function.instructions;
+	CFG cfg(code);
+	Liveness liveness(code, cfg, escaping);
+	std::vector<RegisterSet> after = liveness.liveAfter();
+
+	// 'def %b; move %a %b' with %b dead after the move becomes 'def %a'
+	std::vector<char> remove(code.size(), 0);
+	size_t removed = 0;
+	for (size_t pc = 0; pc + 1 < code.size(); pc++) {
+		Instruction def = code[pc], move = code[pc + 1];
+		if (GET_OPCODE(move) != OP_MOVE || !retargetable(def) || cfg.blockOf(pc) != cfg.blockOf(pc + 1)) {
+			continue;
+		}
+
+		int a = GETARG_A(move), b = GETARG_B(move);
+		if (GETARG_A(def) != b || a == b || escaping[a] || escaping[b] || after[pc + 1][b]) {
+			continue;
+		}
+
+		SETARG_A(code[pc], a);
+		remove[pc + 1] = 1;
+		removed++;
+		pc++; // the move is gone, it cannot be the definition of the next pair
+	}
+
+	if (removed) {
+		removeInstructions(function, remove);
+	}
+	return removed;
+}
+
+size_t Optimizer::peephole(ParsedFunction &function, const RegisterSet &escaping) {
+	std::vector<Instruction> &code = function.instructions;
+	int n = (int)code.size();
+	CFG cfg(code);
+	Liveness liveness(code, cfg, escaping);
+	std::vector<RegisterSet> after = liveness.liveAfter();
+
+	std::vector<char> remove(n, 0);
+	size_t removed = 0;
+	int loadnil = -1; // the loadnil the next adjacent one is merged into
+
+	for (int pc = 0; pc < n; pc++) {
+		Instruction i = code[pc];
+		OpCode op = GET_OPCODE(i);
+
+		if (op == OP_JMP) {
+			// jmp to jmp: go straight to the end of the chain, unless a hop closes upvalues
+			int target = CFG::jumpTarget(code, pc);
+			for (int hops = 0; target >= 0 && target < n && target != pc && hops < n; hops++) {
+				Instruction next = code[target];
+				if (GET_OPCODE(next) != OP_JMP || GETARG_A(next) != 0) {
+					break;
+				}
+				target = CFG::jumpTarget(code, target);
+			}
+			SETARG_sBx(code[pc], target - pc - 1);
+
+			// jmp 0 is a no-op unless it closes upvalues or is the jump taken after a skipping test
+			if (target == pc + 1 && GETARG_A(i) == 0 && !(pc > 0 && CFG::skips(code[pc - 1]))) {
+				remove[pc] = 1;
+				removed++;
+			}
+		}
+
+		if (op == OP_LOADNIL) {
+			if (loadnil >= 0 && cfg.blockOf(loadnil) == cfg.blockOf(pc)) {
+				int from = GETARG_A(code[loadnil]), to = from + GETARG_B(code[loadnil]);
+				int a = GETARG_A(i), b = a + GETARG_B(i);
+				if (a <= to + 1 && from <= b + 1) {
+					SETARG_A(code[loadnil], std::min(from, a));
+					SETARG_B(code[loadnil], std::max(to, b) - std::min(from, a));
+					remove[pc] = 1;
+					removed++;
+					continue;
+				}
+			}
+			loadnil = pc;
+		} else {
+			loadnil = -1;
+		}
+
+		// not %a %b; test %a c  ->  test %b !c  when %a is not read afterwards
+		if (op == OP_NOT && pc + 1 < n && cfg.blockOf(pc) == cfg.blockOf(pc + 1)) {
+			Instruction test = code[pc + 1];
+			int a = GETARG_A(i);
+			if (GET_OPCODE(test) == OP_TEST && GETARG_A(test) == a && !escaping[a] && !after[pc + 1][a]) {
+				SETARG_A(code[pc + 1], GETARG_B(i));
+				SETARG_C(code[pc + 1], !GETARG_C(test));
+				remove[pc] = 1;
+				removed++;
+			}
+		}
+	}
+
+	// the return the compiler appends after an explicit one is never reached
+	if (n >= 2 && GET_OPCODE(code[n - 1]) == OP_RETURN && GET_OPCODE(code[n - 2]) == OP_RETURN && !remove[n - 1]
+		&& cfg.block(cfg.blockOf(n - 1)).npred == 0) {
+		remove[n - 1] = 1;
+		removed++;
+	}
+
+	if (removed) {
+		removeInstructions(function, remove);
+	}
+	return removed;
+}
+
+size_t Optimizer::removeUnreachable(ParsedFunction &function) {
+	std::vector<Instruction> &code = function.instructions;
+	CFG cfg(code);
+	if (cfg.size() == 0) {
+		return 0;
+	}
+
+	std::vector<char> reached(cfg.size(), 0);
+	std::vector<int> stack(1, 0);
+	reached[0] = 1;
+	while (!stack.empty()) {
+		int b = stack.back();
+		stack.pop_back();
+		const int *succ = cfg.successors(b);
+		for (int s = 0; s < cfg.block(b).nsucc; s++) {
+			if (!reached[succ[s]]) {
+				reached[succ[s]] = 1;
+				stack.push_back(succ[s]);
+			}
+		}
+
+		// 'loadbool A B 1' never runs the next instruction, but skips it by counting: removing it
+		// would make the skip land one instruction further
+		int last = cfg.block(b).end - 1;
+		if (CFG::skips(code[last]) && last + 1 < (int)code.size() && !reached[cfg.blockOf(last + 1)]) {
+			reached[cfg.blockOf(last + 1)] = 1;
+			stack.push_back(cfg.blockOf(last + 1));
+		}
+	}
+
+	std::vector<char> remove(code.size(), 0);
+	size_t removed = 0;
+	for (size_t b = 0; b < cfg.size(); b++) {
+		if (!reached[b]) {
+			const BasicBlock &block = cfg.block(b);
+			std::fill(remove.begin() + block.start, remove.begin() + block.end, 1);
+			removed += block.end - block.start;
+		}
+	}
+
+	if (removed) {
+		removeInstructions(function, remove);
+	}
+	return removed;
+}
+
+size_t Optimizer::layoutBlocks(ParsedFunction &function) {
+	std::vector<Instruction> &code = function.instructions;
+	int n = (int)code.size();
+	if (n == 0 || !CFG::noFallThrough(code[n - 1])) {
+		return 0;
+	}
+	CFG cfg(code);
+
+	// blocks that are entered by falling through, or that sit at the fixed distance a skipping
+	// instruction relies on, are glued to the previous block. Glued runs form chains that can be
+	// placed anywhere, since control never flows from the end of one chain into the next.
+	std::vector<int> chainAt(n + 1, -1);
+	std::vector<std::pair<int, int> > chains; // instruction range of each chain
+	for (size_t b = 0; b < cfg.size(); b++) {
+		int pc = cfg.block(b).start;
+		bool glued = pc > 0 && (!CFG::noFallThrough(code[pc - 1]) || CFG::skips(code[pc - 1]) || (pc > 1 && CFG::skips(code[pc - 2])));
+		if (glued) {
+			chains.back().second = cfg.block(b).end;
+		} else {
+			chainAt[pc] = (int)chains.size();
+			chains.push_back(std::make_pair(pc, cfg.block(b).end));
+		}
+	}
+
+	// a chain ending in a plain jmp pulls the chain it jumps to right behind it, the entry stays first
+	std::vector<char> placed(chains.size(), 0);
+	std::vector<int> order;
+	for (size_t c = 0; c < chains.size(); c++) {
+		for (int cur = (int)c; cur >= 0 && !placed[cur];) {
+			placed[cur] = 1;
+			order.push_back(cur);
+
+			int last = chains[cur].second - 1;
+			int target = CFG::jumpTarget(code, last);
+			cur = GET_OPCODE(code[last]) == OP_JMP && GETARG_A(code[last]) == 0 && target >= 0 && target < n ? chainAt[target] : -1;
+		}
+	}
+
+	std::vector<int> newpc(n + 1);
+	std::vector<char> dropped(n, 0);
+	size_t removed = 0;
+	int next = 0;
+	for (size_t o = 0; o < order.size(); o++) {
+		const std::pair<int, int> &chain = chains[order[o]];
+		for (int pc = chain.first; pc < chain.second; pc++) {
+			newpc[pc] = next;
+			if (pc == chain.second - 1 && o + 1 < order.size() && GET_OPCODE(code[pc]) == OP_JMP && GETARG_A(code[pc]) == 0
+				&& CFG::jumpTarget(code, pc) == chains[order[o + 1]].first) {
+				dropped[pc] = 1; // jumps into the dropped jmp now land on its target, which comes next
+				removed++;
+			} else {
+				next++;
+			}
+		}
+	}
+	newpc[n] = next;
+
+	if (!removed) {
+		return 0;
+	}
+
+	std::vector<Instruction> laid(next);
+	bool lines = function.lineinfos.size() == code.size();
+	std::vector<int> lineinfos(lines ? next : 0);
+	for (int pc = 0; pc < n; pc++) {
+		if (dropped[pc]) {
+			continue;
+		}
+		Instruction i = code[pc];
+		int target = CFG::jumpTarget(code, pc);
+		if (target >= 0 && target <= n) {
+			SETARG_sBx(i, newpc[target] - newpc[pc] - 1);
+		}
+		laid[newpc[pc]] = i;
+		if (lines) {
+			lineinfos[newpc[pc]] = function.lineinfos[pc];
+		}
+	}
+	code.swap(laid);
+	if (lines) {
+		function.lineinfos.swap(lineinfos);
+	}
+	for (auto &sub : function.neededSubroutines) {
+		sub.second = newpc[sub.second];
+	}
+
+	return removed;
+}
+
+// a number as the VM sees it, either an integer or a float
+struct Number {
+	bool isint;
+	lua_Integer i;
+	lua_Number f;
+
+	inline lua_Number toFloat() const {
+		return isint ? (lua_Number)i : f;
+	}
+};
+
+// floats convert only when they have an exact integer value, like luaV_tointeger in the default build
+static bool toInteger(const Number &n, lua_Integer &out) {
+	if (n.isint) {
+		out = n.i;
+		return true;
+	}
+	if (std::floor(n.f) != n.f || !(n.f >= -9223372036854775808.0 && n.f < 9223372036854775808.0)) {
+		return false;
+	}
+	out = (lua_Integer)n.f;
+	return true;
+}
+
+static lua_Integer shiftLeft(lua_Integer x, lua_Integer y) {
+	if (y < 0) {
+		return y <= -64 ? 0 : (lua_Integer)((unsigned long long)x >> (0 - (unsigned long long)y));
+	}
+	return y >= 64 ? 0 : (lua_Integer)((unsigned long long)x << y);
+}
+
+// evaluates an operation the way the Lua 5.3 VM does. Like the reference compiler, nothing is
+// folded that raises an error or depends on the sign of zero: divisions by zero, NaN and float zero
+// results are left to run time. Integer arithmetic wraps around, bitwise operations need operands
+// with an integer value.
+static bool arith(OpCode op, const Number &x, const Number &y, Number &r) {
+	switch (op) {
+		case OP_BAND:
+		case OP_BOR:
+		case OP_BXOR:
+		case OP_SHL:
+		case OP_SHR:
+		case OP_BNOT: {
+			lua_Integer a, b;
+			if (!toInteger(x, a) || !toInteger(y, b)) {
+				return false;
+			}
+			r.isint = true;
+			switch (op) {
+				case OP_BAND:
+					r.i = a & b;
+					break;
+				case OP_BOR:
+					r.i = a | b;
+					break;
+				case OP_BXOR:
+					r.i = a ^ b;
+					break;
+				case OP_SHL:
+					r.i = shiftLeft(a, b);
+					break;
+				case OP_SHR:
+					r.i = shiftLeft(a, (lua_Integer)(0 - (unsigned long long)b));
+					break;
+				default:
+					r.i = ~a;
+					break;
+			}
+			return true;
+		}
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MUL:
+		case OP_MOD:
+		case OP_IDIV:
+		case OP_UNM:
+			if (x.isint && y.isint) {
+				unsigned long long a = x.i, b = y.i;
+				r.isint = true;
+				switch (op) {
+					case OP_ADD:
+						r.i = (lua_Integer)(a + b);
+						break;
+					case OP_SUB:
+						r.i = (lua_Integer)(a - b);
+						break;
+					case OP_MUL:
+						r.i = (lua_Integer)(a * b);
+						break;
+					case OP_MOD:
+						if (y.i == 0) {
+							return false;
+						}
+						if (y.i == -1) {
+							r.i = 0; // avoids the overflow of the minimum integer % -1
+						} else {
+							r.i = x.i % y.i;
+							if (r.i != 0 && (r.i ^ y.i) < 0) {
+								r.i += y.i;
+							}
+						}
+						break;
+					case OP_IDIV:
+						if (y.i == 0) {
+							return false;
+						}
+						if (y.i == -1) {
+							r.i = (lua_Integer)(0 - a);
+						} else {
+							r.i = x.i / y.i;
+							if (x.i % y.i != 0 && (x.i ^ y.i) < 0) {
+								r.i -= 1;
+							}
+						}
+						break;
+					default:
+						r.i = (lua_Integer)(0 - a);
+						break;
+				}
+				return true;
+			}
+			break;
+		default:
+			break;
+	}
+
+	lua_Number a = x.toFloat(), b = y.toFloat();
+	r.isint = false;
+	switch (op) {
+		case OP_ADD:
+			r.f = a + b;
+			break;
+		case OP_SUB:
+			r.f = a - b;
+			break;
+		case OP_MUL:
+			r.f = a * b;
+			break;
+		case OP_DIV:
+			if (b == 0) {
+				return false;
+			}
+			r.f = a / b;
+			break;
+		case OP_POW:
+			r.f = b == 2 ? a * a : std::pow(a, b);
+			break;
+		case OP_IDIV:
+			if (b == 0) {
+				return false;
+			}
+			r.f = std::floor(a / b);
+			break;
+		case OP_MOD:
+			if (b == 0) {
+				return false;
+			}
+			r.f = std::fmod(a, b);
+			if (r.f > 0 ? b < 0 : (r.f < 0 && b != r.f)) {
+				r.f += b;
+			}
+			break;
+		case OP_UNM:
+			r.f = -a;
+			break;
+		default:
+			return false;
+	}
+	return !std::isnan(r.f) && r.f != 0;
+}
+
+// the number a constant holds, if it is one
+static bool constantNumber(TValue &k, Number &out) {
+	if (k.type() == LUA_TNUMINT) {
+		out.isint = true;
+		out.i = reinterpret_cast<TInteger*>(&k)->integer();
+		return true;
+	}
+	if (k.type() == LUA_TNUMBER) {
+		out.isint = false;
+		out.f = reinterpret_cast<TNumber*>(&k)->number();
+		return true;
+	}
+	return false;
+}
+
+size_t Optimizer::foldConstants(ParsedFunction &function, const RegisterSet &escaping) {
+	std::vector<Instruction> &code = function.instructions;
+	CFG cfg(code);
+	ConstantPool pool(std::move(function.constants));
+	size_t changed = 0;
+
+	// numbers known to be in registers are tracked within each block. Captured registers can be
+	// changed by any call, so they are never known.
+	std::vector<Number> known(MAXREGS + 1);
+	RegisterSet isKnown;
+	auto number = [&](int rk, Number &out) -> bool {
+		if (ISK(rk)) {
+			return constantNumber(*pool[INDEXK(rk)], out);
+		}
+		out = known[rk];
+		return isKnown[rk];
+	};
+
+	for (size_t b = 0; b < cfg.size(); b++) {
+		const BasicBlock &block = cfg.block(b);
+		isKnown.reset();
+		for (int pc = block.start; pc < block.end; pc++) {
+			Instruction i = code[pc];
+			OpCode op = GET_OPCODE(i);
+			if (op == OP_EXTRAARG) {
+				continue;
+			}
+
+			Number x = {}, y = {}, r = {};
+			bool operands = false;
+			switch (op) {
+				case OP_ADD:
+				case OP_SUB:
+				case OP_MUL:
+				case OP_MOD:
+				case OP_POW:
+				case OP_DIV:
+				case OP_IDIV:
+				case OP_BAND:
+				case OP_BOR:
+				case OP_BXOR:
+				case OP_SHL:
+				case OP_SHR:
+					operands = number(GETARG_B(i), x) && number(GETARG_C(i), y);
+					break;
+				case OP_UNM:
+				case OP_BNOT:
+					operands = number(GETARG_B(i), x);
+					y.isint = true;
+					y.i = 0;
+					break;
+				default:
+					break;
+			}
+			if (operands && arith(op, x, y, r)) {
+				// the result must be loadable by loadk, and is only added to the table if it is
+				TValuePtr value = r.isint ? TValuePtr(new TInteger(r.i)) : TValuePtr(new TNumber(r.f));
+				size_t k = pool.find(*value);
+				if (k == ConstantPool::npos && pool.size() <= MAXARG_Bx) {
+					k = pool.add(value);
+				}
+				if (k <= MAXARG_Bx) {
+					i = code[pc] = CREATE_ABx(OP_LOADK, GETARG_A(i), k);
+					changed++;
+				}
+			}
+
+			bool copy = GET_OPCODE(i) == OP_MOVE && number(GETARG_B(i), x);
+			isKnown &= ~Liveness::effects(i).def;
+			int a = GETARG_A(i);
+			if (escaping[a]) {
+				continue;
+			}
+			if (GET_OPCODE(i) == OP_LOADK && constantNumber(*pool[GETARG_Bx(i)], known[a])) {
+				isKnown.set(a);
+			} else if (copy) {
+				known[a] = x;
+				isKnown.set(a);
+			}
+		}
+	}
+	function.constants = pool.take();
+	folded_ += changed;
+
+	// the loads that fed folded operations are usually dead now
+	return changed + removeDeadLoads(function, escaping);
+}
+
+size_t Optimizer::removeDeadLoads(ParsedFunction &function, const RegisterSet &escaping) {
+	std::vector<Instruction> &code = function.instructions;
+	CFG cfg(code);
+	Liveness liveness(code, cfg, escaping);
+	std::vector<RegisterSet> after = liveness.liveAfter();
+
+	std::vector<char> remove(code.size(), 0);
+	size_t removed = 0;
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		if (GET_OPCODE(code[pc]) == OP_LOADK && !after[pc][GETARG_A(code[pc])] && !(pc > 0 && CFG::skips(code[pc - 1]))) {
+			remove[pc] = 1;
+			removed++;
+		}
+	}
+	if (removed) {
+		removeInstructions(function, remove);
+	}
+	return removed;
+}
+
+// calls f(index, rk) for every constant reference and stores the index it returns
+template<typename F>
+static void constantRefs(std::vector<Instruction> &code, F f) {
+	for (size_t pc = 0; pc < code.size(); pc++) {
+		Instruction &i = code[pc];
+		OpCode op = GET_OPCODE(i);
+		if (op == OP_LOADK) {
+			SETARG_Bx(i, f(GETARG_Bx(i), false));
+		} else if (op == OP_LOADKX && pc + 1 < code.size()) {
+			SETARG_Ax(code[pc + 1], f(GETARG_Ax(code[pc + 1]), false));
+			pc++;
+		} else if (getOpMode(op) == iABC) {
+			if (getBMode(op) == OpArgK && ISK(GETARG_B(i))) {
+				SETARG_B(i, RKASK(f(INDEXK(GETARG_B(i)), true)));
+			}
+			if (getCMode(op) == OpArgK && ISK(GETARG_C(i))) {
+				SETARG_C(i, RKASK(f(INDEXK(GETARG_C(i)), true)));
+			}
+		}
+	}
+}
+
+size_t Optimizer::optimizeConstants(ParsedFunction &function, const RegisterSet &escaping) {
+	std::vector<Instruction> &code = function.instructions;
+	std::vector<TValuePtr> &constants = function.constants;
+	size_t nk = constants.size();
+
+	std::vector<size_t> rkUses(nk, 0), uses(nk, 0);
+	constantRefs(code, [&](int k, bool rk) {
+		if ((size_t)k < nk) {
+			uses[k]++;
+			rkUses[k] += rk;
+		}
+		return k;
+	});
+
+	// constants used as RK operands first, since only the first MAXINDEXRK + 1 can be, then by use
+	// count. Ties keep their order, so an already ordered table is left as it is.
+	std::vector<size_t> order;
+	for (size_t k = 0; k < nk; k++) {
+		if (uses[k]) {
+			order.push_back(k);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		return rkUses[a] != rkUses[b] ? rkUses[a] > rkUses[b] : uses[a] > uses[b];
+	});
+
+	std::vector<int> index(nk, -1);
+	std::vector<TValuePtr> sorted;
+	for (size_t k : order) {
+		index[k] = (int)sorted.size();
+		sorted.push_back(constants[k]);
+	}
+
+	// every reference must stay encodable in its operand, otherwise the table is left as it is
+	for (size_t k = 0; k < nk; k++) {
+		if (rkUses[k] && index[k] > MAXINDEXRK) {
+			return 0;
+		}
+	}
+	for (Instruction i : code) {
+		if (GET_OPCODE(i) == OP_LOADK && (size_t)GETARG_Bx(i) < nk && index[GETARG_Bx(i)] > MAXARG_Bx) {
+			return 0;
+		}
+	}
+
+	dropped_ += nk - sorted.size();
+	constants.swap(sorted);
+	constantRefs(code, [&](int k, bool) {
+		return (size_t)k < nk ? index[k] : k;
+	});
+
+	// loadkx is only needed for indices loadk cannot encode
+	std::vector<char> remove(code.size(), 0);
+	size_t removed = 0;
+	for (size_t pc = 0; pc + 1 < code.size(); pc++) {
+		if (GET_OPCODE(code[pc]) == OP_LOADKX && GET_OPCODE(code[pc + 1]) == OP_EXTRAARG && GETARG_Ax(code[pc + 1]) <= MAXARG_Bx) {
+			code[pc] = CREATE_ABx(OP_LOADK, GETARG_A(code[pc]), GETARG_Ax(code[pc + 1]));
+			remove[++pc] = 1;
+			removed++;
+		}
+	}
+	if (removed) {
+		removeInstructions(function, remove);
+	}
+
+	// constants that can now be RK operands are used directly instead of through their loadk
+	CFG cfg(code);
+	for (size_t b = 0; b < cfg.size(); b++) {
+		const BasicBlock &block = cfg.block(b);
+		for (int pc = block.start; pc < block.end; pc++) {
+			Instruction load = code[pc];
+			int r = GETARG_A(load);
+			if (GET_OPCODE(load) != OP_LOADK || GETARG_Bx(load) > MAXINDEXRK || escaping[r]) {
+				continue;
+			}
+			int k = RKASK(GETARG_Bx(load));
+			for (int j = pc + 1; j < block.end; j++) {
+				Instruction &i = code[j];
+				OpCode op = GET_OPCODE(i);
+				if (op == OP_EXTRAARG) {
+					continue;
+				}
+				if (getOpMode(op) == iABC && getBMode(op) == OpArgK && GETARG_B(i) == r) {
+					SETARG_B(i, k);
+				}
+				if (getOpMode(op) == iABC && getCMode(op) == OpArgK && GETARG_C(i) == r) {
+					SETARG_C(i, k);
+				}
+				RegisterEffects e = Liveness::effects(i);
+				if (e.use[r] || e.def[r]) {
+					break;
+				}
+			}
+		}
+	}
+
+	return removed + removeDeadLoads(function, escaping);
+}
+
+size_t Optimizer::runPass(Pass pass, ParsedFunction &function, const RegisterSet &escaping) {
+	switch (pass) {
+		case OPT_UNREACHABLE:
+			return removeUnreachable(function);
+		case OPT_FOLD:
+			return foldConstants(function, escaping);
+		case OPT_COALESCE:
+			return propagateCopies(function, escaping) + coalesceMoves(function, escaping);
+		case OPT_PEEPHOLE:
+			return peephole(function, escaping);
+		case OPT_LAYOUT:
+			return layoutBlocks(function);
+		case OPT_CONSTANTS:
+			return optimizeConstants(function, escaping);
+		default:
+			return 0;
+	}
+}
+
+Util::BoolRes Optimizer::run(ParsedFunction &function, const std::vector<ParsedFunctionPtr> &protos) {
+	// registers captured by closures are shared with the closure and must keep their place
+	RegisterSet escaping;
+	for (const ParsedFunctionPtr &proto : protos) {
+		for (const Upvalue &upvalue : proto->upvalues) {
+			if (upvalue.instack) {
+				escaping.set(upvalue.idx);
+			}
+		}
+	}
+
+	size_t before = function.instructions.size();
+	size_t saved[NUM_PASSES] = {};
+	dropped_ = 0;
+	folded_ = 0;
+
+	// passes can open opportunities for each other, so run them until nothing changes. Only the
+	// instructions a pass removed count as saved, a fold replaces one.
+	size_t n;
+	do {
+		n = 0;
+		for (size_t p = 0; p < NUM_PASSES; p++) {
+			if (passes_ & passNames[p].pass) {
+				size_t size = function.instructions.size();
+				n += runPass((Pass)passNames[p].pass, function, escaping);
+				saved[p] += size - function.instructions.size();
+			}
+		}
+	} while (n > 0);
+
+	if (function.instructions.size() != before || dropped_ || folded_) {
+		std::string line = function.name + ": " + std::to_string(before) + " -> " + std::to_string(function.instructions.size()) + " instructions (";
+		const char *sep = "";
+		for (size_t p = 0; p < NUM_PASSES; p++) {
+			if (passes_ & passNames[p].pass) {
+				line += sep + std::string(passNames[p].name) + " " + std::to_string(saved[p]);
+				sep = ", ";
+			}
+		}
+		line += ")";
+		if (folded_) {
+			line += ", " + std::to_string(folded_) + " operations folded";
+		}
+		if (dropped_) {
+			line += ", " + std::to_string(dropped_) + " unused constants removed";
+		}
+		report_.push_back(line);
+	}
+
+	return Util::BoolRes(true, "");
+}
@@ -0,0 +1,60 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <string>
+#include <vector>
+
+#include "Assembler.h"
+#include "Liveness.h"
+#include "util.h"
+
+// Optional rewrites of assembled functions, run after every function has been parsed and before
+// anything is written. Passes only ever remove instructions or rename registers, so the register
+// layout that calls, returns and loops depend on is left alone.
+class Optimizer {
+public:
+	enum Pass {
+		OPT_COALESCE = 1 << 0, // copy propagation and move coalescing
+		OPT_PEEPHOLE = 1 << 1, // jump threading and local instruction merging
+		OPT_UNREACHABLE = 1 << 2, // removal of blocks that cannot be reached from the entry
+		OPT_LAYOUT = 1 << 3, // block reordering so that jumps become fall-throughs
+		OPT_FOLD = 1 << 4, // constant folding of arithmetic on known numbers
+		OPT_CONSTANTS = 1 << 5, // constant table ordering by use and removal of unused constants
+		OPT_ALL = OPT_COALESCE | OPT_PEEPHOLE | OPT_UNREACHABLE | OPT_LAYOUT | OPT_FOLD | OPT_CONSTANTS
+	};
+
+	Optimizer(unsigned int passes);
+
+	// protos are the functions created by the closures of function, in closure index order
+	Util::BoolRes run(ParsedFunction &function, const std::vector<ParsedFunctionPtr> &protos);
+
+	// one line per function that was changed
+	inline const std::vector<std::string> &report() const {
+		return report_;
+	}
+
+	// parses a comma separated list of pass names, "all" enables every pass
+	static bool parsePasses(const std::string &list, unsigned int &passes);
+
+	// removes the marked instructions, retargeting jumps (a jump to a removed instruction lands on the
+	// next remaining one) and keeping lineinfo and pending closure fixups in sync
+	static void removeInstructions(ParsedFunction &function, const std::vector<char> &remove);
+
+private:
+	size_t runPass(Pass pass, ParsedFunction &function, const RegisterSet &escaping);
+	size_t removeUnreachable(ParsedFunction &function);
+	size_t layoutBlocks(ParsedFunction &function);
+	size_t foldConstants(ParsedFunction &function, const RegisterSet &escaping);
+	size_t optimizeConstants(ParsedFunction &function, const RegisterSet &escaping);
+	size_t removeDeadLoads(ParsedFunction &function, const RegisterSet &escaping);
+	size_t propagateCopies(ParsedFunction &function, const RegisterSet &escaping);
+	size_t coalesceMoves(ParsedFunction &function, const RegisterSet &escaping);
+	size_t peephole(ParsedFunction &function, const RegisterSet &escaping);
+
+	unsigned int passes_;
+	size_t dropped_; // constants removed from the current function
+	size_t folded_; // operations of the current function replaced by a loadk
+	std::vector<std::string> report_;
+};
+
+#endif
@@ -2,23 +2,43 @@
 #include "lconfig.h"
 #include "Function.h"
 
-#define CHK_ASSERT(f, msg) if (!f) return Util::BoolRes(false, msg);
+#define CHK_ASSERT(f, msg) if (!(f)) return Util::BoolRes(false, msg);
 
-Parser::Parser(Buffer *buffer) : buffer_(buffer), labels_(0) {
+Parser::Parser(Buffer *buffer) : labels_(0), numUpvalues_(0), buffer_(buffer), stats_(nullptr), strip_(STRIP_NONE), verify_(true), text_(true) {
 
 }
 
 Util::BoolRes Parser::parseHeader() {
+	Stats::Scope scope(stats_, Stats::HEADER);
 	CHK_ASSERT(checkLiteral(LUA_SIGNATURE), "signature check failed");
 	CHK_ASSERT(checkByte(LUAC_VERSION), "version check failed");
 	CHK_ASSERT(checkByte(LUAC_FORMAT), "format check failed");
 	CHK_ASSERT(checkLiteral(LUAC_DATA), "corrupted");
-	CHK_ASSERT(checkByte(sizeof(int)), "int size check failed");
-	CHK_ASSERT(checkByte(sizeof(size_t)), "size_t size check failed");
-	CHK_ASSERT(checkByte(sizeof(Instruction)), "Instruction size check failed");
-	CHK_ASSERT(checkByte(sizeof(lua_Integer)), "lua_Integer size check failed");
-	CHK_ASSERT(checkByte(sizeof(lua_Number)), "lua_Number size check failed");
-	CHK_ASSERT(checkInteger(LUAC_INT), "endianness mismatch");
+
+	ChunkFormat format;
+	CHK_ASSERT(buffer_->read(format.intSize).success(), "int size check failed");
+	CHK_ASSERT(buffer_->read(format.sizetSize).success(), "size_t size check failed");
+	CHK_ASSERT(buffer_->read(format.instructionSize).success(), "Instruction size check failed");
+	CHK_ASSERT(buffer_->read(format.integerSize).success(), "lua_Integer size check failed");
+	CHK_ASSERT(buffer_->read(format.numberSize).success(), "lua_Number size check failed");
+	std::string why = format.unsupported();
+	if (!why.empty()) {
+		return Util::BoolRes(false, why);
+	}
+
+	// the byte order is the one in which LUAC_INT reads back
+	unsigned char bytes[8];
+	CHK_ASSERT(buffer_->read(reinterpret_cast<char*>(bytes), format.integerSize) == format.integerSize, "endianness mismatch");
+	unsigned long long little = 0, big = 0;
+	for (int i = 0; i < format.integerSize; i++) {
+		little |= (unsigned long long)bytes[i] << (8 * i);
+		big = (big << 8) | bytes[i];
+	}
+	CHK_ASSERT((little == LUAC_INT || big == LUAC_INT), "endianness mismatch");
+	format.bigEndian = little != LUAC_INT;
+
+	reader_ = ChunkReader::create(format, buffer_);
+	CHK_ASSERT(reader_, "unsupported chunk format " + format.str());
 	CHK_ASSERT(checkNumber(LUAC_NUM), "float format mismatch");
 
 	return Util::BoolRes(true, "");
@@ -33,19 +53,18 @@ Util::BoolRes Parser::parse(std::string &out) {
 		return res;
 	}
 
-	unsigned char numUpvalues;
-	res = buffer_->read(numUpvalues);
+	res = buffer_->read(numUpvalues_);
 	if (!res.success()) {
 		return res;
 	}
 
-	Function func(this, buffer_);
-	res = func.loadFunction();
+	main_.reset(new Function(this, buffer_));
+	res = main_->loadFunction();
 	if (!res.success()) {
 		return res;
 	}
 
-	out = std::string(".upvalues ") + std::to_string(numUpvalues) + "\n\n" + func.disas();
+	out = std::string(".upvalues ") + std::to_string(numUpvalues_) + "\n\n" + main_->disas();
 
 	return res;
 }
\ No newline at end of file
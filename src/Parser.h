@@ -3,6 +3,9 @@
 
 #include "Buffer.h"
 #include "lconfig.h"
+#include "Function.h"
+#include "Stats.h"
+#include "ChunkFormat.h"
 #include <utility>
 #include <cstring>
 #include <vector>
@@ -19,6 +22,59 @@ public:
 		return std::string("subroutine_") + std::to_string(labels_);
 	}
 
+	inline void setStats(Stats *stats) {
+		stats_ = stats;
+	}
+
+	inline Stats *stats() {
+		return stats_;
+	}
+
+	// debug information beyond the level is skipped instead of being kept in the functions
+	inline void setStrip(StripLevel strip) {
+		strip_ = strip;
+	}
+
+	inline StripLevel strip() {
+		return strip_;
+	}
+
+	// every prototype is verified before it is disassembled unless this is turned off
+	inline void setVerify(bool verify) {
+		verify_ = verify;
+	}
+
+	inline bool verify() {
+		return verify_;
+	}
+
+	// without the text, parse() only loads the functions, for the exports that read them directly
+	inline void setText(bool text) {
+		text_ = text;
+	}
+
+	inline bool text() {
+		return text_;
+	}
+
+	inline unsigned char numUpvalues() {
+		return numUpvalues_;
+	}
+
+	// fixed size fields are read through this, in the format announced by the header
+	inline ChunkReader &reader() {
+		return *reader_;
+	}
+
+	inline const ChunkFormat &format() {
+		return reader_->format();
+	}
+
+	// the main function of the last successful parse(), kept for structural inspection
+	inline FunctionPtr mainFunction() {
+		return main_;
+	}
+
 private:
 	Util::BoolRes parseHeader();
 
@@ -38,23 +94,23 @@ private:
 		return buffer_->read(b).success() && byte == b;
 	}
 
-	inline bool checkInteger(lua_Integer n) {
-		lua_Integer num;
-		buffer_->read(num);
-		return num == n;
-	}
-
 	inline bool checkNumber(lua_Number n) {
 		lua_Number num;
-		buffer_->read(num);
-		return num == n;
+		return reader_->readNumber(num).success() && num == n;
 	}
 
 	unsigned int labels_;
+	unsigned char numUpvalues_;
 
 	Util::BoolRes loadString(std::string &out);
 
 	BufferPtr buffer_;
+	std::unique_ptr<ChunkReader> reader_;
+	FunctionPtr main_;
+	Stats *stats_;
+	StripLevel strip_;
+	bool verify_;
+	bool text_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include "PerfCounters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+
+static int openCounter(uint32_t type, uint64_t config) {
+	perf_event_attr attr;
+	std::memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.inherit = 1; // threads started later count too, added in when they exit
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	return fd;
+}
+
+PerfCounters::PerfCounters() {
+	fds_[CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	fds_[INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	fds_[BRANCH_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	fds_[L1D_MISSES] = openCounter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+	fds_[LLC_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	reset();
+}
+
+PerfCounters::~PerfCounters() {
+	for (int i = 0; i < NUM_EVENTS; i++) {
+		if (fds_[i] >= 0) {
+			close(fds_[i]);
+		}
+	}
+}
+
+uint64_t PerfCounters::read(Event event) {
+	if (fds_[event] < 0) {
+		return 0;
+	}
+
+	uint64_t data[3]; // value, time enabled, time running
+	if (::read(fds_[event], data, sizeof(data)) != sizeof(data)) {
+		return 0;
+	}
+	if (data[2] != 0 && data[2] < data[1]) { // the counter was multiplexed, scale it up
+		return (uint64_t)((double)data[0] * data[1] / data[2]);
+	}
+	return data[0];
+}
+
+#else
+
+PerfCounters::PerfCounters() {
+	for (int i = 0; i < NUM_EVENTS; i++) {
+		fds_[i] = -1;
+	}
+	reset();
+}
+
+PerfCounters::~PerfCounters() {
+
+}
+
+uint64_t PerfCounters::read(Event event) {
+	return 0;
+}
+
+#endif
+
+bool PerfCounters::available() const {
+	for (int i = 0; i < NUM_EVENTS; i++) {
+		if (fds_[i] >= 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void PerfCounters::start() {
+	for (int i = 0; i < NUM_EVENTS; i++) {
+		marks_[i] = read((Event)i);
+	}
+}
+
+void PerfCounters::stop() {
+	for (int i = 0; i < NUM_EVENTS; i++) {
+		values_[i] += read((Event)i) - marks_[i];
+	}
+}
+
+void PerfCounters::reset() {
+	for (int i = 0; i < NUM_EVENTS; i++) {
+		values_[i] = marks_[i] = 0;
+	}
+}
+
+const char *PerfCounters::eventName(Event event) {
+	static const char *names[NUM_EVENTS] = {
+		"cycles",
+		"instructions",
+		"branch-misses",
+		"L1d-misses",
+		"LLC-misses"
+	};
+	return names[event];
+}
@@ -0,0 +1,51 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <stdint.h>
+
+// Hardware performance counters of the calling thread and of the threads it starts afterwards (such
+// as the assembler workers, counted once they are joined), read through perf_event_open on Linux.
+// Counters that cannot be opened (other platforms, missing PMU, perf_event_paranoid) are reported as
+// unavailable instead of failing.
+class PerfCounters {
+public:
+	enum Event {
+		CYCLES,
+		INSTRUCTIONS,
+		BRANCH_MISSES,
+		L1D_MISSES,
+		LLC_MISSES,
+		NUM_EVENTS
+	};
+
+	PerfCounters();
+	~PerfCounters();
+
+	bool available() const; // true if at least one counter could be opened
+	inline bool available(Event event) const {
+		return fds_[event] >= 0;
+	}
+
+	// accumulate the counts between start() and stop()
+	void start();
+	void stop();
+	void reset();
+
+	inline uint64_t value(Event event) const {
+		return values_[event];
+	}
+
+	static const char *eventName(Event event);
+
+private:
+	PerfCounters(const PerfCounters &) = delete;
+	PerfCounters &operator=(const PerfCounters &) = delete;
+
+	uint64_t read(Event event);
+
+	int fds_[NUM_EVENTS];
+	uint64_t values_[NUM_EVENTS];
+	uint64_t marks_[NUM_EVENTS];
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include "RoundTrip.h"
+#include "Parser.h"
+#include "Assembler.h"
+#include "StringBuffer.h"
+#include "StringWriteBuffer.h"
+#include "opcodes.h"
+
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// Floats by bit pattern: NaN has to match NaN, and -0.0 must not match 0.0.
+static bool sameConstant(TValue &expected, TValue &actual) {
+	if (expected.type() != actual.type()) {
+		return false;
+	}
+	if (expected.type() == LUA_TNUMFLT) {
+		lua_Number e = static_cast<TNumber&>(expected).number();
+		lua_Number a = static_cast<TNumber&>(actual).number();
+		uint64_t ebits, abits;
+		static_assert(sizeof(lua_Number) == sizeof(uint64_t), "lua_Number is not a double");
+		std::memcpy(&ebits, &e, sizeof(ebits));
+		std::memcpy(&abits, &a, sizeof(abits));
+		return ebits == abits;
+	}
+	return expected == actual;
+}
+
+static std::string describe(Instruction i) {
+	OpCode op = GET_OPCODE(i);
+	if (op >= NUM_OPCODES) {
+		return std::string("<invalid opcode ") + std::to_string((int)op) + ">";
+	}
+
+	std::string s = luaP_opnames[op];
+	switch (getOpMode(op)) {
+		case iABC:
+			s += " A=" + std::to_string(GETARG_A(i)) + " B=" + std::to_string(GETARG_B(i)) + " C=" + std::to_string(GETARG_C(i));
+			break;
+		case iABx:
+			s += " A=" + std::to_string(GETARG_A(i)) + " Bx=" + std::to_string(GETARG_Bx(i));
+			break;
+		case iAsBx:
+			s += " A=" + std::to_string(GETARG_A(i)) + " sBx=" + std::to_string(GETARG_sBx(i));
+			break;
+		case iAx:
+			s += " Ax=" + std::to_string(GETARG_Ax(i));
+			break;
+	}
+	return s;
+}
+
+RoundTrip::RoundTrip(unsigned int threads) : threads_(threads) {
+	if (threads_ == 0) {
+		threads_ = std::max(1u, std::thread::hardware_concurrency());
+	}
+}
+
+Util::BoolRes RoundTrip::compare(const FunctionPtr &expected, const FunctionPtr &actual, size_t &prototypes) {
+	std::string name = expected->label() + ": ";
+	prototypes++;
+
+	if (expected->numParams() != actual->numParams()) {
+		return Util::BoolRes(false, name + "params differ (" + std::to_string(expected->numParams()) + " vs " + std::to_string(actual->numParams()) + ")");
+	}
+	if (expected->isVarArg() != actual->isVarArg()) {
+		return Util::BoolRes(false, name + "vararg differs (" + std::to_string(expected->isVarArg()) + " vs " + std::to_string(actual->isVarArg()) + ")");
+	}
+	if (expected->maxStackSize() != actual->maxStackSize()) {
+		return Util::BoolRes(false, name + "maxstacksize differs (" + std::to_string(expected->maxStackSize()) + " vs " + std::to_string(actual->maxStackSize()) + ")");
+	}
+
+	const std::vector<Instruction> &ecode = expected->code();
+	const std::vector<Instruction> &acode = actual->code();
+	size_t n = std::min(ecode.size(), acode.size());
+	for (size_t pc = 0; pc < n; pc++) {
+		if (ecode[pc] != acode[pc]) {
+			return Util::BoolRes(false, name + "first divergent instruction at pc " + std::to_string(pc) + ": expected " + describe(ecode[pc]) + ", got " + describe(acode[pc]));
+		}
+	}
+	if (ecode.size() != acode.size()) {
+		return Util::BoolRes(false, name + "code length differs (" + std::to_string(ecode.size()) + " vs " + std::to_string(acode.size()) + "), first divergence at pc " + std::to_string(n));
+	}
+
+	const std::vector<TValuePtr> &econst = expected->constants();
+	const std::vector<TValuePtr> &aconst = actual->constants();
+	if (econst.size() != aconst.size()) {
+		return Util::BoolRes(false, name + "constant count differs (" + std::to_string(econst.size()) + " vs " + std::to_string(aconst.size()) + ")");
+	}
+	for (size_t i = 0; i < econst.size(); i++) {
+		if (!sameConstant(*econst[i], *aconst[i])) {
+			return Util::BoolRes(false, name + "constant " + std::to_string(i) + " differs: expected " + econst[i]->str() + ", got " + aconst[i]->str());
+		}
+	}
+
+	const std::vector<Upvalue> &eup = expected->upvalues();
+	const std::vector<Upvalue> &aup = actual->upvalues();
+	if (eup.size() != aup.size()) {
+		return Util::BoolRes(false, name + "upvalue count differs (" + std::to_string(eup.size()) + " vs " + std::to_string(aup.size()) + ")");
+	}
+	for (size_t i = 0; i < eup.size(); i++) {
+		if (eup[i].instack != aup[i].instack || eup[i].idx != aup[i].idx) {
+			return Util::BoolRes(false, name + "upvalue " + std::to_string(i) + " differs");
+		}
+	}
+
+	const std::vector<FunctionPtr> &eprotos = expected->protos();
+	const std::vector<FunctionPtr> &aprotos = actual->protos();
+	if (eprotos.size() != aprotos.size()) {
+		return Util::BoolRes(false, name + "proto count differs (" + std::to_string(eprotos.size()) + " vs " + std::to_string(aprotos.size()) + ")");
+	}
+	for (size_t i = 0; i < eprotos.size(); i++) {
+		auto res = compare(eprotos[i], aprotos[i], prototypes);
+		if (!res.success()) {
+			return res;
+		}
+	}
+
+	return Util::BoolRes(true, "");
+}
+
+Util::BoolRes RoundTrip::verify(const std::string &dump, size_t *prototypes, Trace *trace, size_t thread) {
+	Parser original(new StringBuffer(dump));
+	std::string luas;
+	Util::BoolRes res;
+	{
+		Trace::Span span(trace, thread, "disassemble");
+		res = original.parse(luas);
+	}
+	if (!res.success()) {
+		return Util::BoolRes(false, "disassembly failed: " + res.error_msg());
+	}
+
+	std::string chunk;
+	{
+		Trace::Span span(trace, thread, "assemble");
+		Assembler assembler(new StringBuffer(std::move(luas)), WriteBufferPtr(new StringWriteBuffer(chunk)));
+		res = assembler.assemble();
+	}
+	if (!res.success()) {
+		return Util::BoolRes(false, "reassembly failed: " + res.error_msg());
+	}
+
+	Parser reassembled(new StringBuffer(std::move(chunk)));
+	{
+		Trace::Span span(trace, thread, "reload");
+		std::string unused;
+		res = reassembled.parse(unused);
+	}
+	if (!res.success()) {
+		return Util::BoolRes(false, "reassembled chunk is unreadable: " + res.error_msg());
+	}
+
+	Trace::Span span(trace, thread, "compare");
+	size_t count = 0;
+	res = compare(original.mainFunction(), reassembled.mainFunction(), count);
+	if (prototypes != nullptr) {
+		*prototypes = count;
+	}
+	return res;
+}
+
+std::vector<RoundTripResult> RoundTrip::run(const std::vector<std::string> &files, Trace *trace) {
+	std::vector<RoundTripResult> results(files.size());
+	std::atomic<size_t> next(0);
+
+	auto worker = [&](size_t thread) {
+		size_t i;
+		while ((i = next++) < files.size()) {
+			if (trace) {
+				trace->counter(thread, "queue depth", files.size() - i - 1);
+			}
+
+			RoundTripResult &r = results[i];
+			r.file = files[i];
+			r.prototypes = 0;
+			r.bytes = 0;
+
+			auto start = std::chrono::steady_clock::now();
+			Trace::Span span(trace, thread, files[i].c_str());
+
+			std::string dump;
+			bool read;
+			{
+				Trace::Span span(trace, thread, "read");
+				read = Util::readFile(files[i], dump);
+			}
+			if (!read) {
+				r.result = Util::BoolRes(false, "could not open file");
+			} else {
+				r.bytes = dump.size();
+				r.result = verify(dump, &r.prototypes, trace, thread);
+			}
+
+			r.duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+	};
+
+	size_t threads = std::min<size_t>(threads_, files.size());
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < threads; i++) {
+		pool.emplace_back(worker, i);
+	}
+	worker(0);
+	for (auto &t : pool) {
+		t.join();
+	}
+
+	return results;
+}
@@ -0,0 +1,38 @@
+#ifndef ROUNDTRIP_H
+#define ROUNDTRIP_H
+
+#include "lconfig.h"
+#include "Function.h"
+#include "Trace.h"
+#include <string>
+#include <vector>
+
+struct RoundTripResult {
+	std::string file;
+	Util::BoolRes result;
+	size_t prototypes;
+	size_t bytes;
+	uint64_t duration; // microseconds
+};
+
+class RoundTrip {
+public:
+	RoundTrip(unsigned int threads = 0); // 0 uses one thread per hardware thread
+
+	// disassembles and reassembles a dump in memory, then compares both chunks prototype by prototype.
+	// If a trace is given, the phases are recorded as spans on the given worker thread
+	static Util::BoolRes verify(const std::string &dump, size_t *prototypes = nullptr, Trace *trace = nullptr, size_t thread = 0);
+
+	std::vector<RoundTripResult> run(const std::vector<std::string> &files, Trace *trace = nullptr);
+
+	inline unsigned int threads() {
+		return threads_;
+	}
+
+private:
+	static Util::BoolRes compare(const FunctionPtr &expected, const FunctionPtr &actual, size_t &prototypes);
+
+	unsigned int threads_;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "Simd.h"
+
+#ifdef SIMD_X86
+static bool hasAVX2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0; // the OS saving ymm state is assumed, as on any AVX2 capable Windows
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+static bool hasSSE2() {
+#if defined(_MSC_VER) || defined(__x86_64__)
+	return true; // part of the x86-64 baseline
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2") != 0;
+#endif
+}
+#endif
+
+// function statics, so that kernels picked during static initialization of other files see them
+bool Simd::avx2() {
+#ifdef SIMD_X86
+	static const bool supported = hasAVX2();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+bool Simd::sse2() {
+#ifdef SIMD_X86
+	static const bool supported = hasSSE2();
+	return supported;
+#else
+	return false;
+#endif
+}
+
+const char *Simd::kernel() {
+	if (avx2()) {
+		return "avx2";
+	}
+	if (sse2()) {
+		return "sse2";
+	}
+	return "scalar";
+}
@@ -0,0 +1,48 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Shared by the vectorized kernels: SIMD_X86 is defined where the SSE2 and AVX2 intrinsics can be
+// compiled, and the kernels are marked with SSE2_TARGET / AVX2_TARGET so that the rest of the build
+// keeps the baseline instruction set. Which kernel runs is decided once at run time.
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SIMD_X86
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#include <immintrin.h>
+#define SIMD_X86
+#define SSE2_TARGET
+#define AVX2_TARGET
+#endif
+
+namespace Simd {
+	bool avx2();
+	bool sse2();
+
+	// "avx2", "sse2" or "scalar"
+	const char *kernel();
+
+	// index of the lowest set bit, bits must not be 0
+	inline unsigned int lowestBit(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+		return (unsigned int)__builtin_ctzll(bits);
+#elif defined(_MSC_VER) && defined(_M_X64)
+		unsigned long i;
+		_BitScanForward64(&i, bits);
+		return (unsigned int)i;
+#else
+		unsigned int i = 0;
+		for (; !(bits & 1); bits >>= 1) {
+			i++;
+		}
+		return i;
+#endif
+	}
+}
+
+#endif
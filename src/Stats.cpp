@@ -0,0 +1,109 @@
+#include "Stats.h"
+#include "AllocStats.h"
+
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+
+Stats::Stats() : current_(NONE), wallMark_(0), cpuMark_(0) {
+	for (int i = 0; i < NUM_PHASES; i++) {
+		wall_[i] = cpu_[i] = 0;
+	}
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		counters_[i] = 0;
+	}
+}
+
+uint64_t Stats::wallClock() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+uint64_t Stats::cpuClock() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#else
+	return (uint64_t)std::clock() * (1000000000ull / CLOCKS_PER_SEC);
+#endif
+}
+
+Stats::Phase Stats::enter(Phase phase) {
+	uint64_t wall = wallClock();
+	uint64_t cpu = cpuClock();
+	if (current_ != NONE) {
+		wall_[current_] += wall - wallMark_;
+		cpu_[current_] += cpu - cpuMark_;
+	}
+	wallMark_ = wall;
+	cpuMark_ = cpu;
+
+	Phase previous = current_;
+	current_ = phase;
+	AllocStats::setPhase(phase);
+	return previous;
+}
+
+void Stats::merge(const Stats &other) {
+	for (int i = 0; i < NUM_PHASES; i++) {
+		wall_[i] += other.wall_[i];
+		cpu_[i] += other.cpu_[i];
+	}
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		counters_[i] += other.counters_[i];
+	}
+}
+
+const char *Stats::phaseName(Phase phase) {
+	static const char *names[NUM_PHASES] = {
+		"read",
+		"header",
+		"code",
+		"constants",
+		"upvalues",
+		"protos",
+		"debug",
+		"verify",
+		"formatting",
+		"optimize",
+		"write"
+	};
+	return phase < NUM_PHASES ? names[phase] : "none";
+}
+
+const char *Stats::counterName(Counter counter) {
+	static const char *names[NUM_COUNTERS] = {
+		"bytes in",
+		"bytes out",
+		"prototypes",
+		"instructions",
+		"constants",
+		"string bytes",
+		"jump labels",
+		"dedup hits"
+	};
+	return names[counter];
+}
+
+std::string Stats::report() const {
+	std::string out;
+	char line[128];
+
+	uint64_t wallTotal = 0, cpuTotal = 0;
+	std::snprintf(line, sizeof(line), "%-12s %12s %12s\n", "phase", "wall ms", "cpu ms");
+	out += line;
+	for (int i = 0; i < NUM_PHASES; i++) {
+		std::snprintf(line, sizeof(line), "%-12s %12.3f %12.3f\n", phaseName((Phase)i), wall_[i] / 1e6, cpu_[i] / 1e6);
+		out += line;
+		wallTotal += wall_[i];
+		cpuTotal += cpu_[i];
+	}
+	std::snprintf(line, sizeof(line), "%-12s %12.3f %12.3f\n\n", "total", wallTotal / 1e6, cpuTotal / 1e6);
+	out += line;
+
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		std::snprintf(line, sizeof(line), "%-12s %12llu\n", counterName((Counter)i), (unsigned long long)counters_[i]);
+		out += line;
+	}
+	return out;
+}
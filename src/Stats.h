@@ -0,0 +1,99 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <stdint.h>
+
+// Per-phase timings and counters. Everything that collects statistics takes a Stats pointer that is
+// null when collection is disabled, so a disabled run only pays for a null check.
+class Stats {
+public:
+	enum Phase {
+		READ,
+		HEADER,
+		CODE,
+		CONSTANTS,
+		UPVALUES,
+		PROTOS,
+		DEBUG,
+		VERIFY,
+		FORMAT,
+		OPTIMIZE,
+		WRITE,
+		NUM_PHASES,
+		NONE = NUM_PHASES
+	};
+
+	enum Counter {
+		BYTES_IN,
+		BYTES_OUT,
+		PROTOTYPES,
+		INSTRUCTIONS,
+		CONSTANTS_COUNT,
+		STRING_BYTES,
+		LABELS, // jump targets
+		DEDUP_HITS,
+		NUM_COUNTERS
+	};
+
+	// times a phase for the lifetime of the scope. Phases are exclusive: entering a nested phase
+	// pauses the enclosing one, so the per-phase times add up to the total.
+	class Scope {
+	public:
+		inline Scope(Stats *stats, Phase phase) : stats_(stats), previous_(NONE) {
+			if (stats_) {
+				previous_ = stats_->enter(phase);
+			}
+		}
+		inline ~Scope() {
+			if (stats_) {
+				stats_->enter(previous_);
+			}
+		}
+	private:
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+
+		Stats *stats_;
+		Phase previous_;
+	};
+
+	Stats();
+
+	inline void count(Counter counter, uint64_t n = 1) {
+		counters_[counter] += n;
+	}
+
+	inline uint64_t counter(Counter counter) const {
+		return counters_[counter];
+	}
+
+	// accumulated times in nanoseconds
+	inline uint64_t wallTime(Phase phase) const {
+		return wall_[phase];
+	}
+	inline uint64_t cpuTime(Phase phase) const {
+		return cpu_[phase];
+	}
+
+	void merge(const Stats &other);
+	std::string report() const;
+
+	static const char *phaseName(Phase phase);
+	static const char *counterName(Counter counter);
+
+private:
+	Phase enter(Phase phase); // returns the phase that was active before
+
+	static uint64_t wallClock();
+	static uint64_t cpuClock();
+
+	uint64_t wall_[NUM_PHASES];
+	uint64_t cpu_[NUM_PHASES];
+	uint64_t counters_[NUM_COUNTERS];
+
+	Phase current_;
+	uint64_t wallMark_, cpuMark_;
+};
+
+#endif
@@ -1,42 +1,57 @@
 #include "StringBuffer.h"
 
-StringBuffer::StringBuffer(const std::string &buffer) : buffer_(buffer) {
+#include <algorithm>
+
+StringBuffer::StringBuffer(const std::string &buffer) : buffer_(buffer), pos_(0) {
 
 }
 
-StringBuffer::StringBuffer(std::string &&buffer) : buffer_(std::move(buffer)) {
+StringBuffer::StringBuffer(std::string &&buffer) : buffer_(std::move(buffer)), pos_(0) {
 
 }
 
 size_t StringBuffer::readBytes(char *buffer, size_t amount) {
-	if (buffer_.size() < amount) {
-		amount = buffer_.size();
-	}
+	amount = std::min(amount, remaining());
+
+	std::copy(buffer_.begin() + pos_, buffer_.begin() + pos_ + amount, buffer);
+	pos_ += amount;
+	return amount;
+}
 
-	std::copy(buffer_.begin(), buffer_.begin() + amount, buffer);
-	buffer_.erase(0, amount);
+size_t StringBuffer::skip(size_t amount) {
+	amount = std::min(amount, remaining());
+
+	pos_ += amount;
 	return amount;
 }
 
+size_t StringBuffer::remaining() const {
+	return buffer_.size() - pos_;
+}
+
+const char *StringBuffer::view() const {
+	return buffer_.data() + pos_;
+}
+
 Util::BoolRes StringBuffer::readLine(std::string &buffer) {
-	if (buffer_.empty()) {
+	if (pos_ == buffer_.size()) {
 		return Util::BoolRes(false, "end of stream");
 	}
 
-	auto pos = buffer_.find("\n");
+	auto pos = buffer_.find('\n', pos_);
 	if (pos == std::string::npos) {
-		buffer = std::move(buffer_);
-		buffer_.clear();
+		buffer.assign(buffer_.begin() + pos_, buffer_.end());
+		pos_ = buffer_.size();
 		if (buffer.back() == '\r') {
 			buffer.pop_back();
 		}
 		return Util::BoolRes(true, "");
 	}
 
-	buffer.assign(buffer_.begin(), buffer_.begin() + pos);
-	buffer_.erase(0, pos + 1);
+	buffer.assign(buffer_.begin() + pos_, buffer_.begin() + pos);
+	pos_ = pos + 1;
 
-	if (buffer.back() == '\r') {
+	if (!buffer.empty() && buffer.back() == '\r') {
 		buffer.pop_back();
 	}
 	return Util::BoolRes(true, "");
@@ -11,9 +11,13 @@ public:
 
 	size_t readBytes(char *buffer, size_t amount) override;
 	Util::BoolRes readLine(std::string &buffer) override;
+	size_t skip(size_t amount) override;
+	size_t remaining() const override;
+	const char *view() const override;
 
 private:
 	std::string buffer_;
+	size_t pos_; // read position; consumed bytes are not erased
 };
 
 #endif
\ No newline at end of file
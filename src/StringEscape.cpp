@@ -0,0 +1,284 @@
+#include "StringEscape.h"
+#include "Simd.h"
+
+#include <cstring>
+
+// the letter of the escape sequence written for a character, 0 if it is written as it is
+static inline char escapeLetter(char c) {
+	switch (c) {
+		case '\a':
+			return 'a';
+		case '\b':
+			return 'b';
+		case '\f':
+			return 'f';
+		case '\n':
+			return 'n';
+		case '\r':
+			return 'r';
+		case '\t':
+			return 't';
+		case '\v':
+			return 'v';
+		case '\\':
+		case '"':
+		case '\'':
+			return c;
+		default:
+			return 0;
+	}
+}
+
+// the character an escape sequence stands for, 0 for an unknown one
+static inline char unescapeLetter(char c) {
+	switch (c) {
+		case 'a':
+			return '\a';
+		case 'b':
+			return '\b';
+		case 'f':
+			return '\f';
+		case 'n':
+			return '\n';
+		case 'r':
+			return '\r';
+		case 't':
+			return '\t';
+		case 'v':
+			return '\v';
+		case '\\':
+		case '"':
+		case '\'':
+		case '[':
+		case ']':
+			return c;
+		default:
+			return 0;
+	}
+}
+
+#ifdef SIMD_X86
+static const bool useAVX2 = Simd::avx2();
+static const bool useSSE2 = Simd::sse2();
+
+// The kernels go through whole blocks of 64 characters: a bitmap of the characters of interest is
+// built from vector compares, then its set bits are walked, the runs between them being copied in
+// bulk. They return where they stopped; the scalar code does the rest.
+
+// writes one block escaped, mask having the bits of the characters to escape
+static inline char *escapeBlock(const char *data, uint64_t mask, char *out) {
+	size_t pos = 0;
+	while (mask != 0) {
+		size_t b = Simd::lowestBit(mask);
+		mask &= mask - 1;
+		std::memcpy(out, data + pos, b - pos);
+		out += b - pos;
+		*out++ = '\\';
+		*out++ = escapeLetter(data[b]);
+		pos = b + 1;
+	}
+	std::memcpy(out, data + pos, 64 - pos);
+	return out + 64 - pos;
+}
+
+// Writes the block at i unescaped from pos on, mask having the bits of the backslashes and
+// quotes; characters before pos were taken by an escape sequence started in the block before.
+// Returns true when the literal ends in the block, close being its quote or n for a lone backslash.
+static inline bool unescapeBlock(const char *data, size_t n, size_t i, uint64_t mask, char quote, size_t &pos, char *&out, size_t &close) {
+	while (mask != 0) {
+		size_t b = i + Simd::lowestBit(mask);
+		mask &= mask - 1;
+		if (b < pos) {
+			continue;
+		}
+		std::memcpy(out, data + pos, b - pos);
+		out += b - pos;
+		if (data[b] == quote) {
+			close = b;
+			return true;
+		}
+		if (b + 1 == n) {
+			close = n;
+			return true;
+		}
+		char u = unescapeLetter(data[b + 1]);
+		if (u) {
+			*out++ = u;
+		}
+		pos = b + 2;
+	}
+	if (pos < i + 64) {
+		std::memcpy(out, data + pos, i + 64 - pos);
+		out += i + 64 - pos;
+		pos = i + 64;
+	}
+	return false;
+}
+
+// \a to \r are 7 to 13, one unsigned range compare
+SSE2_TARGET static inline uint64_t escapeMaskSSE2(__m128i v) {
+	__m128i control = _mm_sub_epi8(v, _mm_set1_epi8(7));
+	control = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8(6)), control);
+	__m128i quotes = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+	return (unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(control, quotes), _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+}
+
+SSE2_TARGET static size_t escapeSSE2(const char *data, size_t n, char *&out) {
+	size_t i = 0;
+	for (; i + 64 <= n; i += 64) {
+		uint64_t mask = 0;
+		for (int k = 0; k < 4; k++) {
+			mask |= escapeMaskSSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + k * 16))) << (k * 16);
+		}
+		out = escapeBlock(data + i, mask, out);
+	}
+	return i;
+}
+
+AVX2_TARGET static inline uint64_t escapeMaskAVX2(__m256i v) {
+	__m256i control = _mm256_sub_epi8(v, _mm256_set1_epi8(7));
+	control = _mm256_cmpeq_epi8(_mm256_min_epu8(control, _mm256_set1_epi8(6)), control);
+	__m256i quotes = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+	return (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(control, quotes), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))));
+}
+
+AVX2_TARGET static size_t escapeAVX2(const char *data, size_t n, char *&out) {
+	size_t i = 0;
+	for (; i + 64 <= n; i += 64) {
+		uint64_t mask = escapeMaskAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)))
+			| escapeMaskAVX2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32))) << 32;
+		out = escapeBlock(data + i, mask, out);
+	}
+	return i;
+}
+
+// backslashes and the closing quote
+SSE2_TARGET static bool unescapeSSE2(const char *data, size_t n, char quote, size_t &i, size_t &pos, char *&out, size_t &close) {
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i q = _mm_set1_epi8(quote);
+	for (; i + 64 <= n; i += 64) {
+		uint64_t mask = 0;
+		for (int k = 0; k < 4; k++) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + k * 16));
+			mask |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, backslash), _mm_cmpeq_epi8(v, q))) << (k * 16);
+		}
+		if (unescapeBlock(data, n, i, mask, quote, pos, out, close)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+AVX2_TARGET static bool unescapeAVX2(const char *data, size_t n, char quote, size_t &i, size_t &pos, char *&out, size_t &close) {
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i q = _mm256_set1_epi8(quote);
+	for (; i + 64 <= n; i += 64) {
+		__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+		__m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + 32));
+		uint64_t mask = (uint64_t)(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(lo, backslash), _mm256_cmpeq_epi8(lo, q)))
+			| (uint64_t)(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(hi, backslash), _mm256_cmpeq_epi8(hi, q))) << 32;
+		if (unescapeBlock(data, n, i, mask, quote, pos, out, close)) {
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
+void StringEscape::escape(const char *data, size_t size, std::string &out) {
+	// written in place at the longest it can get, then cut back
+	size_t start = out.size();
+	out.resize(start + 2 * size);
+	char *o = &out[0] + start;
+	size_t i = 0;
+#ifdef SIMD_X86
+	if (useAVX2) {
+		i = escapeAVX2(data, size, o);
+	} else if (useSSE2) {
+		i = escapeSSE2(data, size, o);
+	}
+#endif
+	for (; i < size; i++) {
+		char e = escapeLetter(data[i]);
+		if (e) {
+			*o++ = '\\';
+			*o++ = e;
+		} else {
+			*o++ = data[i];
+		}
+	}
+	out.resize(o - out.data());
+}
+
+void StringEscape::escapeScalar(const char *data, size_t size, std::string &out) {
+	for (size_t i = 0; i < size; i++) {
+		char e = escapeLetter(data[i]);
+		if (e) {
+			out += '\\';
+			out += e;
+		} else {
+			out += data[i];
+		}
+	}
+}
+
+const char *StringEscape::unescape(const char *start, const char *end, char quote, std::string &out) {
+	// never longer than the rest of the input
+	size_t n = end - start;
+	size_t base = out.size();
+	out.resize(base + n);
+	char *o = &out[0] + base;
+
+	size_t pos = 0, close = n;
+	bool done = false;
+#ifdef SIMD_X86
+	size_t i = 0;
+	if (useAVX2) {
+		done = unescapeAVX2(start, n, quote, i, pos, o, close);
+	} else if (useSSE2) {
+		done = unescapeSSE2(start, n, quote, i, pos, o, close);
+	}
+#endif
+	for (; !done && pos < n; pos++) {
+		if (start[pos] == quote) {
+			close = pos;
+			break;
+		}
+		if (start[pos] == '\\') {
+			if (++pos == n) {
+				break;
+			}
+			char u = unescapeLetter(start[pos]);
+			if (u) {
+				*o++ = u;
+			}
+		} else {
+			*o++ = start[pos];
+		}
+	}
+	out.resize(o - out.data());
+	return close < n ? start + close : nullptr;
+}
+
+const char *StringEscape::unescapeScalar(const char *start, const char *end, char quote, std::string &out) {
+	for (const char *c = start; c != end; ++c) {
+		if (*c == '\\') {
+			if (c + 1 == end) {
+				return nullptr;
+			}
+			char u = unescapeLetter(*(++c));
+			if (u) {
+				out += u;
+			}
+		} else if (*c == quote) {
+			return c;
+		} else {
+			out += *c;
+		}
+	}
+	return nullptr;
+}
+
+const char *StringEscape::kernel() {
+	return Simd::kernel();
+}
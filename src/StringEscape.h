@@ -0,0 +1,26 @@
+#ifndef STRINGESCAPE_H
+#define STRINGESCAPE_H
+
+#include <string>
+#include <stddef.h>
+
+// The escapes of string constants in assembly: \a \b \f \n \r \t \v \\ \" \' (and \[ \] when
+// reading). The AVX2 or SSE2 kernel finds the characters to escape (or the backslashes and the
+// quote) 64 at a time, and the runs between them are copied in bulk, so long strings (embedded
+// JSON, templates) cost little more than a copy.
+namespace StringEscape {
+	// appends data to out with the escapes applied
+	void escape(const char *data, size_t size, std::string &out);
+	void escapeScalar(const char *data, size_t size, std::string &out);
+
+	// Reads the body of a literal, start being just after the opening quote, and appends it to out
+	// unescaped. An unknown escape sequence stands for nothing. Returns the closing quote, or
+	// nullptr if the literal ends without one or with a lone backslash.
+	const char *unescape(const char *start, const char *end, char quote, std::string &out);
+	const char *unescapeScalar(const char *start, const char *end, char quote, std::string &out);
+
+	// "avx2", "sse2" or "scalar"
+	const char *kernel();
+}
+
+#endif
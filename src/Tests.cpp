@@ -0,0 +1,328 @@
+#include "StringBuffer.h"
+#include "StringWriteBuffer.h"
+#include "Parser.h"
+#include "Assembler.h"
+#include "Optimizer.h"
+#include "opcodes.h"
+#include "NumberFormat.h"
+#include "StringEscape.h"
+#include "LineScanner.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Regression tests (luadisass_tests, run by ctest). Each test returns normally on success;
+// CHECK reports a failed condition and lets the test go on.
+static int failures = 0;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond << std::endl; \
+		failures++; \
+	} \
+} while (0)
+
+#define CHECK_EQUAL(expected, actual) do { \
+	if (!((expected) == (actual))) { \
+		std::cerr << __FILE__ << ":" << __LINE__ << ": expected " << (expected) << ", got " << (actual) << std::endl; \
+		failures++; \
+	} \
+} while (0)
+
+// Assembles a main function declaring one upvalue with the given code and passes, disassembles the
+// result and returns its instructions one per line, without the comments
+static std::string optimize(const std::string &code, int maxstack, unsigned int passes) {
+	std::string luas = ".upvalues 1\n.func main " + std::to_string(maxstack) + " 0 1\n"
+		".begin_const\n\t\"f\"\n.end_const\n"
+		".begin_upvalue\n\t1 0\n.end_upvalue\n"
+		".begin_code\n" + code + ".end_code\n";
+
+	std::string chunk;
+	Assembler assembler(new StringBuffer(std::move(luas)), WriteBufferPtr(new StringWriteBuffer(chunk)));
+	assembler.setOptimizations(passes);
+	Util::BoolRes res = assembler.assemble();
+	if (!res.success()) {
+		return "assembly failed: " + res.error_msg();
+	}
+
+	Parser parser(new StringBuffer(std::move(chunk)));
+	std::string text;
+	res = parser.parse(text);
+	if (!res.success()) {
+		return "disassembly failed: " + res.error_msg();
+	}
+
+	std::istringstream in(text);
+	std::string line, out;
+	bool inCode = false;
+	while (std::getline(in, line)) {
+		size_t start = line.find_first_not_of(" \t");
+		line = start == std::string::npos ? "" : line.substr(start);
+		if (line == ".begin_code") {
+			inCode = true;
+		} else if (line == ".end_code") {
+			inCode = false;
+		} else if (inCode) {
+			size_t comment = line.find(" ;");
+			out += line.substr(0, comment) + "\n";
+		}
+	}
+	return out;
+}
+
+// A call runs its callee in the registers from its base up: a copy held there must not be read
+// through its source after the call.
+static void testCopyAcrossCall() {
+	std::string out = optimize(
+		"\tgettabup %1 @0 const \"f\"\n"
+		"\tloadk %2 const \"f\"\n"
+		"\tmove %3 %2\n"
+		"\tcall %1 2 1\n"
+		"\tadd %0 %3 %3\n"
+		"\treturn %0 2\n", 4, Optimizer::OPT_ALL);
+	CHECK(out.find("add %0 %2 %2") == std::string::npos);
+	CHECK_EQUAL(
+		"gettabup %1 @0 const \"f\"\n"
+		"loadk %2 const \"f\"\n"
+		"call %1 2 1\n"
+		"add %0 %3 %3\n"
+		"return %0 2\n", out);
+}
+
+// 'loadbool A B 1' skips the next instruction even when nothing else reaches it; removing it or
+// moving it away would make the skip land elsewhere
+static void testLoadBoolSkip() {
+	const std::string unreached =
+		"\tloadbool %0 0 1\n"
+		"\tloadbool %0 1 0\n"
+		"\treturn %0 2\n";
+	const std::string kept =
+		"loadbool %0 false 1\n"
+		"loadbool %0 true 0\n"
+		"return %0 2\n";
+	CHECK_EQUAL(kept, optimize(unreached, 2, Optimizer::OPT_UNREACHABLE));
+	CHECK_EQUAL(kept, optimize(unreached, 2, Optimizer::OPT_ALL));
+
+	// the usual value of a comparison; the layout has to leave the pair in place
+	CHECK_EQUAL(
+		"lt true %0 %1\n"
+		"jmp 0 $location_3\n"
+		"loadbool %2 false 1\n"
+		"location_3:\n"
+		"loadbool %2 true 0\n"
+		"return %2 2\n", optimize(
+		"\tlt 1 %0 %1\n"
+		"\tjmp 0 $true\n"
+		"\tloadbool %2 0 1\n"
+		"true:\n"
+		"\tloadbool %2 1 0\n"
+		"\treturn %2 2\n", 3, Optimizer::OPT_ALL));
+}
+
+// With the constant table full, a fold only happens when its result is already in the table, and
+// the table does not grow; a fold is reported apart from the instructions saved.
+static void testFoldFullTable() {
+	std::string luas = ".upvalues 1\n.func main 2 0 1\n.begin_const\n";
+	for (size_t k = 0; k <= MAXARG_Bx; k++) {
+		luas += "\t" + std::to_string(k) + "\n";
+	}
+	luas += ".end_const\n.begin_upvalue\n\t1 0\n.end_upvalue\n.begin_code\n"
+		"\tadd %0 const 1 const 2\n"
+		"\tshl %1 const 1 const 20\n"
+		"\treturn %0 3\n"
+		".end_code\n";
+
+	std::string chunk;
+	Assembler assembler(new StringBuffer(std::move(luas)), WriteBufferPtr(new StringWriteBuffer(chunk)));
+	assembler.setOptimizations(Optimizer::OPT_FOLD);
+	Util::BoolRes res = assembler.assemble();
+	CHECK(res.success());
+	CHECK_EQUAL(1u, assembler.report().size());
+	if (!assembler.report().empty()) {
+		CHECK_EQUAL("main: 3 -> 3 instructions (fold 0), 1 operations folded", assembler.report()[0]);
+	}
+
+	Parser parser(new StringBuffer(std::move(chunk)));
+	std::string text;
+	CHECK(parser.parse(text).success());
+	CHECK_EQUAL((size_t)MAXARG_Bx + 1, parser.mainFunction()->constants().size());
+	CHECK(text.find("loadk %0 const 3\n") != std::string::npos);
+	CHECK(text.find("shl %1 const 1 const 20\n") != std::string::npos);
+}
+
+// formats a float and parses the text back, which has to give the same bits
+static std::string roundTrip(double number) {
+	std::string text = NumberFormat::format(number);
+	double back;
+	long long integer;
+	bool isInteger;
+	const char *end = NumberFormat::parse(text.data(), text.data() + text.size(), back, integer, isInteger);
+	CHECK(end == text.data() + text.size());
+	CHECK(!isInteger);
+	CHECK(std::memcmp(&back, &number, sizeof(number)) == 0 || (std::isnan(back) && std::isnan(number) && std::signbit(back) == std::signbit(number)));
+	return text;
+}
+
+static void testNumberFormat() {
+	// subnormals have fewer than 15 significant digits
+	CHECK_EQUAL("5e-324", roundTrip(std::ldexp(1.0, -1074)));
+	CHECK_EQUAL("1e-323", roundTrip(std::ldexp(1.0, -1073)));
+	CHECK_EQUAL("-1.5e-323", roundTrip(-std::ldexp(3.0, -1074)));
+	CHECK_EQUAL("2.225073858507201e-308", roundTrip(std::numeric_limits<double>::min() - std::ldexp(1.0, -1074)));
+	CHECK_EQUAL("2.2250738585072014e-308", roundTrip(std::numeric_limits<double>::min()));
+	CHECK_EQUAL("1.7976931348623157e+308", roundTrip(std::numeric_limits<double>::max()));
+
+	CHECK_EQUAL("0.0", roundTrip(0.0));
+	CHECK_EQUAL("-0.0", roundTrip(-0.0));
+	CHECK_EQUAL("0.1", roundTrip(0.1));
+	CHECK_EQUAL("100.0", roundTrip(100.0));
+	CHECK_EQUAL("100000000000000.0", roundTrip(1e14));
+	CHECK_EQUAL("1e+15", roundTrip(1e15));
+	CHECK_EQUAL("0.0001", roundTrip(1e-4));
+	CHECK_EQUAL("1e-05", roundTrip(1e-5));
+	CHECK_EQUAL("-123.456", roundTrip(-123.456));
+	CHECK_EQUAL("0.30000000000000004", roundTrip(0.1 + 0.2));
+
+	// the gap below a power of two is half the one above: the nearest 16 digits fall outside it,
+	// other 16 digits do not
+	CHECK_EQUAL("8.209073602596753e-289", roundTrip(8.209073602596753e-289));
+
+	CHECK_EQUAL("inf", roundTrip(std::numeric_limits<double>::infinity()));
+	CHECK_EQUAL("-inf", roundTrip(-std::numeric_limits<double>::infinity()));
+	CHECK_EQUAL("nan", roundTrip(std::numeric_limits<double>::quiet_NaN()));
+	CHECK_EQUAL("-nan", roundTrip(-std::numeric_limits<double>::quiet_NaN()));
+
+	// not null-terminated, and longer than any stack copy
+	double number;
+	long long integer;
+	bool isInteger;
+	std::string text = "4.9406564584124654e-324;";
+	CHECK(NumberFormat::parse(text.data(), text.data() + text.size() - 1, number, integer, isInteger) == text.data() + text.size() - 1);
+	CHECK_EQUAL(std::ldexp(1.0, -1074), number);
+	text = "0." + std::string(200, '0') + "1e201";
+	CHECK(NumberFormat::parse(text.data(), text.data() + text.size(), number, integer, isInteger) != nullptr);
+	CHECK_EQUAL(1.0, number);
+
+	CHECK(NumberFormat::parse("INF", "INF" + 3, number, integer, isInteger) != nullptr && std::isinf(number));
+	CHECK(NumberFormat::parse("inf1", "inf1" + 4, number, integer, isInteger) == nullptr);
+	CHECK(optimize("\tloadk %0 const inf1\n\treturn %0 2\n", 2, 0).find("assembly failed") == 0);
+}
+
+// unescapes text with the kernel and with the scalar code, which have to agree; "(open)" when there
+// is no closing quote. The text is copied to a block of its own size, so reading past it shows up
+// under AddressSanitizer.
+static std::string unescapeBoth(const std::string &text, char quote) {
+	std::vector<char> copy(text.begin(), text.end());
+	const char *start = copy.data(), *end = copy.data() + copy.size();
+	std::string vector, scalar;
+	const char *v = StringEscape::unescape(start, end, quote, vector);
+	const char *s = StringEscape::unescapeScalar(start, end, quote, scalar);
+	CHECK_EQUAL(s ? s - start : -1, v ? v - start : -1);
+	CHECK_EQUAL(scalar, vector);
+	return v ? vector : "(open)";
+}
+
+// The kernels look at 64 bytes at a time; an escape, a quote or a lone backslash on either side of
+// a block boundary has to come out as it does with the scalar code.
+static void testStringEscape() {
+	const char specials[] = {'\n', '\t', '"', '\'', '\\', '\0', '\x7f', '\xe9'};
+	for (size_t at = 62; at <= 66; at++) {
+		for (char special : specials) {
+			std::string data = std::string(at, 'a') + special + std::string(at, 'b') + special;
+			std::vector<char> copy(data.begin(), data.end());
+			std::string vector, scalar;
+			StringEscape::escape(copy.data(), copy.size(), vector);
+			StringEscape::escapeScalar(copy.data(), copy.size(), scalar);
+			CHECK_EQUAL(scalar, vector);
+			CHECK_EQUAL(data, unescapeBoth(vector + "\"", '"'));
+		}
+
+		const std::string pad(at, 'a');
+		CHECK_EQUAL(pad + "\n" + pad, unescapeBoth(pad + "\\n" + pad + "\"", '"'));
+		CHECK_EQUAL(pad + "\\", unescapeBoth(pad + "\\\\\"" + pad, '"'));
+		CHECK_EQUAL(pad + "\"" + pad, unescapeBoth(pad + "\\\"" + pad + "\"", '"'));
+		CHECK_EQUAL(pad + "\"" + pad, unescapeBoth(pad + "\"" + pad + "'", '\''));
+		CHECK_EQUAL(pad, unescapeBoth(pad + "\"", '"'));
+
+		// a lone backslash as the last byte, or escaping the only quote
+		CHECK_EQUAL("(open)", unescapeBoth(pad + "\\", '"'));
+		CHECK_EQUAL("(open)", unescapeBoth(pad + pad + "\\", '"'));
+		CHECK_EQUAL("(open)", unescapeBoth(pad + "\\\"", '"'));
+		CHECK_EQUAL("(open)", unescapeBoth(pad + "\\\"" + pad, '"'));
+	}
+}
+
+// The kernels index 64 bytes at a time and the input is scanned a window at a time; lines, comments
+// and white space across either boundary have to come out as they do with the scalar code.
+static void testLineScanner() {
+	std::string text;
+	unsigned int lines = 0;
+	size_t expected = 0;
+	for (unsigned int i = 0; text.size() < 0x10000 + 4096; i++) {
+		text += std::string(i * 7 % 70, i % 3 ? ' ' : '\t');
+		switch (i % 5) {
+		case 0: // blank
+			break;
+		case 1:
+			text += "; only a comment " + std::string(i % 90, '-');
+			break;
+		default:
+			text += "move %" + std::to_string(i % 8) + " %1" + std::string(i * 13 % 80, ' ');
+			if (i % 2) {
+				text += "; why" + std::string(i % 100, ';');
+			}
+			expected++;
+		}
+		text += i % 4 ? "\n" : "\r\n";
+		lines++;
+	}
+	text += "\t return %0 1 ; no newline at the end  ";
+	lines++;
+	expected++;
+
+	std::vector<LineView> vector, scalar;
+	LineScanner::scan(text.data(), text.size(), vector);
+	LineScanner::scanScalar(text.data(), text.size(), scalar);
+	CHECK_EQUAL(expected, scalar.size());
+	CHECK_EQUAL(scalar.size(), vector.size());
+
+	// the first line that differs
+	size_t same = 0;
+	while (same < vector.size() && same < scalar.size() && vector[same].text == scalar[same].text &&
+			vector[same].length == scalar[same].length && vector[same].comment == scalar[same].comment &&
+			vector[same].number == scalar[same].number) {
+		same++;
+	}
+	CHECK_EQUAL(scalar.size(), same);
+
+	for (const LineView &line : vector) {
+		CHECK(line.length > 0 && line.text[line.length - 1] != '\r');
+	}
+	if (!vector.empty()) {
+		const LineView &last = vector.back();
+		CHECK_EQUAL("return %0 1 ; no newline at the end", std::string(last.text, last.length));
+		CHECK_EQUAL(std::string("return %0 1 ").size(), last.comment);
+		CHECK_EQUAL(lines, last.number);
+	}
+}
+
+int main() {
+	testCopyAcrossCall();
+	testLoadBoolSkip();
+	testFoldFullTable();
+	testNumberFormat();
+	testStringEscape();
+	testLineScanner();
+
+	if (failures) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "all tests passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include "Trace.h"
+
+#include <fstream>
+#include <cstdio>
+
+static std::string jsonEscape(const std::string &string) {
+	std::string s;
+	for (char c : string) {
+		switch (c) {
+			case '"':
+				s += "\\\"";
+				break;
+			case '\\':
+				s += "\\\\";
+				break;
+			case '\n':
+				s += "\\n";
+				break;
+			case '\r':
+				s += "\\r";
+				break;
+			case '\t':
+				s += "\\t";
+				break;
+			default:
+				if ((unsigned char)c < 0x20) {
+					char buf[8];
+					std::snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+					s += buf;
+				} else {
+					s += c;
+				}
+				break;
+		}
+	}
+	return s;
+}
+
+Trace::Trace(size_t threads) : start_(std::chrono::steady_clock::now()), threads_(threads) {
+
+}
+
+uint64_t Trace::now() const {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count();
+}
+
+void Trace::span(size_t thread, const std::string &name, uint64_t start, uint64_t end) {
+	threads_[thread].push_back(Event{'X', name, start, end - start});
+}
+
+void Trace::counter(size_t thread, const char *name, uint64_t value) {
+	threads_[thread].push_back(Event{'C', name, now(), value});
+}
+
+Util::BoolRes Trace::write(const std::string &path) const {
+	std::ofstream of(path, std::ofstream::binary);
+	if (!of.is_open()) {
+		return Util::BoolRes(false, std::string("could not open file ") + path);
+	}
+
+	of << "{\"traceEvents\":[\n";
+	bool first = true;
+	for (size_t tid = 0; tid < threads_.size(); tid++) {
+		of << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << tid
+			<< ",\"args\":{\"name\":\"worker " << tid << "\"}}";
+		first = false;
+
+		for (const Event &e : threads_[tid]) {
+			of << ",\n{\"ph\":\"" << e.phase << "\",\"name\":\"" << jsonEscape(e.name) << "\",\"pid\":1,\"tid\":" << tid << ",\"ts\":" << e.ts;
+			if (e.phase == 'X') {
+				of << ",\"dur\":" << e.value;
+			} else {
+				of << ",\"args\":{\"" << jsonEscape(e.name) << "\":" << e.value << "}";
+			}
+			of << "}";
+		}
+	}
+	of << "\n]}\n";
+
+	if (!of.good()) {
+		return Util::BoolRes(false, std::string("could not write ") + path);
+	}
+	return Util::BoolRes(true, "");
+}
@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "lconfig.h"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdint.h>
+
+// Timeline of a batch run in the Chrome trace-event format (chrome://tracing, Perfetto). Every worker
+// thread records into its own event list, so recording never takes a lock.
+class Trace {
+public:
+	Trace(size_t threads);
+
+	// records a span for the lifetime of the scope; does nothing without a trace
+	class Span {
+	public:
+		inline Span(Trace *trace, size_t thread, const char *name) : trace_(trace), thread_(thread), name_(name) {
+			if (trace_) {
+				start_ = trace_->now();
+			}
+		}
+		inline ~Span() {
+			if (trace_) {
+				trace_->span(thread_, name_, start_, trace_->now());
+			}
+		}
+	private:
+		Span(const Span &) = delete;
+		Span &operator=(const Span &) = delete;
+
+		Trace *trace_;
+		size_t thread_;
+		const char *name_;
+		uint64_t start_;
+	};
+
+	uint64_t now() const; // microseconds since the trace was created
+
+	void span(size_t thread, const std::string &name, uint64_t start, uint64_t end);
+	void counter(size_t thread, const char *name, uint64_t value);
+
+	Util::BoolRes write(const std::string &path) const;
+
+private:
+	struct Event {
+		char phase; // 'X' complete span, 'C' counter
+		std::string name;
+		uint64_t ts, value; // value is the duration of spans
+	};
+
+	std::chrono::steady_clock::time_point start_;
+	std::vector<std::vector<Event> > threads_;
+};
+
+#endif
@@ -0,0 +1,302 @@
+#include "Verifier.h"
+#include "Function.h"
+#include "DecodedCode.h"
+#include "opcodes.h"
+
+#define MAX_ERRORS 64 // kept per prototype; the rest are only counted
+
+const char *VerifyError::kindName(Kind kind) {
+	static const char *names[] = {
+		"opcode",
+		"register",
+		"constant",
+		"upvalue",
+		"proto",
+		"jump",
+		"extraarg",
+		"sequence"
+	};
+	return names[kind];
+}
+
+std::string VerifyError::str() const {
+	if (pc < 0) {
+		return function + ": " + message;
+	}
+	return function + " pc " + std::to_string(pc) + ": " + message;
+}
+
+Verifier::Verifier(Function *function, const DecodedCode &code) : function_(function), code_(code), total_(0) {
+	registers_ = function->maxStackSize();
+	constants_ = (int)function->constants().size();
+	upvalues_ = (int)function->upvalues().size();
+	protos_ = (int)function->protos().size();
+	aChecked_ = bChecked_ = cChecked_ = false;
+}
+
+void Verifier::error(VerifyError::Kind kind, int pc, const std::string &message) {
+	if (total_++ >= MAX_ERRORS) {
+		return;
+	}
+	std::string where;
+	if (pc >= 0) {
+		int op = code_.opcode[pc];
+		where = std::string("(") + (op < NUM_OPCODES ? luaP_opnames[op] : "?") + ") ";
+	}
+	errors_.push_back(VerifyError{kind, function_->label(), pc, where + message});
+}
+
+void Verifier::checkA(size_t pc) {
+	if (!aChecked_) {
+		checkRegister(pc, code_.a[pc]);
+	}
+}
+
+void Verifier::checkRegister(size_t pc, int r) {
+	if (r >= registers_) {
+		error(VerifyError::REGISTER, (int)pc, "register " + std::to_string(r) + " out of range (maxstacksize " + std::to_string(registers_) + ")");
+	}
+}
+
+void Verifier::checkRK(size_t pc, int rk, bool checked) {
+	if (checked) {
+		return;
+	}
+	if (ISK(rk)) {
+		checkConstant(pc, INDEXK(rk));
+	} else {
+		checkRegister(pc, rk);
+	}
+}
+
+void Verifier::checkConstant(size_t pc, int k) {
+	if (k >= constants_) {
+		error(VerifyError::CONSTANT, (int)pc, "constant " + std::to_string(k) + " out of range (" + std::to_string(constants_) + " constants)");
+	}
+}
+
+void Verifier::checkUpvalue(size_t pc, int u) {
+	if (u >= upvalues_) {
+		error(VerifyError::UPVALUE, (int)pc, "upvalue " + std::to_string(u) + " out of range (" + std::to_string(upvalues_) + " upvalues)");
+	}
+}
+
+void Verifier::checkTarget(size_t pc, long long target) {
+	if (target < 0 || target >= (long long)code_.size()) {
+		error(VerifyError::JUMP, (int)pc, "target " + std::to_string(target) + " outside the code (" + std::to_string(code_.size()) + " instructions)");
+	}
+}
+
+void Verifier::checkNext(size_t pc, int op) {
+	if (pc + 1 >= code_.size() || code_.opcode[pc + 1] != op) {
+		error(VerifyError::SEQUENCE, (int)pc, std::string("needs to be followed by ") + luaP_opnames[op]);
+	}
+}
+
+Util::BoolRes Verifier::verify() {
+	errors_.clear();
+	total_ = 0;
+	size_t n = code_.size();
+
+	if (function_->numParams() > registers_) {
+		error(VerifyError::REGISTER, -1, std::to_string((int)function_->numParams()) + " parameters do not fit maxstacksize " + std::to_string(registers_));
+	}
+	if (n == 0 || code_.opcode[n - 1] != OP_RETURN) {
+		error(VerifyError::SEQUENCE, -1, "the code does not end with return");
+	}
+
+	// extraarg operands show up in these too, so a failure only means looking closer
+	aChecked_ = n == 0 || DecodedCode::max(code_.a) < registers_;
+	bChecked_ = DecodedCode::rkInRange(code_.b, registers_, constants_);
+	cChecked_ = DecodedCode::rkInRange(code_.c, registers_, constants_);
+
+	for (size_t pc = 0; pc < n; pc++) {
+		int op = code_.opcode[pc];
+		int a = code_.a[pc], b = code_.b[pc], c = code_.c[pc];
+
+		switch (op) {
+			case OP_MOVE:
+			case OP_UNM:
+			case OP_BNOT:
+			case OP_NOT:
+			case OP_LEN:
+				checkA(pc);
+				checkRegister(pc, b);
+				break;
+			case OP_LOADK:
+				checkA(pc);
+				checkConstant(pc, code_.bx[pc]);
+				break;
+			case OP_LOADKX:
+				checkA(pc);
+				if (pc + 1 < n && code_.opcode[pc + 1] == OP_EXTRAARG) {
+					checkConstant(pc, GETARG_Ax(function_->code()[pc + 1]));
+					pc++;
+				} else {
+					error(VerifyError::EXTRAARG, (int)pc, "needs to be followed by extraarg");
+				}
+				break;
+			case OP_LOADBOOL:
+				checkA(pc);
+				if (c != 0) {
+					checkTarget(pc, (long long)pc + 2);
+				}
+				break;
+			case OP_LOADNIL:
+				checkRegister(pc, a + b);
+				break;
+			case OP_GETUPVAL:
+				checkA(pc);
+				checkUpvalue(pc, b);
+				break;
+			case OP_GETTABUP:
+				checkA(pc);
+				checkUpvalue(pc, b);
+				checkRK(pc, c, cChecked_);
+				break;
+			case OP_GETTABLE:
+				checkA(pc);
+				checkRegister(pc, b);
+				checkRK(pc, c, cChecked_);
+				break;
+			case OP_SETTABUP:
+				checkUpvalue(pc, a);
+				checkRK(pc, b, bChecked_);
+				checkRK(pc, c, cChecked_);
+				break;
+			case OP_SETUPVAL:
+				checkA(pc);
+				checkUpvalue(pc, b);
+				break;
+			case OP_SETTABLE:
+				checkA(pc);
+				checkRK(pc, b, bChecked_);
+				checkRK(pc, c, cChecked_);
+				break;
+			case OP_NEWTABLE:
+				checkA(pc);
+				break;
+			case OP_SELF:
+				checkRegister(pc, a + 1);
+				checkRegister(pc, b);
+				checkRK(pc, c, cChecked_);
+				break;
+			case OP_ADD:
+			case OP_SUB:
+			case OP_MUL:
+			case OP_MOD:
+			case OP_POW:
+			case OP_DIV:
+			case OP_IDIV:
+			case OP_BAND:
+			case OP_BOR:
+			case OP_BXOR:
+			case OP_SHL:
+			case OP_SHR:
+				checkA(pc);
+				checkRK(pc, b, bChecked_);
+				checkRK(pc, c, cChecked_);
+				break;
+			case OP_CONCAT:
+				checkA(pc);
+				checkRegister(pc, c);
+				if (b > c) {
+					error(VerifyError::REGISTER, (int)pc, "empty range " + std::to_string(b) + ".." + std::to_string(c));
+				}
+				break;
+			case OP_JMP:
+				if (a > 0) {
+					checkRegister(pc, a - 1);
+				}
+				checkTarget(pc, (long long)pc + 1 + code_.sbx[pc]);
+				break;
+			case OP_EQ:
+			case OP_LT:
+			case OP_LE:
+				checkRK(pc, b, bChecked_);
+				checkRK(pc, c, cChecked_);
+				checkNext(pc, OP_JMP);
+				break;
+			case OP_TEST:
+				checkA(pc);
+				checkNext(pc, OP_JMP);
+				break;
+			case OP_TESTSET:
+				checkA(pc);
+				checkRegister(pc, b);
+				checkNext(pc, OP_JMP);
+				break;
+			case OP_CALL:
+				checkRegister(pc, b == 0 ? a : a + b - 1);
+				if (c > 1) {
+					checkRegister(pc, a + c - 2);
+				}
+				break;
+			case OP_TAILCALL:
+				checkRegister(pc, b == 0 ? a : a + b - 1);
+				break;
+			case OP_RETURN:
+				if (b == 0) {
+					checkA(pc);
+				} else if (b > 1) {
+					checkRegister(pc, a + b - 2);
+				}
+				break;
+			case OP_FORLOOP:
+				checkRegister(pc, a + 3);
+				checkTarget(pc, (long long)pc + 1 + code_.sbx[pc]);
+				break;
+			case OP_FORPREP: {
+				checkRegister(pc, a + 3);
+				long long target = (long long)pc + 1 + code_.sbx[pc];
+				checkTarget(pc, target);
+				if (target >= 0 && target < (long long)n && code_.opcode[target] != OP_FORLOOP) {
+					error(VerifyError::SEQUENCE, (int)pc, "does not jump to a forloop");
+				}
+				break;
+			}
+			case OP_TFORCALL:
+				checkRegister(pc, a + 2 + c);
+				checkNext(pc, OP_TFORLOOP);
+				break;
+			case OP_TFORLOOP:
+				checkRegister(pc, a + 1);
+				checkTarget(pc, (long long)pc + 1 + code_.sbx[pc]);
+				break;
+			case OP_SETLIST:
+				checkRegister(pc, b == 0 ? a : a + b);
+				if (c == 0) {
+					if (pc + 1 < n && code_.opcode[pc + 1] == OP_EXTRAARG) {
+						pc++;
+					} else {
+						error(VerifyError::EXTRAARG, (int)pc, "c=0 needs to be followed by extraarg");
+					}
+				}
+				break;
+			case OP_CLOSURE:
+				checkA(pc);
+				if (code_.bx[pc] >= protos_) {
+					error(VerifyError::PROTO, (int)pc, "prototype " + std::to_string(code_.bx[pc]) + " out of range (" + std::to_string(protos_) + " prototypes)");
+				}
+				break;
+			case OP_VARARG:
+				checkRegister(pc, b > 1 ? a + b - 2 : a);
+				break;
+			case OP_EXTRAARG:
+				error(VerifyError::EXTRAARG, (int)pc, "does not follow loadkx or setlist");
+				break;
+			default:
+				error(VerifyError::OPCODE, (int)pc, "invalid opcode " + std::to_string(op));
+				break;
+		}
+	}
+
+	if (errors_.empty()) {
+		return Util::BoolRes(true, "");
+	}
+	std::string message = "verification failed: " + errors_.front().str();
+	if (total_ > 1) {
+		message += " (and " + std::to_string(total_ - 1) + " more)";
+	}
+	return Util::BoolRes(false, message);
+}
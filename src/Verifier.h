@@ -0,0 +1,77 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include "lconfig.h"
+#include <string>
+#include <vector>
+
+class Function;
+class DecodedCode;
+
+// One problem found in a prototype's code
+struct VerifyError {
+	enum Kind {
+		OPCODE, // not an opcode
+		REGISTER, // register at or above maxstacksize
+		CONSTANT, // constant index out of range
+		UPVALUE, // upvalue index out of range
+		PROTO, // closure of a prototype that does not exist
+		JUMP, // jump or skip target outside the code
+		EXTRAARG, // missing or stray OP_EXTRAARG
+		SEQUENCE // instruction pairs the VM relies on (test + jmp, tforcall + tforloop, final return)
+	};
+
+	Kind kind;
+	std::string function; // label of the prototype
+	int pc; // -1 for the prototype as a whole
+	std::string message;
+
+	// "subroutine_3 pc 12 (GETTABLE): constant 300 out of range (12 constants)"
+	std::string str() const;
+
+	static const char *kindName(Kind kind);
+};
+
+// Checks the code of one prototype against its own tables in a single pass, so that the
+// disassembler (or a VM) can trust every operand afterwards: opcodes, registers against
+// maxstacksize, constant, upvalue and prototype indexes, jump targets and the instruction pairs
+// the VM assumes. The A operands and the RK operands are first range checked over the whole
+// decoded arrays at once; the per instruction checks only look at what that cannot cover.
+class Verifier {
+public:
+	Verifier(Function *function, const DecodedCode &code);
+
+	// fails with the first error (and how many more there are)
+	Util::BoolRes verify();
+
+	// in code order, capped at a few dozen per prototype
+	inline const std::vector<VerifyError> &errors() const {
+		return errors_;
+	}
+
+	// all errors found, including the ones not kept
+	inline size_t count() const {
+		return total_;
+	}
+
+private:
+	void error(VerifyError::Kind kind, int pc, const std::string &message);
+
+	void checkA(size_t pc);
+	void checkRegister(size_t pc, int r);
+	void checkRK(size_t pc, int rk, bool checked);
+	void checkConstant(size_t pc, int k);
+	void checkUpvalue(size_t pc, int u);
+	void checkTarget(size_t pc, long long target);
+	void checkNext(size_t pc, int op);
+
+	Function *function_;
+	const DecodedCode &code_;
+	int registers_, constants_, upvalues_, protos_;
+	bool aChecked_, bChecked_, cChecked_; // set when the vectorized checks passed for the whole field
+
+	std::vector<VerifyError> errors_;
+	size_t total_;
+};
+
+#endif
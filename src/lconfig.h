@@ -57,6 +57,7 @@ typedef unsigned int Instruction;
 #define LUA_TNUMINT   (LUA_TNUMBER | (1 << 4))  /* integer numbers */
 
 #include "util.h"
+#include "NumberFormat.h"
 
 
 class TValue {
@@ -78,8 +79,13 @@ public:
 	TString(const std::string &string) : TValue(LUA_TSTRING), string_(string) {};
 	TString(std::string &&string) : TValue(LUA_TSTRING), string_(std::forward<std::string>(string)) {};
 
-	inline std::string string() {return string_; };
-	inline std::string str() override {return std::string("\"") + Util::escape(string_) + std::string("\""); };
+	inline const std::string &string() const {return string_; };
+	inline std::string str() override {
+		std::string s("\"");
+		Util::escape(string_, s);
+		s += '"';
+		return s;
+	};
 
 	inline bool operator==(TValue &v) override {
 		return v.type() == LUA_TSTRING && reinterpret_cast<TString*>(&v)->string() == string_;
@@ -107,7 +113,7 @@ public:
 	TNumber(lua_Number number) : TValue(LUA_TNUMBER), value_(number) {};
 
 	inline lua_Number number() {return value_; };
-	inline std::string str() override {return std::to_string(value_); };
+	inline std::string str() override {return NumberFormat::format(value_); };
 
 	inline bool operator==(TValue &v) override {
 		return v.type() == LUA_TNUMBER && reinterpret_cast<TNumber*>(&v)->number() == value_;
@@ -116,6 +122,20 @@ private:
 	lua_Number value_;
 };
 
+class TInteger : public TValue {
+public:
+	TInteger(lua_Integer integer) : TValue(LUA_TNUMINT), value_(integer) {};
+
+	inline lua_Integer integer() {return value_; };
+	inline std::string str() override {return std::to_string(value_); }; // no decimal point, unlike floats
+
+	inline bool operator==(TValue &v) override {
+		return v.type() == LUA_TNUMINT && reinterpret_cast<TInteger*>(&v)->integer() == value_;
+	};
+private:
+	lua_Integer value_;
+};
+
 
 
 #endif
\ No newline at end of file
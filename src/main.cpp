@@ -4,38 +4,382 @@
 #include "StringBuffer.h"
 #include "Parser.h"
 #include "Assembler.h"
+#include "Optimizer.h"
 #include "StringWriteBuffer.h"
+#include "FileBuffer.h"
+#include "FileWriteBuffer.h"
+#include "RoundTrip.h"
+#include "Stats.h"
+#include "AllocStats.h"
+#include "Bench.h"
+#include "Dumper.h"
+#include "Exporter.h"
 
 #include <iostream>
+#include <algorithm>
+#include <memory>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
 
 void printUsage(const char *name) {
-	std::cout << "usage: " << name << " <-d <luac dump> ; -a <luas assembly> > <output>" << std::endl;
+	std::cout << "usage: " << name << " [--stats] [--alloc-stats] [--stack validate|minimize] [-O | --opt <passes>] [--strip none|lines|all] [--format <format>] [--no-verify] [--stream] [-j <threads>] [--emit text|json|binary] <-d <luac dump> ; -a <luas assembly> > <output>" << std::endl;
+	std::cout << "       " << name << " -s [--strip none|lines|all] [--format <format>] <luac dump> <output>" << std::endl;
+	std::cout << "       " << name << " -r [-j <threads>] [--trace <json>] [--slowest <n>] <luac dump>..." << std::endl;
+	std::cout << "       " << name << " -b [-n <iterations>] [--perf] [--numbers <count>] [--strings <bytes>] <luac dump>..." << std::endl;
+}
+
+// a whole decimal number of at least 1 that fits an unsigned int
+static bool parsePositive(const char *text, unsigned int &out) {
+	if (*text < '0' || *text > '9') {
+		return false;
+	}
+	char *end;
+	errno = 0;
+	unsigned long value = std::strtoul(text, &end, 10);
+	if (*end != '\0' || errno == ERANGE || value < 1 || value > UINT_MAX) {
+		return false;
+	}
+	out = (unsigned int)value;
+	return true;
+}
+
+int bench(int argc, char *argv[]) {
+	unsigned int iterations = 10;
+	unsigned int numbers = 0;
+	unsigned int strings = 0;
+	bool perf = false;
+	std::vector<std::string> files;
+	for (int i = 2; i < argc; i++) {
+		if (std::string("-n") == argv[i] && i + 1 < argc) {
+			if (!parsePositive(argv[++i], iterations)) {
+				std::cerr << "invalid iteration count " << argv[i] << ", expected a number of at least 1" << std::endl;
+				printUsage(argv[0]);
+				return 1;
+			}
+		} else if (std::string("--numbers") == argv[i] && i + 1 < argc) {
+			if (!parsePositive(argv[++i], numbers)) {
+				std::cerr << "invalid count " << argv[i] << " for --numbers, expected a number of at least 1" << std::endl;
+				printUsage(argv[0]);
+				return 1;
+			}
+		} else if (std::string("--strings") == argv[i] && i + 1 < argc) {
+			if (!parsePositive(argv[++i], strings)) {
+				std::cerr << "invalid size " << argv[i] << " for --strings, expected a number of at least 1" << std::endl;
+				printUsage(argv[0]);
+				return 1;
+			}
+		} else if (std::string("--perf") == argv[i]) {
+			perf = true;
+		} else {
+			files.push_back(argv[i]);
+		}
+	}
+
+	Bench b(iterations, perf);
+	for (auto &file : files) {
+		auto res = b.runFile(file);
+		if (!res.success()) {
+			std::cerr << res.error_msg() << std::endl;
+			return 1;
+		}
+	}
+	if (numbers > 0) {
+		auto res = b.runNumbers(numbers);
+		if (!res.success()) {
+			std::cerr << res.error_msg() << std::endl;
+			return 1;
+		}
+	}
+	if (strings > 0) {
+		auto res = b.runStrings(strings);
+		if (!res.success()) {
+			std::cerr << res.error_msg() << std::endl;
+			return 1;
+		}
+	}
+	std::cout << b.report();
+
+	return 0;
+}
+
+int roundTrip(int argc, char *argv[], unsigned int threads) {
+	size_t slowest = 0;
+	std::string tracePath;
+	std::vector<std::string> files;
+	for (int i = 2; i < argc; i++) {
+		if (std::string("--trace") == argv[i] && i + 1 < argc) {
+			tracePath = argv[++i];
+		} else if (std::string("--slowest") == argv[i] && i + 1 < argc) {
+			unsigned int count;
+			if (!parsePositive(argv[++i], count)) {
+				std::cerr << "invalid count " << argv[i] << " for --slowest, expected a number of at least 1" << std::endl;
+				printUsage(argv[0]);
+				return 1;
+			}
+			slowest = count;
+		} else {
+			files.push_back(argv[i]);
+		}
+	}
+
+	RoundTrip rt(threads);
+	std::unique_ptr<Trace> trace;
+	if (!tracePath.empty()) {
+		trace.reset(new Trace(rt.threads()));
+	}
+	auto results = rt.run(files, trace.get());
+
+	if (trace) {
+		auto res = trace->write(tracePath);
+		if (!res.success()) {
+			std::cerr << res.error_msg() << std::endl;
+		}
+	}
+
+	size_t verified = 0, prototypes = 0;
+	for (auto &r : results) {
+		if (r.result.success()) {
+			verified++;
+			prototypes += r.prototypes;
+		} else {
+			std::cerr << r.file << ": " << r.result.error_msg() << std::endl;
+		}
+	}
+	std::cout << "round-trip: " << verified << "/" << results.size() << " files verified (" << prototypes << " prototypes)" << std::endl;
+
+	if (slowest > 0) {
+		std::vector<const RoundTripResult*> order;
+		for (auto &r : results) {
+			order.push_back(&r);
+		}
+		slowest = std::min(slowest, order.size());
+		std::partial_sort(order.begin(), order.begin() + slowest, order.end(), [](const RoundTripResult *a, const RoundTripResult *b) {
+			return a->duration > b->duration;
+		});
+
+		std::cout << "slowest files:" << std::endl;
+		for (size_t i = 0; i < slowest; i++) {
+			std::cout << "   " << order[i]->duration / 1000.0 << " ms  " << order[i]->file << " (" << order[i]->bytes << " bytes, " << order[i]->prototypes << " prototypes)" << std::endl;
+		}
+	}
+
+	return verified == results.size() ? 0 : 1;
+}
+
+// average time spent loading a chunk, not counting the disassembly text
+static double loadTime(const std::string &chunk, StripLevel strip, size_t iterations) {
+	Stats stats;
+	for (size_t i = 0; i < iterations; i++) {
+		Parser parser(new StringBuffer(chunk));
+		parser.setStats(&stats);
+		parser.setStrip(strip);
+		std::string out;
+		parser.parse(out);
+	}
+
+	uint64_t ns = 0;
+	for (int p = 0; p < Stats::NUM_PHASES; p++) {
+		if (p != Stats::FORMAT) {
+			ns += stats.wallTime((Stats::Phase)p);
+		}
+	}
+	return ns / 1e3 / iterations;
+}
+
+// rewrites a chunk with less debug information, in its own format unless one is given
+int strip(const char *input, const char *output, StripLevel level, const ChunkFormat *format, Stats *stats) {
+	std::string dump;
+	if (!Util::readFile(input, dump)) {
+		std::cerr << "could not open file " << input << std::endl;
+		return 1;
+	}
+
+	Parser parser(new StringBuffer(dump));
+	parser.setStats(stats);
+	parser.setStrip(level);
+	std::string disas;
+	auto res = parser.parse(disas);
+	if (!res.success()) {
+		std::cerr << input << ": " << res.error_msg() << std::endl;
+		return 1;
+	}
+
+	std::string chunk;
+	Dumper dumper(WriteBufferPtr(new StringWriteBuffer(chunk)), level, format ? *format : parser.format());
+	dumper.setStats(stats);
+	if (!(res = dumper.dump(*Dumper::fromFunction(parser.mainFunction()), parser.numUpvalues())).success()) {
+		std::cerr << res.error_msg() << std::endl;
+		return 1;
+	}
+
+	std::ofstream of(output, std::ifstream::binary);
+	if (!of.is_open()) {
+		std::cerr << "could not open file " << output << std::endl;
+		return 1;
+	}
+	of << chunk;
+	of.close();
+
+	const size_t iterations = 20;
+	double before = loadTime(dump, STRIP_NONE, iterations), after = loadTime(chunk, STRIP_NONE, iterations);
+	std::cout << input << ": " << dump.size() << " -> " << chunk.size() << " bytes (" << ((long long)dump.size() - (long long)chunk.size()) << " saved), load "
+		<< before << " -> " << after << " us" << std::endl;
+	return 0;
+}
+
+// writes the functions of a parsed chunk in one of the exported forms instead of assembly
+int exportFunctions(Parser &parser, const std::string &kind, const char *output, Stats *stats) {
+	Stats::Scope scope(stats, Stats::WRITE);
+	std::shared_ptr<FileWriteBuffer> wbuffer(new FileWriteBuffer(output));
+	if (!wbuffer->isOpen()) {
+		std::cerr << "could not open file " << output << std::endl;
+		return 1;
+	}
+
+	auto res = Exporter::create(kind, wbuffer)->write(parser.mainFunction(), parser.numUpvalues());
+	if (stats) {
+		stats->count(Stats::BYTES_OUT, wbuffer->written());
+	}
+	wbuffer.reset();
+	if (!res.success()) {
+		std::cerr << res.error_msg() << std::endl;
+		std::remove(output);
+		return 1;
+	}
+	return 0;
 }
 
 int main(int argc, char *argv[]) {
+	Stats stats;
+	Stats *pstats = nullptr;
+	bool printStats = false, allocStats = false;
+	Assembler::StackMode stackMode = Assembler::STACK_KEEP;
+	unsigned int optimizations = 0;
+	StripLevel stripLevel = STRIP_NONE;
+	bool stripGiven = false;
+	ChunkFormat format = ChunkFormat::native();
+	bool formatGiven = false;
+	bool verify = true;
+	bool streaming = false;
+	unsigned int threads = 0; // one per core
+	bool threadsGiven = false;
+	std::string emit = "text";
+
+	int n = 1;
+	for (int i = 1; i < argc; i++) {
+		if (std::string("--stats") == argv[i]) {
+			pstats = &stats;
+			printStats = true;
+		} else if (std::string("--alloc-stats") == argv[i]) {
+			pstats = &stats; // allocations are charged to the phases tracked by Stats
+			allocStats = true;
+		} else if (std::string("-O") == argv[i]) {
+			optimizations = Optimizer::OPT_ALL;
+		} else if (std::string("--opt") == argv[i] && i + 1 < argc) {
+			if (!Optimizer::parsePasses(argv[++i], optimizations)) {
+				std::cerr << "unknown optimization in " << argv[i] << std::endl;
+				return 1;
+			}
+		} else if (std::string("--strip") == argv[i] && i + 1 < argc) {
+			if (!Dumper::parseStripLevel(argv[++i], stripLevel)) {
+				std::cerr << "unknown strip level " << argv[i] << std::endl;
+				return 1;
+			}
+			stripGiven = true;
+		} else if (std::string("--format") == argv[i] && i + 1 < argc) {
+			if (!ChunkFormat::parse(argv[++i], format) || !format.unsupported().empty()) {
+				std::cerr << "unknown chunk format " << argv[i] << std::endl;
+				return 1;
+			}
+			formatGiven = true;
+		} else if (std::string("--no-verify") == argv[i]) {
+			verify = false;
+		} else if (std::string("--emit") == argv[i] && i + 1 < argc) {
+			emit = argv[++i];
+			if (emit != "text" && !Exporter::supported(emit)) {
+				std::cerr << "unknown output " << emit << std::endl;
+				return 1;
+			}
+		} else if (std::string("--stream") == argv[i]) {
+			streaming = true;
+		} else if (std::string("-j") == argv[i] && i + 1 < argc) {
+			if (!parsePositive(argv[++i], threads)) {
+				std::cerr << "invalid thread count " << argv[i] << ", expected a number of at least 1" << std::endl;
+				printUsage(argv[0]);
+				return 1;
+			}
+			threadsGiven = true;
+		} else if (std::string("--stack") == argv[i] && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == "validate") {
+				stackMode = Assembler::STACK_VALIDATE;
+			} else if (mode == "minimize") {
+				stackMode = Assembler::STACK_MINIMIZE;
+			} else {
+				std::cerr << "unknown stack mode " << mode << std::endl;
+				return 1;
+			}
+		} else {
+			argv[n++] = argv[i];
+		}
+	}
+	argc = n;
+
+	if (allocStats && !AllocStats::enable()) {
+		std::cerr << "allocation accounting is not built in, configure with -DLUADISASS_ALLOC_STATS=ON" << std::endl;
+		allocStats = false;
+	}
+
+	if (argc >= 3 && std::string("-r") == argv[1]) {
+		return roundTrip(argc, argv, threads);
+	}
+	if (argc >= 3 && std::string("-b") == argv[1]) {
+		return bench(argc, argv);
+	}
+
 	if (argc < 4) {
 		printUsage(argv[0]);
 		return 0;
 	}
 
-	if (std::string("-d") == argv[1]) {
-		std::ifstream file(argv[2], std::ifstream::binary);
-		if (!file.is_open()) {
-			std::cerr << "could not open file " << argv[2] << std::endl;
-			return 1;
+	if (std::string("-s") == argv[1]) {
+		int ret = strip(argv[2], argv[3], stripGiven ? stripLevel : STRIP_ALL, formatGiven ? &format : nullptr, pstats);
+		if (printStats) {
+			std::cerr << pstats->report();
 		}
-		file >> std::noskipws;
+		return ret;
+	}
 
-		std::string dump(std::istream_iterator<char>(file), (std::istream_iterator<char>()));
-		file.close();
+	if (std::string("-d") == argv[1]) {
+		std::string dump;
+		{
+			Stats::Scope scope(pstats, Stats::READ);
+			if (!Util::readFile(argv[2], dump)) {
+				std::cerr << "could not open file " << argv[2] << std::endl;
+				return 1;
+			}
+		}
+		if (pstats) {
+			pstats->count(Stats::BYTES_IN, dump.size());
+		}
 
 		Parser parser(new StringBuffer(std::move(dump)));
+		parser.setStats(pstats);
+		parser.setVerify(verify);
+		parser.setText(emit == "text");
 
 		std::string out;
 		auto res = parser.parse(out);
 		std::cout << "success: " << res.success() << " (" << res.error_msg() << ")" << std::endl;
 
-		if (res.success()) {
+		if (res.success() && emit != "text") {
+			if (exportFunctions(parser, emit, argv[3], pstats) != 0) {
+				return 1;
+			}
+		} else if (res.success()) {
+			Stats::Scope scope(pstats, Stats::WRITE);
 			std::ofstream of(argv[3], std::ifstream::binary);
 			if (!of.is_open()) {
 				std::cerr << "could not open file " << argv[3] << std::endl;
@@ -43,28 +387,80 @@ int main(int argc, char *argv[]) {
 			}
 			of << out;
 			of.close();
+			if (pstats) {
+				pstats->count(Stats::BYTES_OUT, out.size());
+			}
 		}
 
-	} else if (std::string("-a") == argv[1]) {
-		std::ifstream file(argv[2], std::ifstream::binary);
-		if (!file.is_open()) {
+	} else if (std::string("-a") == argv[1] && streaming) {
+		// the input is read and the output written as assembly goes, only the encoded functions
+		// are kept in memory
+		std::unique_ptr<FileBuffer> rbuffer(new FileBuffer(argv[2]));
+		if (!rbuffer->isOpen()) {
 			std::cerr << "could not open file " << argv[2] << std::endl;
 			return 1;
 		}
-		file >> std::noskipws;
+		if (pstats) {
+			pstats->count(Stats::BYTES_IN, rbuffer->remaining());
+		}
+		std::shared_ptr<FileWriteBuffer> wbuffer(new FileWriteBuffer(argv[3]));
+		if (!wbuffer->isOpen()) {
+			std::cerr << "could not open file " << argv[3] << std::endl;
+			return 1;
+		}
 
-		std::string dump(std::istream_iterator<char>(file), (std::istream_iterator<char>()));
-		file.close();
+		Assembler ass(rbuffer.release(), wbuffer);
+		ass.setStats(pstats);
+		ass.setStackMode(stackMode);
+		ass.setOptimizations(optimizations);
+		ass.setStrip(stripLevel);
+		ass.setFormat(format);
+		ass.setStreaming(true);
+		ass.setThreads(threadsGiven ? threads : 1);
+		auto res = ass.assemble();
+		std::cerr << "success: " << res.success() << " (" << res.error_msg() << ")" << std::endl;
+		for (const std::string &line : ass.report()) {
+			std::cerr << line << std::endl;
+		}
 
+		if (pstats) {
+			pstats->count(Stats::BYTES_OUT, wbuffer->written());
+		}
+		wbuffer.reset();
+		if (!res.success()) {
+			std::remove(argv[3]);
+		}
+	} else if (std::string("-a") == argv[1]) {
+		std::string dump;
+		{
+			Stats::Scope scope(pstats, Stats::READ);
+			if (!Util::readFile(argv[2], dump)) {
+				std::cerr << "could not open file " << argv[2] << std::endl;
+				return 1;
+			}
+		}
+		if (pstats) {
+			pstats->count(Stats::BYTES_IN, dump.size());
+		}
 
 		std::string str;
 		WriteBufferPtr wbuffer(new StringWriteBuffer(str));
 
 		Assembler ass(new StringBuffer(std::move(dump)), wbuffer);
+		ass.setStats(pstats);
+		ass.setStackMode(stackMode);
+		ass.setOptimizations(optimizations);
+		ass.setStrip(stripLevel);
+		ass.setFormat(format);
+		ass.setThreads(threadsGiven ? threads : 1);
 		auto res = ass.assemble();
 		std::cerr << "success: " << res.success() << " (" << res.error_msg() << ")" << std::endl;
+		for (const std::string &line : ass.report()) {
+			std::cerr << line << std::endl;
+		}
 
 		if (res.success()) {
+			Stats::Scope scope(pstats, Stats::WRITE);
 			std::ofstream of(argv[3], std::ifstream::binary);
 			if (!of.is_open()) {
 				std::cerr << "could not open file " << argv[3] << std::endl;
@@ -72,10 +468,21 @@ int main(int argc, char *argv[]) {
 			}
 			of << str;
 			of.close();
+			if (pstats) {
+				pstats->count(Stats::BYTES_OUT, str.size());
+			}
 		}
 	} else {
 		printUsage(argv[0]);
 	}
 
+	if (allocStats) {
+		AllocStats::disable();
+		std::cerr << AllocStats::report();
+	}
+	if (printStats) {
+		std::cerr << pstats->report();
+	}
+
 	return 0;
 }
\ No newline at end of file
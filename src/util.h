@@ -5,6 +5,10 @@
 #include <string>
 #include <cctype>
 #include <functional>
+#include <fstream>
+#include <iterator>
+#include "CharClass.h"
+#include "StringEscape.h"
 
 namespace Util {
 
@@ -20,53 +24,31 @@ namespace Util {
     };
 
 	static inline void trim(std::string &s) {
-		s.erase(s.begin(), std::find_if(s.begin(), s.end(), std::not1(std::ptr_fun<int, int>(std::isspace))));
-		s.erase(std::find_if(s.rbegin(), s.rend(), std::not1(std::ptr_fun<int, int>(std::isspace))).base(), s.end());
+		s.erase(s.begin(), std::find_if_not(s.begin(), s.end(), CharClass::isSpace));
+		s.erase(std::find_if_not(s.rbegin(), s.rend(), CharClass::isSpace).base(), s.end());
+	}
+
+	static inline bool readFile(const std::string &path, std::string &out) {
+		std::ifstream file(path, std::ifstream::binary);
+		if (!file.is_open()) {
+			return false;
+		}
+		out.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+		return true;
 	}
 
 	static inline void lower(std::string &s) {
-		std::transform(s.begin(), s.end(), s.begin(), std::ptr_fun<int, int>(std::tolower));
+		std::transform(s.begin(), s.end(), s.begin(), CharClass::lower);
+	}
+
+	// appends string to out with \a \b \f \n \r \t \v \\ \" \' escaped
+	static inline void escape(const std::string &string, std::string &out) {
+		StringEscape::escape(string.data(), string.size(), out);
 	}
 
 	static inline std::string escape(const std::string &string) {
 		std::string s;
-		for (char c : string) {
-			switch (c) {
-				case '\a':
-					s += "\\a";
-					break;
-				case '\b':
-					s += "\\b";
-					break;
-				case '\f':
-					s += "\\f";
-					break;
-				case '\n':
-					s += "\\n";
-					break;
-				case '\r':
-					s += "\\r";
-					break;
-				case '\t':
-					s += "\\t";
-					break;
-				case '\v':
-					s += "\\v";
-					break;
-				case '\\':
-					s += "\\\\";
-					break;
-				case '"':
-					s += "\\\"";
-					break;
-				case '\'':
-					s += "\\'";
-					break;
-				default:
-					s += c;
-					break;
-			}
-		}
+		escape(string, s);
 		return s;
 	}
 }